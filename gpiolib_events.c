@@ -0,0 +1,137 @@
+#include "gpiolib_events.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h> 				//for poll() over the line event file descriptors
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h> 		//GPIO character device line event interface
+
+//One line event file descriptor is kept per watched pin
+struct GPIO_Events
+{
+	int numLines;
+	struct pollfd fds[GPIO_EVENTS_MAX_LINES];
+	int pins[GPIO_EVENTS_MAX_LINES]; 	//pin of each line, in the same order as fds
+};
+
+//This function requests both-edge line events on every pin passed in
+//It returns NULL if the GPIO character device cannot be used (the caller should then fall back to polling)
+GPIO_Events* gpiolib_init_events(const char* consumer, const int* pins, int numPins)
+{
+	if(numPins <= 0 || numPins > GPIO_EVENTS_MAX_LINES)
+	{
+		return NULL;
+	}
+
+	//The chip file descriptor is only needed to request the lines, each line keeps its own descriptor afterwards
+	int chip = open(GPIO_CHIP_PATH, O_RDONLY | O_CLOEXEC);
+	if(chip < 0)
+	{
+		return NULL;
+	}
+
+	GPIO_Events* events = calloc(1, sizeof(GPIO_Events));
+	if(events == NULL)
+	{
+		close(chip);
+		return NULL;
+	}
+
+	for(int i = 0; i < numPins; i++)
+	{
+		struct gpioevent_request request;
+		memset(&request, 0, sizeof(request));
+
+		//Ask the kernel for a timestamped event on both the falling edge (beam broken)
+		//and the rising edge (beam restored) of this pin
+		request.lineoffset = pins[i];
+		request.handleflags = GPIOHANDLE_REQUEST_INPUT;
+		request.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+		strncpy(request.consumer_label, consumer, sizeof(request.consumer_label) - 1);
+
+		if(ioctl(chip, GPIO_GET_LINEEVENT_IOCTL, &request) < 0)
+		{
+			close(chip);
+			gpiolib_free_events(events);
+			return NULL;
+		}
+
+		events->fds[i].fd = request.fd;
+		events->fds[i].events = POLLIN;
+		events->pins[i] = pins[i];
+		events->numLines++;
+	}
+
+	close(chip);
+	return events;
+}
+
+//This function releases every requested line
+void gpiolib_free_events(GPIO_Events* events)
+{
+	if(events == NULL)
+	{
+		return;
+	}
+
+	for(int i = 0; i < events->numLines; i++)
+	{
+		close(events->fds[i].fd);
+	}
+	free(events);
+}
+
+//This function blocks until at least one edge arrives on a watched pin or until timeoutMs has passed
+//All pending edges are drained so that the next call only wakes on new ones
+//Returns the number of edges read (0 on timeout, -1 on error) and stores the kernel timestamp
+//of the most recent edge in timestampNs
+//If pinTimestampNs is not NULL (an array of 32, indexed by pin), the kernel timestamp of the most recent edge
+//of each pin 0-31 that changed is stored in it too, so that edges drained together keep their own times;
+//the entries of the other pins are left as they are
+int gpiolib_wait_events(GPIO_Events* events, int timeoutMs, uint64_t* timestampNs, uint64_t* pinTimestampNs)
+{
+	int ready = poll(events->fds, events->numLines, timeoutMs);
+	if(ready <= 0)
+	{
+		//A signal interrupting the wait is treated like a timeout
+		return (ready < 0 && errno != EINTR) ? -1 : 0;
+	}
+
+	int edges = 0;
+	for(int i = 0; i < events->numLines; i++)
+	{
+		if(!(events->fds[i].revents & POLLIN))
+		{
+			continue;
+		}
+
+		//Read as many queued events as fit in one call, poll() guarantees at least one is waiting
+		struct gpioevent_data data[16];
+		ssize_t bytes = read(events->fds[i].fd, data, sizeof(data));
+		if(bytes < 0)
+		{
+			return -1;
+		}
+
+		int count = bytes / sizeof(struct gpioevent_data);
+		for(int j = 0; j < count; j++)
+		{
+			if(timestampNs != NULL && data[j].timestamp > *timestampNs)
+			{
+				*timestampNs = data[j].timestamp;
+			}
+		}
+
+		//The events of one line are queued in order, so the last one read is the latest
+		int pin = events->pins[i];
+		if(count > 0 && pinTimestampNs != NULL && pin >= 0 && pin < 32)
+		{
+			pinTimestampNs[pin] = data[count - 1].timestamp;
+		}
+		edges += count;
+	}
+	return edges;
+}
@@ -0,0 +1,17 @@
+
+#ifndef GPIO_EVENTS_H
+#define GPIO_EVENTS_H
+
+#include <stdint.h>
+
+#define GPIO_CHIP_PATH        "/dev/gpiochip0"
+#define GPIO_EVENTS_MAX_LINES 32
+
+typedef struct GPIO_Events GPIO_Events;
+
+GPIO_Events* gpiolib_init_events(const char* consumer, const int* pins, int numPins);
+void         gpiolib_free_events(GPIO_Events* events);
+
+int          gpiolib_wait_events(GPIO_Events* events, int timeoutMs, uint64_t* timestampNs, uint64_t* pinTimestampNs);
+
+#endif /* GPIO_EVENTS_H */
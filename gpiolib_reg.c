@@ -0,0 +1,81 @@
+#include "gpiolib_addr.h"
+#include "gpiolib_reg.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h> 			//for mmap() and shm_open()
+#include <sys/stat.h>
+
+#define GPIO_MEM_PATH "/dev/gpiomem"
+
+//This function maps the GPIO register block
+//If GPIOLIB_SIM is set in the environment, the simulated backend is used instead of the hardware
+GPIO_Handle gpiolib_init_gpio(void)
+{
+	const char* sim = getenv(GPIOLIB_SIM_ENV);
+	if(sim != NULL && sim[0] != 0)
+	{
+		return gpiolib_init_sim(sim, 0);
+	}
+
+	//The /dev/gpiomem device exposes only the GPIO registers, so no root access is needed
+	int fd = open(GPIO_MEM_PATH, O_RDWR | O_SYNC | O_CLOEXEC);
+	if(fd < 0)
+	{
+		return NULL;
+	}
+
+	void* regs = mmap(NULL, GPIO_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, GPIO_BASE);
+
+	//The mapping stays valid after the file descriptor is closed
+	close(fd);
+
+	return (regs == MAP_FAILED) ? NULL : (GPIO_Handle)regs;
+}
+
+//This function maps a simulated register block from a file or a shared memory object
+//Another process (or the same one) drives the simulation by writing the GPLEV registers of the block
+//If create is set, the block is created and zeroed when it does not exist yet
+GPIO_Handle gpiolib_init_sim(const char* source, int create)
+{
+	int flags = O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0);
+	int fd;
+
+	if(strncmp(source, "shm:", 4) == 0)
+	{
+		fd = shm_open(source + 4, flags, 0600);
+	}
+	else
+	{
+		fd = open(source, flags, 0600);
+	}
+
+	if(fd < 0)
+	{
+		return NULL;
+	}
+
+	//Make sure the whole register block is backed before mapping it
+	struct stat st;
+	if(fstat(fd, &st) < 0 || (st.st_size < GPIO_LEN && ftruncate(fd, GPIO_LEN) < 0))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void* regs = mmap(NULL, GPIO_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	return (regs == MAP_FAILED) ? NULL : (GPIO_Handle)regs;
+}
+
+//This function unmaps the register block of either backend
+void gpiolib_free_gpio(GPIO_Handle handle)
+{
+	if(handle != NULL)
+	{
+		munmap(handle, GPIO_LEN);
+	}
+}
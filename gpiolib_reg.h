@@ -1,3 +1,4 @@
+
 #ifndef GPIO_REG_H
 #define GPIO_REG_H
 
@@ -5,10 +6,23 @@
 
 typedef uint32_t* GPIO_Handle;
 
+//Setting this environment variable selects the simulated backend instead of /dev/gpiomem
+//Its value is a file path, or "shm:<name>" for a POSIX shared memory object
+#define GPIOLIB_SIM_ENV "GPIOLIB_SIM"
+
 GPIO_Handle gpiolib_init_gpio(void);
+GPIO_Handle gpiolib_init_sim (const char* source, int create);
 void        gpiolib_free_gpio(GPIO_Handle handle);
 
-void        gpiolib_write_reg(GPIO_Handle handle,uint32_t offst, uint32_t data);
-uint32_t    gpiolib_read_reg (GPIO_Handle handle, uint32_t offst);
+//Both backends map the register block into memory, so register access is a plain load or store
+static inline void gpiolib_write_reg(GPIO_Handle handle, uint32_t offst, uint32_t data)
+{
+	((volatile uint32_t*)handle)[offst] = data;
+}
+
+static inline uint32_t gpiolib_read_reg(GPIO_Handle handle, uint32_t offst)
+{
+	return ((volatile uint32_t*)handle)[offst];
+}
 
 #endif /* GPIO_REG_H */
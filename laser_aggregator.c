@@ -0,0 +1,552 @@
+#define _GNU_SOURCE 		//for recvmmsg()
+#include "laser_fleet.h"
+#include "laser_time.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+//This program aggregates the counts of a fleet of counters into the occupancy of a building
+//It receives the datagrams of every counter's fleet sender (see laser_fleet.h), drops the duplicated and stale
+//events, and serves the building-wide counts in the Prometheus text format on a Unix socket
+//(e.g. curl --unix-socket /tmp/laser_aggregator.sock http://localhost/)
+//Usage: laser_aggregator [-l <address>]... [-s <query socket>]
+//Each -l adds an address to receive on ("unix:<path>" or "[host]:<port>"), by default ":7411"
+//Everything runs in one thread: a burst of datagrams is read with a single recvmmsg call
+
+#define AGGREGATOR_SOCKET_PATH "/tmp/laser_aggregator.sock"
+
+//Largest number of counters and receiving addresses
+#define AGGREGATOR_COUNTERS  4096
+#define AGGREGATOR_LISTENERS 8
+
+//Datagrams read by one recvmmsg call
+#define AGGREGATOR_BURST 32
+
+//Events a counter's duplicate window remembers behind the highest sequence number received
+#define AGGREGATOR_WINDOW 256
+
+//Previous boot numbers remembered per counter, whose late datagrams are dropped
+#define AGGREGATOR_OLD_BOOTS 4
+
+//Receive buffer asked for on every receiving socket (the kernel caps it at net.core.rmem_max)
+#define AGGREGATOR_RECEIVE_BUFFER (4 * 1024 * 1024)
+
+//Size the query page buffer starts at: it grows to fit the page when more counters are heard from
+#define AGGREGATOR_PAGE_SIZE (64 * 1024)
+
+//Longest a query client may take to accept the page before it is dropped, so a stalled client cannot hold
+//up the datagrams
+#define AGGREGATOR_SEND_TIMEOUT_MS 1000
+
+//Counts of one doorway, as of its latest event
+typedef struct
+{
+	uint64_t sequence; 		//sequence number of the event the counts come from, 0 if none yet
+	int64_t time;
+	int32_t numberIn;
+	int32_t numberOut;
+} AggregatedDoorway;
+
+//What the aggregator knows of one counter
+typedef struct
+{
+	uint32_t counterId;
+	uint32_t bootId;
+	uint32_t oldBoots[AGGREGATOR_OLD_BOOTS]; 	//boot numbers the counter has since moved on from, 0 if unused
+	int used;
+	int numDoorways;
+	uint64_t highest; 							//highest sequence number received
+	uint64_t window[AGGREGATOR_WINDOW / 64]; 	//sequence numbers received in the window below (and including) highest
+	unsigned long events; 						//distinct events received
+	unsigned long bootEvents; 					//distinct events received since the counter last started
+	unsigned long duplicates;
+	unsigned long stale; 						//datagrams of a previous boot that arrived after the new one
+	unsigned long restarts;
+	uint64_t lastSeenNs;
+	AggregatedDoorway doorways[LASER_MAX_DOORWAYS];
+} AggregatedCounter;
+
+typedef struct
+{
+	AggregatedCounter counters[AGGREGATOR_COUNTERS]; 	//open addressing on the counter id
+	int numCounters;
+	unsigned long datagrams;
+	unsigned long rejected; 							//datagrams that are not fleet datagrams
+	uint64_t startNs;
+} Aggregator;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int signal)
+{
+	(void)signal;
+	stopRequested = 1;
+}
+
+//This function finds the counter with id counterId, adding it if it is new
+//Returns NULL if the table is full
+static AggregatedCounter* findCounter(Aggregator* aggregator, uint32_t counterId)
+{
+	uint32_t slot = (counterId * 2654435761u) % AGGREGATOR_COUNTERS;
+	for(int i = 0; i < AGGREGATOR_COUNTERS; i++)
+	{
+		AggregatedCounter* counter = &aggregator->counters[(slot + i) % AGGREGATOR_COUNTERS];
+		if(counter->used && counter->counterId == counterId)
+		{
+			return counter;
+		}
+		if(!counter->used)
+		{
+			memset(counter, 0, sizeof(*counter));
+			counter->used = 1;
+			counter->counterId = counterId;
+			aggregator->numCounters++;
+			return counter;
+		}
+	}
+	return NULL;
+}
+
+//This function marks sequence as received in the duplicate window of a counter
+//Returns 1 if it was received before (or is too old for the window to tell), 0 if it is new
+static int seenBefore(AggregatedCounter* counter, uint64_t sequence)
+{
+	if(sequence > counter->highest)
+	{
+		//Slide the window up to the new highest sequence number
+		uint64_t shift = sequence - counter->highest;
+		if(shift >= AGGREGATOR_WINDOW)
+		{
+			memset(counter->window, 0, sizeof(counter->window));
+		}
+		else
+		{
+			for(uint64_t s = counter->highest + 1; s <= sequence; s++)
+			{
+				counter->window[(s / 64) % (AGGREGATOR_WINDOW / 64)] &= ~(1ull << (s % 64));
+			}
+		}
+		counter->highest = sequence;
+	}
+	else if(counter->highest - sequence >= AGGREGATOR_WINDOW)
+	{
+		return 1;
+	}
+
+	uint64_t* word = &counter->window[(sequence / 64) % (AGGREGATOR_WINDOW / 64)];
+	uint64_t bit = 1ull << (sequence % 64);
+	int seen = (*word & bit) != 0;
+	*word |= bit;
+	return seen;
+}
+
+//This function applies one datagram
+//Events can arrive late, twice or not at all: as they carry absolute counts, a doorway only takes an event
+//newer than the one its counts come from
+static void applyDatagram(Aggregator* aggregator, const uint8_t* datagram, size_t length)
+{
+	FleetHeader header;
+	if(length < sizeof(header))
+	{
+		aggregator->rejected++;
+		return;
+	}
+	memcpy(&header, datagram, sizeof(header));
+	if(header.magic != FLEET_MAGIC || header.version != FLEET_VERSION || header.count > FLEET_BATCH_EVENTS ||
+	   length != sizeof(header) + header.count * sizeof(FleetEvent) || header.sequence == 0)
+	{
+		aggregator->rejected++;
+		return;
+	}
+	aggregator->datagrams++;
+
+	AggregatedCounter* counter = findCounter(aggregator, header.counterId);
+	if(counter == NULL)
+	{
+		return;
+	}
+
+	//The boot numbers are random, so they have no order: a datagram of a boot the counter has moved on from
+	//arrived late, and its counts are older than the ones of the new boot
+	for(int i = 0; counter->bootId != header.bootId && i < AGGREGATOR_OLD_BOOTS; i++)
+	{
+		if(counter->oldBoots[i] == header.bootId && header.bootId != 0)
+		{
+			counter->stale++;
+			return;
+		}
+	}
+
+	//A new boot number means the counter restarted and numbers its events from 1 again
+	//(its counts carry on from its checkpoint, so they are simply the latest ones)
+	if(counter->bootId != header.bootId)
+	{
+		if(counter->events != 0)
+		{
+			counter->restarts++;
+			memmove(&counter->oldBoots[1], &counter->oldBoots[0], sizeof(counter->oldBoots) - sizeof(counter->oldBoots[0]));
+			counter->oldBoots[0] = counter->bootId;
+		}
+		counter->bootId = header.bootId;
+		counter->highest = 0;
+		counter->bootEvents = 0;
+		memset(counter->window, 0, sizeof(counter->window));
+		for(int i = 0; i < LASER_MAX_DOORWAYS; i++)
+		{
+			counter->doorways[i].sequence = 0;
+		}
+	}
+	counter->lastSeenNs = laserMonotonicNs();
+
+	for(int i = 0; i < header.count; i++)
+	{
+		FleetEvent event;
+		memcpy(&event, datagram + sizeof(header) + i * sizeof(FleetEvent), sizeof(event));
+		uint64_t sequence = header.sequence + i;
+
+		if(seenBefore(counter, sequence))
+		{
+			counter->duplicates++;
+			continue;
+		}
+		counter->events++;
+		counter->bootEvents++;
+
+		if(event.doorway >= LASER_MAX_DOORWAYS)
+		{
+			continue;
+		}
+		AggregatedDoorway* doorway = &counter->doorways[event.doorway];
+		if(sequence > doorway->sequence)
+		{
+			doorway->sequence = sequence;
+			doorway->time = event.time;
+			doorway->numberIn = event.numberIn;
+			doorway->numberOut = event.numberOut;
+		}
+		if(event.doorway >= counter->numDoorways)
+		{
+			counter->numDoorways = event.doorway + 1;
+		}
+	}
+}
+
+//Appends text to the page, keeping track of the room left
+#define PAGE_PRINTF(...) \
+	do{ \
+		int _n = snprintf(page + length, (length < size) ? size - length : 0, __VA_ARGS__); \
+		length += (_n > 0) ? (size_t)_n : 0; \
+	}while(0)
+
+//This function writes the building-wide and per counter counts into page in the Prometheus text format
+//Returns the length of the whole page: if it is size or more, the page did not fit and was cut short
+static size_t formatPage(const Aggregator* aggregator, char* page, size_t size)
+{
+	size_t length = 0;
+	uint64_t nowNs = laserMonotonicNs();
+
+	long totalIn = 0;
+	long totalOut = 0;
+	unsigned long events = 0;
+	unsigned long duplicates = 0;
+	unsigned long stale = 0;
+	for(int i = 0; i < AGGREGATOR_COUNTERS; i++)
+	{
+		const AggregatedCounter* counter = &aggregator->counters[i];
+		for(int j = 0; counter->used && j < counter->numDoorways; j++)
+		{
+			totalIn += counter->doorways[j].numberIn;
+			totalOut += counter->doorways[j].numberOut;
+		}
+		events += counter->events;
+		duplicates += counter->duplicates;
+		stale += counter->stale;
+	}
+
+	PAGE_PRINTF("# HELP laser_fleet_occupancy Objects in the building: entries minus exits over every counter.\n"
+	            "# TYPE laser_fleet_occupancy gauge\nlaser_fleet_occupancy %ld\n", totalIn - totalOut);
+	PAGE_PRINTF("# HELP laser_fleet_entered_total Entries over every counter.\n"
+	            "# TYPE laser_fleet_entered_total counter\nlaser_fleet_entered_total %ld\n", totalIn);
+	PAGE_PRINTF("# HELP laser_fleet_exited_total Exits over every counter.\n"
+	            "# TYPE laser_fleet_exited_total counter\nlaser_fleet_exited_total %ld\n", totalOut);
+	PAGE_PRINTF("# HELP laser_fleet_counters Counters heard from.\n"
+	            "# TYPE laser_fleet_counters gauge\nlaser_fleet_counters %d\n", aggregator->numCounters);
+	PAGE_PRINTF("# HELP laser_fleet_datagrams_total Datagrams received.\n"
+	            "# TYPE laser_fleet_datagrams_total counter\nlaser_fleet_datagrams_total %lu\n", aggregator->datagrams);
+	PAGE_PRINTF("# HELP laser_fleet_rejected_total Datagrams that were not fleet datagrams.\n"
+	            "# TYPE laser_fleet_rejected_total counter\nlaser_fleet_rejected_total %lu\n", aggregator->rejected);
+	PAGE_PRINTF("# HELP laser_fleet_events_total Distinct events received.\n"
+	            "# TYPE laser_fleet_events_total counter\nlaser_fleet_events_total %lu\n", events);
+	PAGE_PRINTF("# HELP laser_fleet_duplicates_total Events received more than once.\n"
+	            "# TYPE laser_fleet_duplicates_total counter\nlaser_fleet_duplicates_total %lu\n", duplicates);
+	PAGE_PRINTF("# HELP laser_fleet_stale_total Datagrams of a previous boot of their counter that arrived after the new one.\n"
+	            "# TYPE laser_fleet_stale_total counter\nlaser_fleet_stale_total %lu\n", stale);
+
+	PAGE_PRINTF("# HELP laser_fleet_counter_occupancy Entries minus exits of one counter.\n"
+	            "# TYPE laser_fleet_counter_occupancy gauge\n");
+	for(int i = 0; i < AGGREGATOR_COUNTERS; i++)
+	{
+		const AggregatedCounter* counter = &aggregator->counters[i];
+		if(!counter->used)
+		{
+			continue;
+		}
+		long occupancy = 0;
+		for(int j = 0; j < counter->numDoorways; j++)
+		{
+			occupancy += counter->doorways[j].numberIn - counter->doorways[j].numberOut;
+		}
+		PAGE_PRINTF("laser_fleet_counter_occupancy{counter=\"%u\"} %ld\n", counter->counterId, occupancy);
+	}
+
+	//Events the counter numbered but that never arrived (its snapshots make up for their counts)
+	PAGE_PRINTF("# HELP laser_fleet_counter_lost_total Events of one counter that never arrived since it last started.\n"
+	            "# TYPE laser_fleet_counter_lost_total counter\n");
+	for(int i = 0; i < AGGREGATOR_COUNTERS; i++)
+	{
+		const AggregatedCounter* counter = &aggregator->counters[i];
+		if(counter->used)
+		{
+			PAGE_PRINTF("laser_fleet_counter_lost_total{counter=\"%u\"} %lu\n", counter->counterId,
+			            (unsigned long)(counter->highest > counter->bootEvents ? counter->highest - counter->bootEvents : 0));
+		}
+	}
+
+	PAGE_PRINTF("# HELP laser_fleet_counter_silence_seconds Time since the last datagram of one counter.\n"
+	            "# TYPE laser_fleet_counter_silence_seconds gauge\n");
+	for(int i = 0; i < AGGREGATOR_COUNTERS; i++)
+	{
+		const AggregatedCounter* counter = &aggregator->counters[i];
+		if(counter->used)
+		{
+			PAGE_PRINTF("laser_fleet_counter_silence_seconds{counter=\"%u\"} %.3f\n", counter->counterId,
+			            (nowNs - counter->lastSeenNs) / 1e9);
+		}
+	}
+	return length;
+}
+
+//This function answers one query client with the page, as an HTTP response
+static void serveClient(const Aggregator* aggregator, int client)
+{
+	//Read (and ignore) the request, if the client sends one
+	struct pollfd request = {client, POLLIN, 0};
+	if(poll(&request, 1, 100) > 0)
+	{
+		char discard[1024];
+		ssize_t ignored = read(client, discard, sizeof(discard));
+		(void)ignored;
+	}
+
+	//The page grows with the number of counters: format it again into a larger buffer if it did not fit
+	static char* page = NULL;
+	static size_t capacity = 0;
+	size_t length = (page != NULL) ? formatPage(aggregator, page, capacity) : SIZE_MAX;
+	while(length >= capacity)
+	{
+		size_t grown = (length != SIZE_MAX) ? length + length / 4 : AGGREGATOR_PAGE_SIZE;
+		char* larger = realloc(page, grown);
+		if(larger == NULL)
+		{
+			return;
+		}
+		page = larger;
+		capacity = grown;
+		length = formatPage(aggregator, page, capacity);
+	}
+
+	struct timeval timeout = {AGGREGATOR_SEND_TIMEOUT_MS / 1000, (AGGREGATOR_SEND_TIMEOUT_MS % 1000) * 1000};
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	char head[128];
+	int headLength = snprintf(head, sizeof(head),
+	                          "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+	                          length);
+	if(send(client, head, headLength, MSG_NOSIGNAL) != headLength)
+	{
+		return;
+	}
+
+	//A page larger than the socket buffer goes out in several sends
+	for(size_t sent = 0; sent < length; )
+	{
+		ssize_t bytes = send(client, page + sent, length - sent, MSG_NOSIGNAL);
+		if(bytes < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(bytes <= 0)
+		{
+			return;
+		}
+		sent += (size_t)bytes;
+	}
+}
+
+//This function opens the Unix stream socket the queries are served on
+//Returns the listening socket, or -1 on error
+static int openQuerySocket(const char* path)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(address.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(address.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+	{
+		return -1;
+	}
+	unlink(path);
+	if(bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(fd, 16) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int main(const int argc, const char* const argv[])
+{
+	const char* addresses[AGGREGATOR_LISTENERS];
+	int numAddresses = 0;
+	const char* queryPath = AGGREGATOR_SOCKET_PATH;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-l") == 0 && i + 1 < argc && numAddresses < AGGREGATOR_LISTENERS)
+		{
+			addresses[numAddresses++] = argv[++i];
+		}
+		else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+		{
+			queryPath = argv[++i];
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [-l <address>]... [-s <query socket>]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	char defaultAddress[16];
+	if(numAddresses == 0)
+	{
+		snprintf(defaultAddress, sizeof(defaultAddress), ":%d", FLEET_PORT);
+		addresses[numAddresses++] = defaultAddress;
+	}
+
+	laserTimeInit();
+
+	//The listeners come first in the poll set, the query socket last
+	struct pollfd fds[AGGREGATOR_LISTENERS + 1];
+	for(int i = 0; i < numAddresses; i++)
+	{
+		fds[i].fd = laserFleetOpen(addresses[i], 1);
+		fds[i].events = POLLIN;
+		if(fds[i].fd < 0)
+		{
+			fprintf(stderr, "Cannot receive on %s: %s\n", addresses[i], strerror(errno));
+			return -1;
+		}
+
+		//Give the kernel room to queue a burst of the whole fleet while the page is being served
+		int bufferSize = AGGREGATOR_RECEIVE_BUFFER;
+		setsockopt(fds[i].fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+	}
+	fds[numAddresses].fd = openQuerySocket(queryPath);
+	fds[numAddresses].events = POLLIN;
+	if(fds[numAddresses].fd < 0)
+	{
+		fprintf(stderr, "Cannot serve on %s: %s\n", queryPath, strerror(errno));
+		return -1;
+	}
+
+	struct sigaction stop;
+	memset(&stop, 0, sizeof(stop));
+	stop.sa_handler = requestStop;
+	sigemptyset(&stop.sa_mask);
+	sigaction(SIGINT, &stop, NULL);
+	sigaction(SIGTERM, &stop, NULL);
+
+	static Aggregator aggregator;
+	aggregator.startNs = laserMonotonicNs();
+
+	//Buffers of one burst of datagrams
+	static uint8_t buffers[AGGREGATOR_BURST][FLEET_DATAGRAM_MAX + 1];
+	struct iovec vectors[AGGREGATOR_BURST];
+	struct mmsghdr messages[AGGREGATOR_BURST];
+
+	while(!stopRequested)
+	{
+		if(poll(fds, numAddresses + 1, -1) < 0)
+		{
+			continue;
+		}
+
+		for(int i = 0; i < numAddresses; i++)
+		{
+			if(!(fds[i].revents & POLLIN))
+			{
+				continue;
+			}
+
+			//Read every datagram waiting, a burst per system call
+			int received;
+			do
+			{
+				for(int j = 0; j < AGGREGATOR_BURST; j++)
+				{
+					vectors[j].iov_base = buffers[j];
+					vectors[j].iov_len = sizeof(buffers[j]);
+					memset(&messages[j].msg_hdr, 0, sizeof(messages[j].msg_hdr));
+					messages[j].msg_hdr.msg_iov = &vectors[j];
+					messages[j].msg_hdr.msg_iovlen = 1;
+				}
+
+				received = recvmmsg(fds[i].fd, messages, AGGREGATOR_BURST, MSG_DONTWAIT, NULL);
+				for(int j = 0; j < received; j++)
+				{
+					applyDatagram(&aggregator, buffers[j], messages[j].msg_len);
+				}
+			}
+			while(received == AGGREGATOR_BURST);
+		}
+
+		if(fds[numAddresses].revents & POLLIN)
+		{
+			int client = accept(fds[numAddresses].fd, NULL, NULL);
+			if(client >= 0)
+			{
+				serveClient(&aggregator, client);
+				close(client);
+			}
+		}
+	}
+
+	for(int i = 0; i < numAddresses; i++)
+	{
+		if(strncmp(addresses[i], "unix:", 5) == 0)
+		{
+			unlink(addresses[i] + 5);
+		}
+		close(fds[i].fd);
+	}
+	close(fds[numAddresses].fd);
+	unlink(queryPath);
+	return 0;
+}
@@ -0,0 +1,162 @@
+#include "laser_analytics.h"
+
+#include <string.h>
+
+//This function adds n to an aggregate only the sensing thread writes
+static void add(atomic_ulong* aggregate, unsigned long n)
+{
+	atomic_store_explicit(aggregate, atomic_load_explicit(aggregate, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+//This function moves a moving average a window's worth towards value
+static void average(atomic_ulong* ewma, unsigned long value)
+{
+	long previous = (long)atomic_load_explicit(ewma, memory_order_relaxed);
+	long next = previous + ((long)value - previous) / ANALYTICS_EWMA_MINUTES;
+	atomic_store_explicit(ewma, (unsigned long)next, memory_order_relaxed);
+}
+
+//This function returns the histogram bucket of value
+static int bucket(const uint32_t* bounds, int buckets, uint32_t value)
+{
+	int i = 0;
+	while(i < buckets - 1 && value > bounds[i])
+	{
+		i++;
+	}
+	return i;
+}
+
+static uint32_t toUs(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	return (us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us;
+}
+
+//This function sets up the analytics of numDoorways doorways whose beams are spacingMm apart
+void laserAnalyticsInit(LaserAnalytics* analytics, uint32_t spacingMm, int numDoorways)
+{
+	memset(analytics, 0, sizeof(*analytics));
+	analytics->spacingMm = spacingMm;
+	analytics->numDoorways = numDoorways;
+}
+
+//This function times the transition of one doorway's state machine from the machine state 'from',
+//taken at timeNs (only called when the state changed)
+//Returns 1 when the transition ends a crossing, whose record is then stored in crossing, 0 otherwise
+int laserAnalyticsTransition(LaserAnalytics* analytics, int doorway, uint8_t from, const LaserTransition* transition,
+                             uint64_t timeNs, LaserCrossing* crossing)
+{
+	LaserDoorwayAnalytics* timing = &analytics->doorways[doorway];
+	State previous = LASER_STATE(from);
+	State next = LASER_STATE(transition->next);
+
+	//The first beam breaks: a crossing starts
+	if(previous == BOTH_UNBROKEN && (next == ONLY_LASER1_BROKEN || next == ONLY_LASER2_BROKEN))
+	{
+		timing->startNs = timeNs;
+		timing->bothNs = 0;
+		timing->leaveNs = 0;
+		timing->openNs = timeNs;
+		return 0;
+	}
+
+	//Nothing to time before the counter has started, or once it is done
+	if(timing->startNs == 0)
+	{
+		return 0;
+	}
+
+	if(next == BOTH_BROKEN)
+	{
+		if(timing->bothNs == 0)
+		{
+			timing->bothNs = timeNs;
+		}
+		return 0;
+	}
+	if(previous == BOTH_BROKEN)
+	{
+		timing->leaveNs = timeNs;
+		return 0;
+	}
+	if(next != BOTH_UNBROKEN)
+	{
+		return 0;
+	}
+
+	//Both beams are unbroken again: the crossing is over, counted in, out, or abandoned (the object turned back)
+	crossing->startNs = timing->startNs;
+	crossing->direction = (transition->actions & ACT_COUNT_IN) ? CROSSING_IN :
+	                      (transition->actions & ACT_COUNT_OUT) ? CROSSING_OUT : CROSSING_ABANDONED;
+	crossing->durationUs = toUs(timeNs - timing->startNs);
+	crossing->leadUs = 0;
+	crossing->overlapUs = 0;
+	crossing->trailUs = 0;
+	crossing->speedMmS = 0;
+
+	add(&timing->crossings[crossing->direction], 1);
+	add(&timing->dwell[bucket(laserDwellBounds, ANALYTICS_DWELL_BUCKETS, crossing->durationUs)], 1);
+	add(&timing->dwellSumUs, crossing->durationUs);
+
+	//A counted crossing went through the both broken state, so it has all three phases
+	if(crossing->direction != CROSSING_ABANDONED)
+	{
+		uint64_t leadNs = timing->bothNs - timing->startNs;
+		uint64_t trailNs = timeNs - timing->leaveNs;
+		crossing->leadUs = toUs(leadNs);
+		crossing->overlapUs = toUs(timing->leaveNs - timing->bothNs);
+		crossing->trailUs = toUs(trailNs);
+
+		//The front of the object covers the spacing during the lead and its back during the trail
+		if(analytics->spacingMm != 0 && leadNs + trailNs != 0)
+		{
+			uint64_t speed = (uint64_t)analytics->spacingMm * 2000000000ull / (leadNs + trailNs);
+			crossing->speedMmS = (speed > UINT32_MAX) ? UINT32_MAX : (uint32_t)speed;
+			add(&timing->speed[bucket(laserSpeedBounds, ANALYTICS_SPEED_BUCKETS, crossing->speedMmS)], 1);
+			add(&timing->speedSumMmS, crossing->speedMmS);
+		}
+
+		add(&timing->leadSumUs, crossing->leadUs);
+		add(&timing->overlapSumUs, crossing->overlapUs);
+		add(&timing->trailSumUs, crossing->trailUs);
+	}
+
+	timing->busyNs += timeNs - timing->openNs;
+	timing->minuteCrossings++;
+	timing->startNs = 0;
+	return 1;
+}
+
+//This function closes every occupancy window that ended before timeNs and moves the averages
+//A crossing still in progress at the end of a window is split between the windows
+void laserAnalyticsRoll(LaserAnalytics* analytics, uint64_t timeNs)
+{
+	//The first window starts at the first sample
+	if(analytics->minuteEndNs == 0)
+	{
+		analytics->minuteEndNs = timeNs + ANALYTICS_MINUTE_NS;
+		return;
+	}
+
+	while(timeNs >= analytics->minuteEndNs)
+	{
+		uint64_t endNs = analytics->minuteEndNs;
+		for(int i = 0; i < analytics->numDoorways; i++)
+		{
+			LaserDoorwayAnalytics* timing = &analytics->doorways[i];
+			if(timing->startNs != 0)
+			{
+				timing->busyNs += endNs - timing->openNs;
+				timing->openNs = endNs;
+			}
+
+			uint64_t busyNs = (timing->busyNs < ANALYTICS_MINUTE_NS) ? timing->busyNs : ANALYTICS_MINUTE_NS;
+			average(&timing->occupancyPpm, (unsigned long)(busyNs * 1000000 / ANALYTICS_MINUTE_NS));
+			average(&timing->ratePerMinute, timing->minuteCrossings * 1000ul);
+			timing->busyNs = 0;
+			timing->minuteCrossings = 0;
+		}
+		analytics->minuteEndNs = endNs + ANALYTICS_MINUTE_NS;
+	}
+}
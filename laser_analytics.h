@@ -0,0 +1,90 @@
+
+#ifndef LASER_ANALYTICS_H
+#define LASER_ANALYTICS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "laser_fsm.h"
+
+//Length of the occupancy window, and the number of windows the moving averages are taken over
+#define ANALYTICS_MINUTE_NS   60000000000ull
+#define ANALYTICS_EWMA_MINUTES 15
+
+//Upper bounds of the crossing speed histogram, in millimetres per second (the last bucket is unbounded)
+#define ANALYTICS_SPEED_BUCKETS 9
+static const uint32_t laserSpeedBounds[ANALYTICS_SPEED_BUCKETS - 1] =
+{
+	250, 500, 750, 1000, 1250, 1500, 2000, 3000
+};
+
+//Upper bounds of the crossing duration histogram, in microseconds (the last bucket is unbounded)
+#define ANALYTICS_DWELL_BUCKETS 8
+static const uint32_t laserDwellBounds[ANALYTICS_DWELL_BUCKETS - 1] =
+{
+	250000, 500000, 1000000, 2000000, 5000000, 10000000, 30000000
+};
+
+//Directions a crossing is counted in, indexing LaserDoorwayAnalytics.crossings
+typedef enum{CROSSING_IN, CROSSING_OUT, CROSSING_ABANDONED, CROSSING_DIRECTIONS}CrossingDirection;
+
+//The record of one crossing: from the first beam breaking to both beams being unbroken again
+//An entry breaks laser 1, then both (the overlap), then only laser 2 (an exit the other way round)
+typedef struct
+{
+	uint64_t startNs; 			//monotonic time the first beam broke
+	CrossingDirection direction;
+	uint32_t durationUs; 		//dwell: time at least one beam was broken
+	uint32_t leadUs; 			//only the first beam broken, until both were
+	uint32_t overlapUs; 		//from both beams broken until the first one was clear again
+	uint32_t trailUs; 			//only the second beam broken, until both were clear
+	uint32_t speedMmS; 			//estimated from the beam spacing and the lead and trail times, 0 if unknown
+} LaserCrossing;
+
+//Timing of one doorway's crossings
+//The phase times and window sums are only used by the sensing thread, the aggregates are written by it
+//with relaxed stores and read by the metrics thread
+typedef struct
+{
+	uint64_t startNs; 			//crossing in progress, 0 if both beams are unbroken
+	uint64_t bothNs; 			//first time both beams were broken during it, 0 if not yet
+	uint64_t leaveNs; 			//last time it left the both broken state
+	uint64_t openNs; 			//start of the part of the crossing not yet added to busyNs
+	uint64_t busyNs; 			//time at least one beam was broken in the current minute
+	uint32_t minuteCrossings; 	//crossings completed in the current minute
+
+	atomic_ulong crossings[CROSSING_DIRECTIONS];
+	atomic_ulong speed[ANALYTICS_SPEED_BUCKETS]; 	//histogram of the counted crossings (not cumulative)
+	atomic_ulong speedSumMmS;
+	atomic_ulong dwell[ANALYTICS_DWELL_BUCKETS]; 	//histogram of every crossing (not cumulative)
+	atomic_ulong dwellSumUs;
+	atomic_ulong leadSumUs; 		//phase times summed over the counted crossings
+	atomic_ulong overlapSumUs;
+	atomic_ulong trailSumUs;
+	atomic_ulong occupancyPpm; 		//moving average of the fraction of each minute a beam was broken, in millionths
+	atomic_ulong ratePerMinute; 	//moving average of the crossings per minute, in thousandths
+} LaserDoorwayAnalytics;
+
+typedef struct
+{
+	uint32_t spacingMm; 		//distance between the two beams of a doorway
+	int numDoorways;
+	uint64_t minuteEndNs; 		//end of the current occupancy window, 0 before the first sample
+	LaserDoorwayAnalytics doorways[LASER_MAX_DOORWAYS];
+} LaserAnalytics;
+
+void laserAnalyticsInit      (LaserAnalytics* analytics, uint32_t spacingMm, int numDoorways);
+int  laserAnalyticsTransition(LaserAnalytics* analytics, int doorway, uint8_t from, const LaserTransition* transition,
+                              uint64_t timeNs, LaserCrossing* crossing);
+void laserAnalyticsRoll      (LaserAnalytics* analytics, uint64_t timeNs);
+
+//This function closes the occupancy windows that ended before timeNs (called for every sample)
+static inline void laserAnalyticsTick(LaserAnalytics* analytics, uint64_t timeNs)
+{
+	if(timeNs >= analytics->minuteEndNs)
+	{
+		laserAnalyticsRoll(analytics, timeNs);
+	}
+}
+
+#endif /* LASER_ANALYTICS_H */
@@ -0,0 +1,474 @@
+#include "laser_archive.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//Length of a segment file
+#define SEGMENT_LENGTH ((size_t)(ARCHIVE_SEGMENT_BLOCKS + 1) * ARCHIVE_BLOCK_SIZE)
+
+//This function returns block 'block' of a mapped segment
+static inline uint8_t* segmentBlock(const ArchiveSegment* segment, uint32_t block)
+{
+	return (uint8_t*)segment + (size_t)(block + 1) * ARCHIVE_BLOCK_SIZE;
+}
+
+//This function writes the path of segment 'number' into path (ARCHIVE_PATH_MAX + 16 characters)
+static void segmentPath(const char* directory, int number, char* path)
+{
+	snprintf(path, ARCHIVE_PATH_MAX + 16, "%s/%06d" ARCHIVE_SUFFIX, directory, number);
+}
+
+//This function appends a varint to a column of the open block: seven bits per byte, the high bit is set on every
+//byte but the last
+static void appendVarint(LaserArchive* archive, ArchiveColumn column, uint64_t value)
+{
+	uint8_t* out = archive->columns[column] + archive->block.columnBytes[column];
+	uint8_t* start = out;
+	while(value >= 0x80)
+	{
+		*out++ = (uint8_t)value | 0x80;
+		value >>= 7;
+	}
+	*out++ = (uint8_t)value;
+	archive->block.columnBytes[column] += (uint16_t)(out - start);
+}
+
+//This function reads a varint from a column, without going past its end
+//Returns 0 on success or -1 if the column ends inside the varint
+static int readVarint(const uint8_t** in, const uint8_t* end, uint64_t* value)
+{
+	uint64_t result = 0;
+	for(int shift = 0; *in < end && shift < 64; shift += 7)
+	{
+		uint8_t byte = *(*in)++;
+		result |= (uint64_t)(byte & 0x7f) << shift;
+		if(!(byte & 0x80))
+		{
+			*value = result;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+//This function maps segment 'number' of the archive read-write, creating it if create is set
+//Returns the segment, or NULL if it cannot be created or mapped, or is not a segment
+static ArchiveSegment* openSegment(const char* directory, int number, int create)
+{
+	char path[ARCHIVE_PATH_MAX + 16];
+	segmentPath(directory, number, path);
+
+	int fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+	if(fd < 0)
+	{
+		return NULL;
+	}
+
+	//A new segment is sized once and stays sparse until its blocks are written
+	struct stat st;
+	if(fstat(fd, &st) < 0 || (create && ftruncate(fd, SEGMENT_LENGTH) < 0) || (!create && (size_t)st.st_size != SEGMENT_LENGTH))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void* map = mmap(NULL, SEGMENT_LENGTH, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	ArchiveSegment* segment = map;
+	if(create)
+	{
+		segment->version = ARCHIVE_VERSION;
+		atomic_init(&segment->sequence, 0);
+
+		//The magic number is written last so that a reader never trusts a half initialized segment
+		atomic_thread_fence(memory_order_release);
+		segment->magic = ARCHIVE_MAGIC;
+	}
+	else if(segment->magic != ARCHIVE_MAGIC || segment->version != ARCHIVE_VERSION ||
+	        segment->numBlocks > ARCHIVE_SEGMENT_BLOCKS)
+	{
+		munmap(map, SEGMENT_LENGTH);
+		return NULL;
+	}
+	else
+	{
+		//A writer that died in the middle of an update left the sequence odd, and the readers would retry forever
+		atomic_store_explicit(&segment->sequence, 0, memory_order_release);
+	}
+	return segment;
+}
+
+//This function finds the segments of an archive
+//first and last are set to the lowest and highest segment numbers (0 if there is none)
+//Returns the number of segments, or -1 if the directory cannot be read
+int laserArchiveSegments(const char* directory, int* first, int* last)
+{
+	DIR* dir = opendir(directory);
+	if(dir == NULL)
+	{
+		return -1;
+	}
+
+	int count = 0;
+	*first = 0;
+	*last = 0;
+	struct dirent* entry;
+	while((entry = readdir(dir)) != NULL)
+	{
+		char* end;
+		long number = strtol(entry->d_name, &end, 10);
+		if(end == entry->d_name || strcmp(end, ARCHIVE_SUFFIX) != 0 || number <= 0 || number > 999999)
+		{
+			continue;
+		}
+		if(count == 0 || number < *first)
+		{
+			*first = (int)number;
+		}
+		if(count == 0 || number > *last)
+		{
+			*last = (int)number;
+		}
+		count++;
+	}
+	closedir(dir);
+	return count;
+}
+
+//This function unmaps the open segment, marking it full when the writer moves on from it
+static void closeSegment(LaserArchive* archive, int full)
+{
+	if(archive->segment != NULL)
+	{
+		archive->segment->full = full;
+		msync(archive->segment, SEGMENT_LENGTH, MS_ASYNC);
+		munmap(archive->segment, SEGMENT_LENGTH);
+		archive->segment = NULL;
+	}
+}
+
+//This function opens the archive in 'directory', creating the directory if needed
+//The last segment carries on where the previous run stopped, and its last block is reloaded as the open block
+//Returns 0 on success or -1 if the directory or the segment cannot be created
+int laserArchiveOpen(LaserArchive* archive, const char* directory)
+{
+	memset(archive, 0, sizeof(*archive));
+	if(strlen(directory) >= sizeof(archive->directory) || (mkdir(directory, 0755) < 0 && errno != EEXIST))
+	{
+		return -1;
+	}
+	strcpy(archive->directory, directory);
+
+	int first;
+	int last;
+	if(laserArchiveSegments(directory, &first, &last) < 0)
+	{
+		return -1;
+	}
+
+	if(last > 0)
+	{
+		archive->segment = openSegment(directory, last, 0);
+		archive->number = last;
+	}
+
+	//Start a new segment after a full or unreadable one, carrying on from the time of its last crossing
+	if(archive->segment == NULL || archive->segment->full || archive->segment->numBlocks == ARCHIVE_SEGMENT_BLOCKS)
+	{
+		if(archive->segment != NULL)
+		{
+			archive->lastUs = archive->segment->lastTimeNs / 1000;
+		}
+		closeSegment(archive, 1);
+		archive->number = last + 1;
+		archive->segment = openSegment(directory, archive->number, 1);
+		if(archive->segment == NULL)
+		{
+			return -1;
+		}
+	}
+
+	//Reload the last block, so that the next crossings are added to it
+	ArchiveSegment* segment = archive->segment;
+	if(segment->numBlocks > 0)
+	{
+		const uint8_t* image = segmentBlock(segment, segment->numBlocks - 1);
+		memcpy(&archive->block, image, sizeof(ArchiveBlock));
+
+		size_t offset = sizeof(ArchiveBlock);
+		for(int i = 0; i < ARCHIVE_COLUMNS; i++)
+		{
+			if(offset + archive->block.columnBytes[i] > ARCHIVE_BLOCK_SIZE)
+			{
+				//A damaged block is left as it is: the next crossing starts a new one
+				archive->block.count = ARCHIVE_BLOCK_CROSSINGS;
+				break;
+			}
+			memcpy(archive->columns[i], image + offset, archive->block.columnBytes[i]);
+			offset += archive->block.columnBytes[i];
+		}
+		archive->lastUs = archive->block.lastTimeNs / 1000;
+	}
+	return 0;
+}
+
+//This function writes the open block back and unmaps the segment
+void laserArchiveClose(LaserArchive* archive)
+{
+	closeSegment(archive, 0);
+}
+
+//This function appends a crossing to the archive
+//It encodes the crossing at the end of each column of the open block, then copies the block into the mapped segment:
+//no formatting and no system call, except when a segment is full and the next one is created (every few hundred
+//thousand crossings)
+void laserArchiveAdd(LaserArchive* archive, const ArchiveCrossing* crossing)
+{
+	if(archive->segment == NULL)
+	{
+		return;
+	}
+
+	//Move on to a new block when the longest record might not fit
+	ArchiveBlock* block = &archive->block;
+	size_t used = sizeof(ArchiveBlock);
+	for(int i = 0; i < ARCHIVE_COLUMNS; i++)
+	{
+		used += block->columnBytes[i];
+	}
+	if(block->count > 0 && (used + ARCHIVE_MAX_RECORD > ARCHIVE_BLOCK_SIZE || block->count >= ARCHIVE_BLOCK_CROSSINGS))
+	{
+		memset(block, 0, sizeof(*block));
+
+		//Move on to a new segment when every block is used
+		if(archive->segment->numBlocks == ARCHIVE_SEGMENT_BLOCKS)
+		{
+			msync(archive->segment, SEGMENT_LENGTH, MS_ASYNC);
+			closeSegment(archive, 1);
+			archive->segment = openSegment(archive->directory, ++archive->number, 1);
+			if(archive->segment == NULL)
+			{
+				return;
+			}
+		}
+	}
+
+	//Times never go backwards, within a block or from one block or segment to the next, even if the wall clock
+	//is stepped back: the index stays sorted for the binary search of the readers
+	int64_t us = crossing->timeNs / 1000;
+	if(us < archive->lastUs)
+	{
+		us = archive->lastUs;
+	}
+	if(block->count == 0)
+	{
+		block->firstTimeNs = us * 1000;
+		archive->lastUs = us;
+	}
+
+	appendVarint(archive, COLUMN_TIME, (uint64_t)(us - archive->lastUs));
+	archive->columns[COLUMN_KIND][block->columnBytes[COLUMN_KIND]++] =
+		(uint8_t)((crossing->doorway & ARCHIVE_DOORWAY_MASK) | (crossing->direction << ARCHIVE_DIRECTION_SHIFT));
+	appendVarint(archive, COLUMN_LEAD, crossing->leadUs);
+	appendVarint(archive, COLUMN_OVERLAP, crossing->overlapUs);
+	appendVarint(archive, COLUMN_TRAIL, crossing->trailUs);
+	block->lastTimeNs = us * 1000;
+	block->count++;
+	archive->lastUs = us;
+
+	//Copy the block into the segment and index it
+	ArchiveSegment* segment = archive->segment;
+	unsigned sequence = atomic_load_explicit(&segment->sequence, memory_order_relaxed);
+	atomic_store_explicit(&segment->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	if(block->count == 1)
+	{
+		segment->numBlocks++;
+	}
+	uint32_t current = segment->numBlocks - 1;
+	uint8_t* image = segmentBlock(segment, current);
+	memcpy(image, block, sizeof(*block));
+	size_t offset = sizeof(*block);
+	for(int i = 0; i < ARCHIVE_COLUMNS; i++)
+	{
+		memcpy(image + offset, archive->columns[i], block->columnBytes[i]);
+		offset += block->columnBytes[i];
+	}
+
+	segment->index[current].firstTimeNs = block->firstTimeNs;
+	segment->index[current].lastTimeNs = block->lastTimeNs;
+	if(segment->crossings == 0)
+	{
+		segment->firstTimeNs = block->firstTimeNs;
+	}
+	segment->lastTimeNs = block->lastTimeNs;
+	segment->crossings++;
+
+	atomic_store_explicit(&segment->sequence, sequence + 2, memory_order_release);
+}
+
+//This function maps segment 'number' of an archive read-only (used by the query tool)
+//Returns the segment, or NULL if it is missing or is not a segment
+ArchiveSegment* laserArchiveMapSegment(const char* directory, int number)
+{
+	char path[ARCHIVE_PATH_MAX + 16];
+	segmentPath(directory, number, path);
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		return NULL;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size != SEGMENT_LENGTH)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void* map = mmap(NULL, SEGMENT_LENGTH, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	ArchiveSegment* segment = map;
+	if(segment->magic != ARCHIVE_MAGIC || segment->version != ARCHIVE_VERSION)
+	{
+		munmap(map, SEGMENT_LENGTH);
+		return NULL;
+	}
+	return segment;
+}
+
+void laserArchiveUnmapSegment(ArchiveSegment* segment)
+{
+	munmap(segment, SEGMENT_LENGTH);
+}
+
+//This function copies a consistent snapshot of the header and index of a segment, which the counter may be writing
+//Returns the number of blocks, or -1 (errno EAGAIN) if the segment is still being updated after
+//ARCHIVE_READ_RETRIES copies, as when the counter died in the middle of an update
+int laserArchiveReadIndex(const ArchiveSegment* segment, ArchiveSegment* copy)
+{
+	unsigned before;
+	unsigned after;
+
+	for(int retries = 0; ; retries++)
+	{
+		before = atomic_load_explicit(&segment->sequence, memory_order_acquire);
+		memcpy((void*)copy, (const void*)segment, sizeof(*copy));
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&segment->sequence, memory_order_relaxed);
+		if(!(before & 1) && before == after)
+		{
+			break;
+		}
+		if(retries == ARCHIVE_READ_RETRIES)
+		{
+			errno = EAGAIN;
+			return -1;
+		}
+		sched_yield();
+	}
+
+	atomic_init(&copy->sequence, after);
+	if(copy->numBlocks > ARCHIVE_SEGMENT_BLOCKS)
+	{
+		copy->numBlocks = ARCHIVE_SEGMENT_BLOCKS;
+	}
+	return (int)copy->numBlocks;
+}
+
+//This function copies block 'block' of a segment consistently with the writer and decodes its crossings
+//crossings must have room for ARCHIVE_BLOCK_CROSSINGS crossings
+//Returns the number of crossings, -1 if the block is damaged, or -2 (errno EAGAIN) if the segment is still being
+//updated after ARCHIVE_READ_RETRIES copies
+int laserArchiveReadBlock(const ArchiveSegment* segment, uint32_t block, ArchiveCrossing* crossings)
+{
+	uint8_t image[ARCHIVE_BLOCK_SIZE];
+	unsigned before;
+	unsigned after;
+
+	for(int retries = 0; ; retries++)
+	{
+		before = atomic_load_explicit(&segment->sequence, memory_order_acquire);
+		memcpy(image, segmentBlock(segment, block), sizeof(image));
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&segment->sequence, memory_order_relaxed);
+		if(!(before & 1) && before == after)
+		{
+			break;
+		}
+		if(retries == ARCHIVE_READ_RETRIES)
+		{
+			errno = EAGAIN;
+			return -2;
+		}
+		sched_yield();
+	}
+
+	ArchiveBlock header;
+	memcpy(&header, image, sizeof(header));
+	if(header.count > ARCHIVE_BLOCK_CROSSINGS)
+	{
+		return -1;
+	}
+
+	//Find where each column starts and ends
+	const uint8_t* column[ARCHIVE_COLUMNS];
+	const uint8_t* end[ARCHIVE_COLUMNS];
+	size_t offset = sizeof(header);
+	for(int i = 0; i < ARCHIVE_COLUMNS; i++)
+	{
+		if(offset + header.columnBytes[i] > sizeof(image))
+		{
+			return -1;
+		}
+		column[i] = image + offset;
+		offset += header.columnBytes[i];
+		end[i] = image + offset;
+	}
+
+	int64_t us = header.firstTimeNs / 1000;
+	for(int i = 0; i < header.count; i++)
+	{
+		uint64_t delta;
+		uint64_t lead;
+		uint64_t overlap;
+		uint64_t trail;
+		if(readVarint(&column[COLUMN_TIME], end[COLUMN_TIME], &delta) < 0 || column[COLUMN_KIND] >= end[COLUMN_KIND] ||
+		   readVarint(&column[COLUMN_LEAD], end[COLUMN_LEAD], &lead) < 0 ||
+		   readVarint(&column[COLUMN_OVERLAP], end[COLUMN_OVERLAP], &overlap) < 0 ||
+		   readVarint(&column[COLUMN_TRAIL], end[COLUMN_TRAIL], &trail) < 0)
+		{
+			return -1;
+		}
+
+		uint8_t kind = *column[COLUMN_KIND]++;
+		us += (int64_t)delta;
+		crossings[i].timeNs = us * 1000;
+		crossings[i].doorway = kind & ARCHIVE_DOORWAY_MASK;
+		crossings[i].direction = kind >> ARCHIVE_DIRECTION_SHIFT;
+		crossings[i].leadUs = (uint32_t)lead;
+		crossings[i].overlapUs = (uint32_t)overlap;
+		crossings[i].trailUs = (uint32_t)trail;
+	}
+	return header.count;
+}
@@ -0,0 +1,110 @@
+
+#ifndef LASER_ARCHIVE_H
+#define LASER_ARCHIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define ARCHIVE_MAGIC   0x3141434C 	//"LCA1"
+#define ARCHIVE_VERSION 1
+
+//A segment file is a header block followed by up to ARCHIVE_SEGMENT_BLOCKS blocks of 4 KiB (about 1 MiB, a few
+//hundred thousand crossings); the file is sparse, so only the blocks written take space on the disk
+#define ARCHIVE_BLOCK_SIZE     4096
+#define ARCHIVE_SEGMENT_BLOCKS 250
+
+//Segment files are named <archive directory>/<number>.lca, numbered from 1
+#define ARCHIVE_SUFFIX ".lca"
+#define ARCHIVE_PATH_MAX 128
+
+//Number of copies a reader makes of a segment's index or of a block before it gives up on a consistent one
+#define ARCHIVE_READ_RETRIES 10000
+
+//Columns of a block, each a run of varints (the kinds are single bytes)
+typedef enum{COLUMN_TIME, COLUMN_KIND, COLUMN_LEAD, COLUMN_OVERLAP, COLUMN_TRAIL, ARCHIVE_COLUMNS}ArchiveColumn;
+
+//The kind byte packs the doorway in the low three bits and the direction (CrossingDirection) above them
+#define ARCHIVE_DOORWAY_MASK     0x07
+#define ARCHIVE_DIRECTION_SHIFT  3
+
+//Longest record: a 64-bit time delta, the kind and three 32-bit phase times
+#define ARCHIVE_MAX_RECORD (10 + 1 + 3 * 5)
+
+//One archived crossing
+typedef struct
+{
+	int64_t timeNs; 		//wall clock time it was counted, to the microsecond
+	uint8_t doorway;
+	uint8_t direction; 		//CROSSING_IN, CROSSING_OUT or CROSSING_ABANDONED
+	uint32_t leadUs; 		//phase times (see laser_analytics.h), 0 when the crossings are not analysed
+	uint32_t overlapUs;
+	uint32_t trailUs;
+} ArchiveCrossing;
+
+//Each block starts with the time of its first and last crossing and the length of its columns
+//The times of a block are deltas in microseconds from the previous crossing, starting from firstTimeNs,
+//so a block decodes on its own
+typedef struct
+{
+	int64_t firstTimeNs;
+	int64_t lastTimeNs;
+	uint16_t count;
+	uint16_t columnBytes[ARCHIVE_COLUMNS];
+	uint32_t reserved;
+} ArchiveBlock;
+
+//Most crossings a block can hold (every varint a single byte)
+#define ARCHIVE_BLOCK_CROSSINGS ((ARCHIVE_BLOCK_SIZE - sizeof(ArchiveBlock)) / ARCHIVE_COLUMNS)
+
+//Entry of the sparse time index: one per block
+typedef struct
+{
+	int64_t firstTimeNs;
+	int64_t lastTimeNs;
+} ArchiveIndexEntry;
+
+//Header block of a segment
+//Like the stats header, the sequence number is odd while the writer updates the segment
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	atomic_uint sequence;
+	uint32_t numBlocks; 		//blocks written, the last one may still be growing
+	uint64_t crossings;
+	int64_t firstTimeNs;
+	int64_t lastTimeNs;
+	uint32_t full; 				//the writer has moved on to the next segment
+	uint32_t reserved;
+	ArchiveIndexEntry index[ARCHIVE_SEGMENT_BLOCKS];
+} ArchiveSegment;
+
+_Static_assert(sizeof(ArchiveSegment) <= ARCHIVE_BLOCK_SIZE, "the index must fit in the header block");
+
+//The writer: the crossings of the open block are kept encoded column by column, and the block is copied into
+//the mapped segment after every crossing, so it never needs more than a store into memory
+typedef struct
+{
+	char directory[ARCHIVE_PATH_MAX];
+	int number; 				//number of the open segment
+	ArchiveSegment* segment;
+	uint8_t* blocks;
+
+	//Open block
+	uint8_t columns[ARCHIVE_COLUMNS][ARCHIVE_BLOCK_SIZE];
+	ArchiveBlock block;
+	int64_t lastUs; 			//time of the last crossing, in microseconds
+} LaserArchive;
+
+int  laserArchiveOpen (LaserArchive* archive, const char* directory);
+void laserArchiveAdd  (LaserArchive* archive, const ArchiveCrossing* crossing);
+void laserArchiveClose(LaserArchive* archive);
+
+int  laserArchiveSegments(const char* directory, int* first, int* last);
+ArchiveSegment* laserArchiveMapSegment(const char* directory, int number);
+void laserArchiveUnmapSegment(ArchiveSegment* segment);
+int  laserArchiveReadIndex(const ArchiveSegment* segment, ArchiveSegment* copy);
+int  laserArchiveReadBlock(const ArchiveSegment* segment, uint32_t block, ArchiveCrossing* crossings);
+
+#endif /* LASER_ARCHIVE_H */
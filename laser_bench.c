@@ -0,0 +1,401 @@
+#include "gpiolib_addr.h"
+#include "gpiolib_reg.h"
+#include "laser_counter.h"
+#include "laser_time.h"
+#include "laser_poll.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/resource.h> 		//for getrusage()
+
+//This program measures how fast the counting pipeline reacts
+//Synthetic beam traces are written into a simulated GPIO register block and the same sampling and
+//state machine code as the sensing loop in main() runs against it
+//Usage: laser_bench [repetitions]
+//The counts of every trace are checked: the program exits with status 1 if any trace is miscounted
+
+#define BENCH_SIM_PATH   "/tmp/laser_bench.gpio"
+#define BENCH_STATS_PATH "/tmp/laser_bench.stats"
+#define BENCH_PIN1       17
+#define BENCH_PIN2       27
+
+//Levels of the two beams: a beam reads high while its laser reaches the photodiode
+#define CLEAR  ((1u << BENCH_PIN1) | (1u << BENCH_PIN2))
+#define CUT1   (1u << BENCH_PIN2)
+#define CUT2   (1u << BENCH_PIN1)
+#define CUT12  0u
+
+//A trace is a list of level samples, one per sensing loop iteration, and the counts one pass of it must give
+typedef struct
+{
+	const char* name;
+	const uint32_t* levels;
+	int length;
+	int expectedIn;
+	int expectedOut;
+} Trace;
+
+//One person walking in, then one walking out
+static const uint32_t walkThrough[] = {CLEAR, CUT1, CUT12, CUT2, CLEAR, CUT2, CUT12, CUT1, CLEAR};
+
+//Two people entering back to back: the second breaks laser 1 before the first has cleared laser 2
+static const uint32_t tailgating[] = {CLEAR, CUT1, CUT12, CUT2, CUT12, CUT2, CLEAR, CUT1, CUT12, CUT2, CLEAR};
+
+//A partial occlusion bouncing on both edges of laser 1 before a normal crossing
+static const uint32_t jitter[] = {CLEAR, CUT1, CLEAR, CUT1, CLEAR, CUT1, CUT12, CUT1, CUT12, CUT2, CLEAR, CUT2, CLEAR};
+
+//Laser 2 stuck broken while laser 1 keeps toggling
+static const uint32_t stuckBeam[] = {CLEAR, CUT2, CUT12, CUT2, CUT12, CUT2, CUT12, CUT2, CUT12, CUT2, CLEAR};
+
+static const Trace traces[] =
+{
+	{"walk-through", walkThrough, sizeof(walkThrough) / sizeof(walkThrough[0]), 1, 1},
+	{"tailgating",   tailgating,  sizeof(tailgating) / sizeof(tailgating[0]),   2, 0},
+	{"jitter",       jitter,      sizeof(jitter) / sizeof(jitter[0]),           1, 0},
+	{"stuck beam",   stuckBeam,   sizeof(stuckBeam) / sizeof(stuckBeam[0]),     0, 0},
+};
+
+static int compareLatency(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+//This function returns the CPU time (user and system) used by the process in nanoseconds
+static uint64_t cpuNs(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return ((uint64_t)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ull +
+	       ((uint64_t)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ull;
+}
+
+//This function replays a trace 'repetitions' times through the simulated GPIO and the counter
+//It reports the sample rate, the latency from writing an edge to the end of its count update, and the CPU usage
+//Returns 0 if the trace was counted as expected or -1 if the counts differ, so that a logic change that
+//miscounts cannot pass as a speed-up
+static int benchTrace(const Trace* trace, int repetitions, GPIO_Handle gpio, LaserLog* log, LaserStats* stats)
+{
+	static LaserCounter counter;
+	memset(&counter, 0, sizeof(counter));
+	laserCounterAddDoorway(&counter, BENCH_PIN1, BENCH_PIN2);
+	counter.log = log;
+	counter.stats = stats;
+
+	size_t capacity = (size_t)trace->length * repetitions;
+	uint64_t* latencies = malloc(capacity * sizeof(uint64_t));
+	size_t numLatencies = 0;
+	long samples = 0;
+
+	uint64_t cpuStart = cpuNs();
+	uint64_t wallStart = laserMonotonicNs();
+
+	for(int r = 0; r < repetitions; r++)
+	{
+		for(int i = 0; i < trace->length; i++)
+		{
+			//The edge happens when the simulated level register changes
+			gpiolib_write_reg(gpio, GPLEV(0), trace->levels[i]);
+			uint64_t edgeNs = laserMonotonicNs();
+
+			//Same steps as one iteration of the sensing loop in main()
+			uint32_t levels = gpiolib_read_reg(gpio, GPLEV(0));
+			uint64_t sampleNs = laserMonotonicNs();
+			unsigned actions = laserCounterProcess(&counter, levels, sampleNs, edgeNs);
+
+			if(actions != 0)
+			{
+				latencies[numLatencies++] = laserMonotonicNs() - edgeNs;
+			}
+			samples++;
+		}
+	}
+
+	uint64_t wallNs = laserMonotonicNs() - wallStart;
+	uint64_t usedNs = cpuNs() - cpuStart;
+
+	qsort(latencies, numLatencies, sizeof(uint64_t), compareLatency);
+	uint64_t p50 = numLatencies ? latencies[numLatencies / 2] : 0;
+	uint64_t p99 = numLatencies ? latencies[numLatencies * 99 / 100] : 0;
+
+	const LaserCounts* counts = &counter.doorways[0].counts;
+	printf("%-14s %12.0f %10llu %10llu %7.1f%%   in %d out %d\n", trace->name,
+	       samples * 1e9 / (wallNs ? wallNs : 1), (unsigned long long)p50, (unsigned long long)p99,
+	       100.0 * usedNs / (wallNs ? wallNs : 1), counts->numberIn, counts->numberOut);
+
+	free(latencies);
+
+	if(counts->numberIn != trace->expectedIn * repetitions || counts->numberOut != trace->expectedOut * repetitions)
+	{
+		fprintf(stderr, "%s: expected in %d out %d\n", trace->name, trace->expectedIn * repetitions,
+		        trace->expectedOut * repetitions);
+		return -1;
+	}
+	return 0;
+}
+
+//This function compares the cost of the old synchronous PRINT_MSG and outputStats with their replacements
+static void benchOutput(int repetitions, LaserLog* log, LaserStats* stats)
+{
+	FILE* devNull = fopen("/dev/null", "w");
+	LaserTimeCache cache = {-1, ""};
+	char Time[LASER_TIME_LEN];
+	LaserCounts counts = {1, 2, 3, 4};
+
+	//PRINT_MSG: format the time, fprintf and fflush for every message
+	uint64_t start = laserMonotonicNs();
+	for(int i = 0; i < repetitions; i++)
+	{
+		laserFormatTime(&cache, laserMonotonicNs(), Time);
+		fprintf(devNull, "%s : %s : %s", Time, "laser_bench", "Laser 1 has been broken.\n\n");
+		fflush(devNull);
+	}
+	uint64_t printNs = laserMonotonicNs() - start;
+
+	//LOG_MSG: one queued record
+	start = laserMonotonicNs();
+	for(int i = 0; i < repetitions; i++)
+	{
+		LOG_MSG(log, LOG_SINK_LOG, laserMonotonicNs(), "Laser 1 has been broken.\n\n");
+	}
+	uint64_t postNs = laserMonotonicNs() - start;
+
+	//Old outputStats: four sprintf calls, the time and four flushed messages
+	start = laserMonotonicNs();
+	for(int i = 0; i < repetitions; i++)
+	{
+		char line[4][50];
+		sprintf(line[0], "Laser 1 was broken %d times\n\n", counts.laser1Count);
+		sprintf(line[1], "Laser 2 was broken %d times\n\n", counts.laser2Count);
+		sprintf(line[2], "%d objects entered the room\n\n", counts.numberIn);
+		sprintf(line[3], "%d objects exitted the room\n\n", counts.numberOut);
+		laserFormatTime(&cache, laserMonotonicNs(), Time);
+		for(int j = 0; j < 4; j++)
+		{
+			fprintf(devNull, "%s : %s : %s", Time, "laser_bench", line[j]);
+			fflush(devNull);
+		}
+	}
+	uint64_t textStatsNs = laserMonotonicNs() - start;
+
+	//laserStatsUpdate: counts stored in place in the mapped stats file
+	start = laserMonotonicNs();
+	for(int i = 0; i < repetitions; i++)
+	{
+		laserStatsUpdate(stats, 0, &counts, ACT_STATS, laserWallNs(laserMonotonicNs()));
+	}
+	uint64_t mappedStatsNs = laserMonotonicNs() - start;
+
+	fclose(devNull);
+
+	printf("\nPer call (ns):\n");
+	printf("  PRINT_MSG (fprintf + fflush)       %8.1f\n", (double)printNs / repetitions);
+	printf("  LOG_MSG (queued record)            %8.1f\n", (double)postNs / repetitions);
+	printf("  outputStats (text, 4 flushes)      %8.1f\n", (double)textStatsNs / repetitions);
+	printf("  laserStatsUpdate (mapped header)   %8.1f\n", (double)mappedStatsNs / repetitions);
+}
+
+//Crossings walked through the simulated doorway for each polling bound, and the time each beam phase holds
+#define POLL_CROSSINGS 20
+#define POLL_PHASE_NS  5000000
+
+//Detection latency bounds compared, in microseconds (0 spins all the time, as the loop used to)
+static const uint32_t pollBounds[] = {0, 100, 500, 2000, 10000};
+
+//A person walking through the simulated doorway at random times, driven from a second thread
+typedef struct
+{
+	GPIO_Handle gpio;
+	atomic_uint_least64_t edgeNs; 	//time the first beam of the latest crossing broke, 0 once it has been seen
+	atomic_int done;
+} PollWalker;
+
+static void sleepNs(uint64_t ns)
+{
+	struct timespec pause = {(time_t)(ns / 1000000000), (long)(ns % 1000000000)};
+	nanosleep(&pause, NULL);
+}
+
+static void* walkThread(void* arg)
+{
+	PollWalker* walker = arg;
+	static const uint32_t crossing[] = {CUT1, CUT12, CUT2, CLEAR};
+
+	for(int i = 0; i < POLL_CROSSINGS; i++)
+	{
+		//Idle for 50 to 150 ms, so that the polling loop has backed off when the next crossing starts
+		sleepNs(50000000 + (uint64_t)(rand() % 100000) * 1000);
+
+		gpiolib_write_reg(walker->gpio, GPLEV(0), crossing[0]);
+		atomic_store(&walker->edgeNs, laserMonotonicNs());
+		for(int j = 1; j < 4; j++)
+		{
+			sleepNs(POLL_PHASE_NS);
+			gpiolib_write_reg(walker->gpio, GPLEV(0), crossing[j]);
+		}
+	}
+	sleepNs(50000000);
+	atomic_store(&walker->done, 1);
+	return NULL;
+}
+
+//This function returns the CPU time used by the calling thread in nanoseconds
+static uint64_t threadCpuNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//This function runs the adaptive polling loop of main() against crossings walked at random times, for each
+//detection latency bound
+//It reports the time from the first beam of each crossing breaking to the loop seeing it, the CPU the loop uses while
+//nobody walks through and over the whole run, and the crossings counted: the trade-off between idle CPU and latency
+static void benchPolling(GPIO_Handle gpio)
+{
+	printf("\nAdaptive polling (%d crossings at random times, %d ms per beam phase):\n", POLL_CROSSINGS,
+	       POLL_PHASE_NS / 1000000);
+	printf("%-12s %10s %10s %10s %9s %8s %8s %9s\n", "bound us", "p50 us", "p99 us", "max us", "idle cpu", "cpu", "sleeps",
+	       "counted");
+
+	for(size_t b = 0; b < sizeof(pollBounds) / sizeof(pollBounds[0]); b++)
+	{
+		static LaserCounter counter;
+		memset(&counter, 0, sizeof(counter));
+		laserCounterAddDoorway(&counter, BENCH_PIN1, BENCH_PIN2);
+
+		LaserPoll poll;
+		laserPollInit(&poll, pollBounds[b]);
+
+		//Measure the CPU the loop uses while nobody walks through, for a quarter of a second
+		gpiolib_write_reg(gpio, GPLEV(0), CLEAR);
+		uint64_t idleCpuStart = threadCpuNs();
+		uint64_t idleStart = laserMonotonicNs();
+		while(laserMonotonicNs() - idleStart < 250000000)
+		{
+			uint32_t levels = gpiolib_read_reg(gpio, GPLEV(0));
+			laserCounterProcess(&counter, levels, laserMonotonicNs(), 0);
+			uint64_t sleep = laserPollNext(&poll, laserCounterBusy(&counter));
+			if(sleep != 0)
+			{
+				laserPollSleep(laserMonotonicNs() + sleep);
+			}
+		}
+		double idleCpu = 100.0 * (threadCpuNs() - idleCpuStart) / (laserMonotonicNs() - idleStart);
+
+		PollWalker walker = {gpio, 0, 0};
+		pthread_t walking;
+		pthread_create(&walking, NULL, walkThread, &walker);
+
+		uint64_t latencies[POLL_CROSSINGS];
+		int numLatencies = 0;
+		long sleeps = 0;
+		uint64_t cpuStart = threadCpuNs();
+		uint64_t wallStart = laserMonotonicNs();
+
+		//Same steps as the polling loop in main()
+		while(!atomic_load(&walker.done))
+		{
+			uint32_t levels = gpiolib_read_reg(gpio, GPLEV(0));
+			uint64_t sampleNs = laserMonotonicNs();
+			laserCounterProcess(&counter, levels, sampleNs, 0);
+
+			uint64_t edgeNs = atomic_load(&walker.edgeNs);
+			if(edgeNs != 0 && laserCounterBusy(&counter))
+			{
+				if(numLatencies < POLL_CROSSINGS)
+				{
+					latencies[numLatencies++] = sampleNs - edgeNs;
+				}
+				atomic_store(&walker.edgeNs, 0);
+			}
+
+			uint64_t nowNs = laserMonotonicNs();
+			uint64_t sleep = laserPollNext(&poll, laserCounterBusy(&counter));
+			if(sleep != 0)
+			{
+				laserPollSleep(nowNs + sleep);
+				sleeps++;
+			}
+		}
+
+		uint64_t usedNs = threadCpuNs() - cpuStart;
+		uint64_t wallNs = laserMonotonicNs() - wallStart;
+		pthread_join(walking, NULL);
+
+		qsort(latencies, numLatencies, sizeof(uint64_t), compareLatency);
+		uint64_t p50 = numLatencies ? latencies[numLatencies / 2] : 0;
+		uint64_t p99 = numLatencies ? latencies[numLatencies * 99 / 100] : 0;
+		uint64_t max = numLatencies ? latencies[numLatencies - 1] : 0;
+
+		char bound[16];
+		snprintf(bound, sizeof(bound), pollBounds[b] ? "%u" : "spin", pollBounds[b]);
+		printf("%-12s %10.1f %10.1f %10.1f %8.1f%% %7.1f%% %8ld %6d/%d\n", bound, p50 / 1e3, p99 / 1e3, max / 1e3, idleCpu,
+		       100.0 * usedNs / (wallNs ? wallNs : 1), sleeps, counter.doorways[0].counts.numberIn, POLL_CROSSINGS);
+	}
+}
+
+int main(const int argc, const char* const argv[])
+{
+	int repetitions = (argc > 1) ? atoi(argv[1]) : 100000;
+	if(repetitions <= 0)
+	{
+		fprintf(stderr, "Usage: %s [repetitions]\n", argv[0]);
+		return -1;
+	}
+
+	laserTimeInit();
+
+	//Simulated register block driven by this program
+	GPIO_Handle gpio = gpiolib_init_sim(BENCH_SIM_PATH, 1);
+	if(gpio == NULL)
+	{
+		perror("The simulated GPIO could not be created");
+		return -1;
+	}
+
+	//Messages go to /dev/null so that only the cost of producing them is measured
+	FILE* devNull = fopen("/dev/null", "w");
+	static LaserLog log;
+	LaserStats stats;
+	if(laserLogStart(&log, devNull, "laser_bench", 1, LOG_BATCH) < 0 ||
+	   laserStatsOpen(&stats, BENCH_STATS_PATH, "laser_bench", 1, STATS_JOURNAL_RECORDS) < 0)
+	{
+		perror("The benchmark could not be set up");
+		return -1;
+	}
+
+	int miscounted = 0;
+	printf("%-14s %12s %10s %10s %8s\n", "trace", "samples/s", "p50 ns", "p99 ns", "cpu");
+	for(size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); i++)
+	{
+		if(benchTrace(&traces[i], repetitions, gpio, &log, &stats) < 0)
+		{
+			miscounted++;
+		}
+	}
+
+	benchOutput(repetitions, &log, &stats);
+	benchPolling(gpio);
+
+	laserLogStop(&log);
+	printf("\nLog records dropped: %lu\n", (unsigned long)atomic_load(&log.dropped));
+
+	laserStatsClose(&stats);
+	gpiolib_free_gpio(gpio);
+	fclose(devNull);
+	unlink(BENCH_SIM_PATH);
+	unlink(BENCH_STATS_PATH);
+
+	if(miscounted > 0)
+	{
+		fprintf(stderr, "%d trace(s) were miscounted\n", miscounted);
+		return 1;
+	}
+	return 0;
+}
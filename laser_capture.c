@@ -0,0 +1,310 @@
+#include "laser_capture.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "laser_time.h"
+
+//This function returns block 'slot' of the ring
+static inline CaptureBlock* captureBlock(const LaserCapture* capture, uint64_t slot)
+{
+	return (CaptureBlock*)(capture->blocks + (slot % capture->header->numBlocks) * capture->header->blockSize);
+}
+
+//This function maps a ring file of the given length and checks that it is a capture ring
+//Returns 0 on success or -1 on failure
+static int mapRing(LaserCapture* capture, int fd, size_t length, int prot)
+{
+	void* map = mmap(NULL, length, prot, MAP_SHARED | ((prot & PROT_WRITE) ? MAP_POPULATE : 0), fd, 0);
+	if(map == MAP_FAILED)
+	{
+		return -1;
+	}
+
+	capture->header = map;
+	capture->blocks = (uint8_t*)map + CAPTURE_BLOCK_SIZE;
+	capture->length = length;
+	capture->block = NULL;
+	capture->levels = 0;
+	capture->lastNs = 0;
+	return 0;
+}
+
+//This function opens the ring file, creating or resetting it if it does not have the requested layout
+//An existing ring with the same layout is kept, so the edges of earlier runs stay on disk until overwritten
+//The file is populated up front, so capturing an edge never faults in a page
+//Returns 0 on success or -1 if the file cannot be created or mapped
+int laserCaptureOpen(LaserCapture* capture, const char* path, uint32_t pinMask, uint32_t numBlocks)
+{
+	size_t length = (size_t)(numBlocks + 1) * CAPTURE_BLOCK_SIZE;
+
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd < 0)
+	{
+		return -1;
+	}
+
+	struct stat st;
+	int keep = (fstat(fd, &st) == 0 && (size_t)st.st_size == length);
+	if(!keep && ftruncate(fd, length) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	int result = mapRing(capture, fd, length, PROT_READ | PROT_WRITE);
+	close(fd);
+	if(result < 0)
+	{
+		return -1;
+	}
+
+	CaptureHeader* header = capture->header;
+	if(keep && header->magic == CAPTURE_MAGIC && header->version == CAPTURE_VERSION &&
+	   header->blockSize == CAPTURE_BLOCK_SIZE && header->numBlocks == numBlocks && header->pinMask == pinMask)
+	{
+		return 0;
+	}
+
+	//Start an empty ring
+	memset(capture->header, 0, length);
+	header->version = CAPTURE_VERSION;
+	header->blockSize = CAPTURE_BLOCK_SIZE;
+	header->numBlocks = numBlocks;
+	header->pinMask = pinMask;
+	atomic_init(&header->next, 0);
+
+	//The magic number is written last so that a reader never trusts a half initialized header
+	atomic_thread_fence(memory_order_release);
+	header->magic = CAPTURE_MAGIC;
+	return 0;
+}
+
+//This function maps an existing ring file read-only (used for replay)
+//Returns 0 on success or -1 if the file is missing or is not a capture ring
+int laserCaptureMap(LaserCapture* capture, const char* path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		return -1;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size < CAPTURE_BLOCK_SIZE)
+	{
+		close(fd);
+		return -1;
+	}
+
+	int result = mapRing(capture, fd, st.st_size, PROT_READ);
+	close(fd);
+	if(result < 0)
+	{
+		return -1;
+	}
+
+	//Reject files that are not rings or whose blocks do not fit in the file
+	const CaptureHeader* header = capture->header;
+	if(header->magic != CAPTURE_MAGIC || header->version != CAPTURE_VERSION ||
+	   header->blockSize != CAPTURE_BLOCK_SIZE || header->numBlocks == 0 ||
+	   (size_t)(header->numBlocks + 1) * CAPTURE_BLOCK_SIZE > capture->length)
+	{
+		laserCaptureClose(capture);
+		return -1;
+	}
+	return 0;
+}
+
+//This function writes the mapped pages back and unmaps the ring file
+void laserCaptureClose(LaserCapture* capture)
+{
+	if(capture->header != NULL)
+	{
+		msync(capture->header, capture->length, MS_ASYNC);
+		munmap(capture->header, capture->length);
+		capture->header = NULL;
+	}
+}
+
+//This function starts the next block of the ring at timeNs, overwriting the oldest block once the ring is full
+static void startBlock(LaserCapture* capture, uint64_t timeNs)
+{
+	CaptureHeader* header = capture->header;
+	uint64_t next = atomic_load_explicit(&header->next, memory_order_relaxed);
+	CaptureBlock* block = captureBlock(capture, next);
+
+	//Invalidate the block while its header is rewritten
+	block->sequence = 0;
+	atomic_thread_fence(memory_order_release);
+
+	block->startNs = timeNs;
+	block->wallOffsetNs = laserWallNs(0);
+	block->levels = capture->levels;
+	atomic_store_explicit(&block->used, 0, memory_order_relaxed);
+
+	atomic_thread_fence(memory_order_release);
+	block->sequence = next + 1;
+	atomic_store_explicit(&header->next, next + 1, memory_order_release);
+
+	capture->block = block;
+	capture->lastNs = timeNs;
+}
+
+//This function appends one record for every captured pin whose level differs from the last sample
+//The first sample of a run only starts a block holding the initial levels
+void laserCaptureEdges(LaserCapture* capture, uint32_t levels, uint64_t timeNs)
+{
+	uint32_t pinMask = capture->header->pinMask;
+
+	if(capture->block == NULL)
+	{
+		capture->levels = levels & pinMask;
+		startBlock(capture, timeNs);
+		return;
+	}
+
+	//Edge timestamps never go backwards, even if an edge timestamp predates the previous sample
+	if(timeNs < capture->lastNs)
+	{
+		timeNs = capture->lastNs;
+	}
+
+	uint32_t diff = (levels ^ capture->levels) & pinMask;
+	while(diff)
+	{
+		int pin = __builtin_ctz(diff);
+		uint32_t bit = 1u << pin;
+		diff &= diff - 1;
+
+		//Move on to a new block when the longest record might not fit
+		unsigned used = atomic_load_explicit(&capture->block->used, memory_order_relaxed);
+		if(sizeof(CaptureBlock) + used + CAPTURE_MAX_VARINT > capture->header->blockSize)
+		{
+			startBlock(capture, timeNs);
+			used = 0;
+		}
+
+		uint64_t value = ((timeNs - capture->lastNs) << CAPTURE_DELTA_SHIFT) |
+		                 ((uint64_t)((levels & bit) != 0) << CAPTURE_LEVEL_SHIFT) | (uint64_t)pin;
+
+		//Seven bits per byte, the high bit is set on every byte but the last
+		uint8_t* out = (uint8_t*)(capture->block + 1) + used;
+		while(value >= 0x80)
+		{
+			*out++ = (uint8_t)value | 0x80;
+			value >>= 7;
+		}
+		*out++ = (uint8_t)value;
+
+		capture->levels ^= bit;
+		capture->lastNs = timeNs;
+
+		//Publish the record to readers of the live ring
+		atomic_store_explicit(&capture->block->used, (unsigned)(out - (uint8_t*)(capture->block + 1)), memory_order_release);
+	}
+}
+
+//This function replays one sample of the ring
+//Once the oldest blocks have been overwritten, the ring may start in the middle of a crossing, so the
+//samples before every captured beam is unbroken are skipped instead of failing the start-up check
+static void replaySample(const LaserCapture* capture, LaserCounter* counter, LaserReplay* replay,
+                         uint64_t timeNs, uint32_t levels, int* waiting)
+{
+	if(*waiting && levels != capture->header->pinMask)
+	{
+		return;
+	}
+	*waiting = 0;
+	laserReplayChange(replay, counter, timeNs, levels);
+}
+
+//This function drives the counter with every edge kept in the ring, oldest first, as fast as the CPU allows
+//Edges captured in the same sample are replayed as one change, as the live loop saw them
+//The replay runs on wall clock time, so that runs with different monotonic clocks follow each other
+//Returns the number of changes replayed, or -1 if the counter aborted
+long laserCaptureReplay(const LaserCapture* capture, LaserCounter* counter, LaserReplay* replay)
+{
+	const CaptureHeader* header = capture->header;
+	uint64_t next = atomic_load_explicit(&header->next, memory_order_acquire);
+	uint64_t first = (next > header->numBlocks) ? next - header->numBlocks : 0;
+	int waiting = (first > 0);
+
+	//The timestamps below are already wall clock times
+	laserTimeSetOffset(0);
+
+	uint32_t levels = 0;
+	uint64_t timeNs = 0;
+	int started = 0;
+
+	for(uint64_t b = first; b < next && !(replay->actions & ACT_ABORT); b++)
+	{
+		const CaptureBlock* block = captureBlock(capture, b);
+		if(block->sequence != b + 1)
+		{
+			continue;
+		}
+
+		uint32_t used = atomic_load_explicit(&block->used, memory_order_acquire);
+		uint32_t room = header->blockSize - sizeof(CaptureBlock);
+		const uint8_t* in = (const uint8_t*)(block + 1);
+		const uint8_t* end = in + ((used < room) ? used : room);
+		uint64_t blockNs = block->startNs + block->wallOffsetNs;
+
+		//A block carrying on from the previous one starts at its first edge, so the previous sample is complete
+		//unless that edge belongs to the same sample
+		if(started && levels != replay->levels && (blockNs != timeNs || block->levels != levels))
+		{
+			replaySample(capture, counter, replay, timeNs, levels, &waiting);
+		}
+
+		//A block that does not carry on from the previous one opens a new run (or follows overwritten blocks):
+		//start from the block's own levels
+		if(!started || block->levels != levels || blockNs < timeNs)
+		{
+			levels = block->levels;
+			started = 1;
+
+			if(replay->changes == 0 || levels != replay->levels)
+			{
+				replaySample(capture, counter, replay, blockNs, levels, &waiting);
+			}
+		}
+		timeNs = blockNs;
+
+		while(in < end)
+		{
+			uint64_t value = 0;
+			for(int shift = 0; in < end && shift < 64; shift += 7)
+			{
+				uint8_t byte = *in++;
+				value |= (uint64_t)(byte & 0x7f) << shift;
+				if(!(byte & 0x80))
+				{
+					break;
+				}
+			}
+
+			//A new timestamp ends the sample that the previous edges belonged to
+			uint64_t delta = value >> CAPTURE_DELTA_SHIFT;
+			if(delta != 0 && levels != replay->levels)
+			{
+				replaySample(capture, counter, replay, timeNs, levels, &waiting);
+			}
+			timeNs += delta;
+
+			uint32_t bit = 1u << (value & CAPTURE_PIN_MASK);
+			levels = (value & (1u << CAPTURE_LEVEL_SHIFT)) ? (levels | bit) : (levels & ~bit);
+		}
+	}
+
+	//Replay the last sample
+	if(started && levels != replay->levels)
+	{
+		replaySample(capture, counter, replay, timeNs, levels, &waiting);
+	}
+	return laserReplayFinish(replay, counter);
+}
@@ -0,0 +1,77 @@
+
+#ifndef LASER_CAPTURE_H
+#define LASER_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "laser_counter.h"
+#include "laser_trace.h"
+
+#define CAPTURE_MAGIC   0x3150434C 	//"LCP1"
+#define CAPTURE_VERSION 1
+
+//Default geometry of the ring: 4096 blocks of 4 KiB (16 MiB, several million edges)
+#define CAPTURE_BLOCK_SIZE 4096
+#define CAPTURE_BLOCKS     4096
+
+//Every edge is one varint: (timestamp delta << 6) | (level << 5) | pin
+#define CAPTURE_PIN_MASK    0x1f
+#define CAPTURE_LEVEL_SHIFT 5
+#define CAPTURE_DELTA_SHIFT 6
+#define CAPTURE_MAX_VARINT  10
+
+//The ring file starts with this header, padded to one block
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t blockSize;
+	uint32_t numBlocks;
+	uint32_t pinMask; 		//beam pins captured
+	uint32_t reserved;
+	atomic_uint_least64_t next; 	//number of blocks ever started, the newest is (next - 1) % numBlocks
+} CaptureHeader;
+
+//Each block starts with the absolute time and the levels of every pin, so it decodes on its own
+//after older blocks have been overwritten
+typedef struct
+{
+	uint64_t sequence; 		//block number + 1 (0 for a block never written)
+	uint64_t startNs; 		//monotonic time the deltas of the block start from
+	int64_t wallOffsetNs; 	//wall clock minus monotonic clock of the run that wrote the block
+	uint32_t levels; 		//levels of the captured pins before the first edge of the block
+	atomic_uint used; 		//bytes of edges written after this header
+} CaptureBlock;
+
+typedef struct
+{
+	CaptureHeader* header;
+	uint8_t* blocks;
+	size_t length;
+
+	//Writer state
+	CaptureBlock* block; 	//block being written
+	uint32_t levels; 		//levels after the last edge captured
+	uint64_t lastNs; 		//time of the last edge captured
+} LaserCapture;
+
+int  laserCaptureOpen  (LaserCapture* capture, const char* path, uint32_t pinMask, uint32_t numBlocks);
+int  laserCaptureMap   (LaserCapture* capture, const char* path);
+void laserCaptureClose (LaserCapture* capture);
+
+void laserCaptureEdges (LaserCapture* capture, uint32_t levels, uint64_t timeNs);
+long laserCaptureReplay(const LaserCapture* capture, LaserCounter* counter, LaserReplay* replay);
+
+//This function captures every beam pin that changed since the last sample
+//It only writes to the mapped ring: no formatting and no system call
+static inline void laserCaptureSample(LaserCapture* capture, uint32_t levels, uint64_t timeNs)
+{
+	if(capture->block == NULL || ((levels ^ capture->levels) & capture->header->pinMask))
+	{
+		laserCaptureEdges(capture, levels, timeNs);
+	}
+}
+
+#endif /* LASER_CAPTURE_H */
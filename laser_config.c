@@ -0,0 +1,495 @@
+#include "laser_config.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "laser_filter.h"
+#include "laser_watchdog.h"
+#include "laser_metrics.h"
+#include "laser_poll.h"
+
+//This function reads a whole decimal number between min and max into *number
+//Returns 0 on success or -1 if value is not such a number
+static int parseNumber(const char* value, long min, long max, long* number)
+{
+	char* end;
+	long result = strtol(value, &end, 10);
+	if(end == value || *end != 0 || result < min || result > max)
+	{
+		return -1;
+	}
+	*number = result;
+	return 0;
+}
+
+//This function copies a file name, which must fit in CONFIG_NAME_MAX characters
+//A name that does not fit is left empty, so that the default file is used instead
+static int parseName(char* name, const char* value)
+{
+	if(strlen(value) >= CONFIG_NAME_MAX)
+	{
+		name[0] = 0;
+		return -1;
+	}
+	strcpy(name, value);
+	return 0;
+}
+
+static int parseTimeout(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 0, 3600, &number) < 0)
+	{
+		//An invalid timeout is replaced by the default when it is checked
+		config->timeout = -1;
+		return -1;
+	}
+	config->timeout = (int)number;
+	return 0;
+}
+
+static int parseWatchdogKicks(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 1, 100, &number) < 0)
+	{
+		return -1;
+	}
+	config->watchdogKicks = (int)number;
+	return 0;
+}
+
+static int parseLogFile(LaserConfig* config, const char* value)
+{
+	return parseName(config->logFileName, value);
+}
+
+static int parseStatsFile(LaserConfig* config, const char* value)
+{
+	return parseName(config->statsFileName, value);
+}
+
+static int parseTraceFile(LaserConfig* config, const char* value)
+{
+	return parseName(config->traceFileName, value);
+}
+
+static int parseCaptureFile(LaserConfig* config, const char* value)
+{
+	return parseName(config->captureFileName, value);
+}
+
+static int parseMetricsSocket(LaserConfig* config, const char* value)
+{
+	return parseName(config->metricsSocket, value);
+}
+
+static int parseRollupFile(LaserConfig* config, const char* value)
+{
+	return parseName(config->rollupFileName, value);
+}
+
+static int parseArchiveDirectory(LaserConfig* config, const char* value)
+{
+	return parseName(config->archiveDirectory, value);
+}
+
+//The pins of laser 1 and laser 2 of one doorway, separated by a comma (e.g. DOORWAY=17,27 or DOORWAY=17 , 27)
+//The pins themselves are checked when the doorway is added to the counter
+static int parseDoorway(LaserConfig* config, const char* value)
+{
+	char* end;
+	long pin1 = strtol(value, &end, 10);
+	if(end == value || config->numDoorways >= LASER_MAX_DOORWAYS)
+	{
+		return -1;
+	}
+	while(isspace((unsigned char)*end))
+	{
+		end++;
+	}
+	if(*end != ',')
+	{
+		return -1;
+	}
+
+	//strtol skips the spaces before the second pin, the ones after it are skipped here
+	const char* second = end + 1;
+	long pin2 = strtol(second, &end, 10);
+	if(end == second)
+	{
+		return -1;
+	}
+	while(isspace((unsigned char)*end))
+	{
+		end++;
+	}
+	if(*end != 0)
+	{
+		return -1;
+	}
+
+	config->doorwayPins[config->numDoorways][0] = (int)pin1;
+	config->doorwayPins[config->numDoorways][1] = (int)pin2;
+	config->numDoorways++;
+	return 0;
+}
+
+static int parseDebounce(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 0, 1000000, &number) < 0)
+	{
+		return -1;
+	}
+	config->debounceUs = (uint32_t)number;
+	return 0;
+}
+
+static int parseHysteresis(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 0, 1000000, &number) < 0)
+	{
+		return -1;
+	}
+	config->hysteresisUs = (uint32_t)number;
+	return 0;
+}
+
+static int parseLogFlush(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 1, 60000, &number) < 0)
+	{
+		return -1;
+	}
+	config->logFlushMs = (int)number;
+	return 0;
+}
+
+static int parseLogDurability(LaserConfig* config, const char* value)
+{
+	if(strcasecmp(value, "batch") == 0)
+	{
+		config->logDurability = LOG_BATCH;
+	}
+	else if(strcasecmp(value, "immediate") == 0)
+	{
+		config->logDurability = LOG_IMMEDIATE;
+	}
+	else if(strcasecmp(value, "fsync") == 0)
+	{
+		config->logDurability = LOG_FSYNC;
+	}
+	else
+	{
+		return -1;
+	}
+	return 0;
+}
+
+static int parseRtPriority(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 0, 99, &number) < 0)
+	{
+		return -1;
+	}
+	config->rtPriority = (int)number;
+	return 0;
+}
+
+static int parseRtCpu(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, -1, 1023, &number) < 0)
+	{
+		return -1;
+	}
+	config->rtCpu = (int)number;
+	return 0;
+}
+
+static int parseLatencyBudget(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 0, 10000000, &number) < 0)
+	{
+		return -1;
+	}
+	config->latencyBudgetUs = (uint32_t)number;
+	return 0;
+}
+
+static int parsePollMaxLatency(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 0, 1000000, &number) < 0)
+	{
+		return -1;
+	}
+	config->pollMaxLatencyUs = (uint32_t)number;
+	return 0;
+}
+
+static int parseBeamSpacing(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 0, 10000, &number) < 0)
+	{
+		return -1;
+	}
+	config->beamSpacingMm = (uint32_t)number;
+	return 0;
+}
+
+static int parseTrackCrossings(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 0, 1, &number) < 0)
+	{
+		return -1;
+	}
+	config->trackCrossings = (int)number;
+	return 0;
+}
+
+//The aggregator is "unix:<path>" or "<host>:<port>" (see laserFleetOpen), checked when the fleet sender starts
+static int parseFleetAddress(LaserConfig* config, const char* value)
+{
+	return parseName(config->fleetAddress, value);
+}
+
+static int parseFleetId(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 0, 2147483647, &number) < 0)
+	{
+		return -1;
+	}
+	config->fleetId = (uint32_t)number;
+	return 0;
+}
+
+static int parseLogSegmentKb(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 0, 1048576, &number) < 0)
+	{
+		return -1;
+	}
+	config->logSegmentKb = (int)number;
+	return 0;
+}
+
+static int parseLogSegmentHours(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 0, 8760, &number) < 0)
+	{
+		return -1;
+	}
+	config->logSegmentHours = (int)number;
+	return 0;
+}
+
+static int parseLogSegments(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 0, 10000, &number) < 0)
+	{
+		return -1;
+	}
+	config->logSegments = (int)number;
+	return 0;
+}
+
+static int parseLogCompress(LaserConfig* config, const char* value)
+{
+	long number;
+	if(parseNumber(value, 0, 1, &number) < 0)
+	{
+		return -1;
+	}
+	config->logCompress = (int)number;
+	return 0;
+}
+
+//Every key the parser knows, and the function storing its value
+//A new setting only needs a field in LaserConfig, a parse function and a line here
+typedef struct
+{
+	const char* key;
+	int (*parse)(LaserConfig* config, const char* value);
+} ConfigKey;
+
+static const ConfigKey configKeys[] =
+{
+	{"WATCHDOG_TIMEOUT", parseTimeout},
+	{"WATCHDOG_KICKS",   parseWatchdogKicks},
+	{"LOGFILE",          parseLogFile},
+	{"STATSFILE",        parseStatsFile},
+	{"TRACEFILE",        parseTraceFile},
+	{"CAPTUREFILE",      parseCaptureFile},
+	{"METRICS_SOCKET",   parseMetricsSocket},
+	{"ROLLUPFILE",       parseRollupFile},
+	{"ARCHIVE_DIR",      parseArchiveDirectory},
+	{"DOORWAY",          parseDoorway},
+	{"DEBOUNCE_US",      parseDebounce},
+	{"HYSTERESIS_US",    parseHysteresis},
+	{"LOG_FLUSH_MS",     parseLogFlush},
+	{"LOG_DURABILITY",   parseLogDurability},
+	{"LOG_SEGMENT_KB",   parseLogSegmentKb},
+	{"LOG_SEGMENT_HOURS", parseLogSegmentHours},
+	{"LOG_SEGMENTS",     parseLogSegments},
+	{"LOG_COMPRESS",     parseLogCompress},
+	{"RT_PRIORITY",      parseRtPriority},
+	{"RT_CPU",           parseRtCpu},
+	{"LATENCY_BUDGET_US", parseLatencyBudget},
+	{"POLL_MAX_LATENCY_US", parsePollMaxLatency},
+	{"BEAM_SPACING_MM",  parseBeamSpacing},
+	{"TRACK_CROSSINGS",  parseTrackCrossings},
+	{"FLEET_ADDRESS",    parseFleetAddress},
+	{"FLEET_ID",         parseFleetId},
+};
+
+//This function sets every setting to the value used when the config file does not give one
+void laserConfigDefaults(LaserConfig* config)
+{
+	memset(config, 0, sizeof(*config));
+	config->timeout = 10;
+	config->watchdogKicks = WATCHDOG_KICKS_PER_TIMEOUT;
+	strcpy(config->logFileName, "/home/pi/Lab4Default.log");
+	strcpy(config->statsFileName, "/home/pi/Lab4Default.stats");
+	strcpy(config->metricsSocket, METRICS_SOCKET_PATH);
+	strcpy(config->rollupFileName, "/home/pi/Lab4Default.rollup");
+	strcpy(config->archiveDirectory, "/home/pi/Lab4Archive");
+	config->debounceUs = FILTER_STABLE_US;
+	config->hysteresisUs = FILTER_HYSTERESIS_US;
+	config->logFlushMs = LOG_FLUSH_INTERVAL_MS;
+	config->logDurability = LOG_BATCH;
+	config->logSegmentKb = ROTATE_SEGMENT_KB;
+	config->logSegmentHours = ROTATE_SEGMENT_HOURS;
+	config->logSegments = ROTATE_SEGMENTS;
+	config->logCompress = 1;
+	config->rtCpu = -1;
+	config->pollMaxLatencyUs = POLL_MAX_LATENCY_US;
+}
+
+//This function handles one line of the config file (without its newline)
+//Blank lines and lines starting with '#' are skipped, spaces around the key and the value are ignored
+static void parseLine(LaserConfig* config, char* line)
+{
+	//Trim the line
+	while(isspace((unsigned char)*line))
+	{
+		line++;
+	}
+	size_t length = strlen(line);
+	while(length > 0 && isspace((unsigned char)line[length - 1]))
+	{
+		line[--length] = 0;
+	}
+	if(length == 0 || line[0] == '#')
+	{
+		return;
+	}
+
+	char* equal = strchr(line, '=');
+	if(equal == NULL)
+	{
+		config->errors++;
+		return;
+	}
+
+	//Split the line into the key and the value, and trim both
+	char* value = equal + 1;
+	while(isspace((unsigned char)*value))
+	{
+		value++;
+	}
+	*equal = 0;
+	while(equal > line && isspace((unsigned char)equal[-1]))
+	{
+		*--equal = 0;
+	}
+
+	for(size_t i = 0; i < sizeof(configKeys) / sizeof(configKeys[0]); i++)
+	{
+		if(strcmp(line, configKeys[i].key) == 0)
+		{
+			if(configKeys[i].parse(config, value) < 0)
+			{
+				config->errors++;
+			}
+			return;
+		}
+	}
+	config->unknown++;
+}
+
+//This function reads the settings of a config file in a single pass, one bounded line at a time
+//Settings the file does not give keep the value they had
+//Returns the number of lines in error (0 if the whole file was understood)
+int laserConfigParse(LaserConfig* config, FILE* file)
+{
+	char line[CONFIG_LINE_MAX];
+	size_t length = 0;
+	int tooLong = 0;
+	int c;
+
+	config->errors = 0;
+	config->unknown = 0;
+
+	do
+	{
+		c = getc(file);
+
+		if(c == '\n' || c == EOF)
+		{
+			if(tooLong)
+			{
+				config->errors++;
+			}
+			else if(length > 0)
+			{
+				line[length] = 0;
+				parseLine(config, line);
+			}
+			length = 0;
+			tooLong = 0;
+		}
+		else if(length < sizeof(line) - 1)
+		{
+			line[length++] = (char)c;
+		}
+		else
+		{
+			//Skip the rest of a line that does not fit in the buffer
+			tooLong = 1;
+		}
+	}
+	while(c != EOF);
+
+	return config->errors;
+}
+
+//This function reads the config file at path over the defaults
+//Returns the number of lines in error, or -1 if the file cannot be opened (the defaults are kept)
+int laserConfigLoad(LaserConfig* config, const char* path)
+{
+	laserConfigDefaults(config);
+
+	FILE* file = fopen(path, "r");
+	if(file == NULL)
+	{
+		return -1;
+	}
+
+	int errors = laserConfigParse(config, file);
+	fclose(file);
+	return errors;
+}
@@ -0,0 +1,65 @@
+
+#ifndef LASER_CONFIG_H
+#define LASER_CONFIG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "laser_fsm.h"
+#include "laser_log.h"
+
+//Config file read when no -c option is given
+#define CONFIG_PATH "/home/pi/Lab4.cfg"
+
+//Longest line the parser accepts (longer lines are skipped and counted as errors)
+#define CONFIG_LINE_MAX 256
+
+//Size of the file names held by the config
+#define CONFIG_NAME_MAX 50
+
+//Every setting the config file can hold
+//A setting missing from the file keeps its default value
+typedef struct
+{
+	int timeout; 							//WATCHDOG_TIMEOUT, in seconds
+	int watchdogKicks; 						//WATCHDOG_KICKS, kicks per timeout
+	char logFileName[CONFIG_NAME_MAX]; 		//LOGFILE
+	char statsFileName[CONFIG_NAME_MAX]; 	//STATSFILE
+	char traceFileName[CONFIG_NAME_MAX]; 	//TRACEFILE, empty if the beams are not recorded
+	char captureFileName[CONFIG_NAME_MAX]; 	//CAPTUREFILE, empty if the edges are not captured
+	char metricsSocket[CONFIG_NAME_MAX]; 	//METRICS_SOCKET, empty if the metrics are not served
+	char rollupFileName[CONFIG_NAME_MAX]; 	//ROLLUPFILE, empty if no history is kept
+	char archiveDirectory[CONFIG_NAME_MAX]; //ARCHIVE_DIR, empty if the crossings are not archived
+
+	int numDoorways; 						//DOORWAY=<laser 1 pin>,<laser 2 pin>, once per doorway
+	int doorwayPins[LASER_MAX_DOORWAYS][2];
+
+	uint32_t debounceUs; 					//DEBOUNCE_US
+	uint32_t hysteresisUs; 					//HYSTERESIS_US
+	int logFlushMs; 						//LOG_FLUSH_MS
+	LogDurability logDurability; 			//LOG_DURABILITY=batch|immediate|fsync
+	int logSegmentKb; 						//LOG_SEGMENT_KB, size a log segment is rotated at, 0 to never rotate
+	int logSegmentHours; 					//LOG_SEGMENT_HOURS, age a log segment is rotated at, 0 for no age limit
+	int logSegments; 						//LOG_SEGMENTS, closed log segments kept, 0 to keep all
+	int logCompress; 						//LOG_COMPRESS=0|1, gzip the closed log segments
+
+	int rtPriority; 						//RT_PRIORITY, SCHED_FIFO priority of the sensing loop, 0 to leave it normal
+	int rtCpu; 								//RT_CPU, CPU the sensing loop is pinned to, -1 for any
+	uint32_t latencyBudgetUs; 				//LATENCY_BUDGET_US, longest edge-to-decision time, 0 for no budget
+	uint32_t pollMaxLatencyUs; 				//POLL_MAX_LATENCY_US, longest time an idle polling loop takes to see a change, 0 to spin
+
+	uint32_t beamSpacingMm; 				//BEAM_SPACING_MM, distance between the beams, 0 to leave the crossings unanalysed
+	int trackCrossings; 					//TRACK_CROSSINGS=0|1, count in and out with the crossing tracker
+
+	char fleetAddress[CONFIG_NAME_MAX]; 	//FLEET_ADDRESS, aggregator the counts are sent to, empty if there is none
+	uint32_t fleetId; 						//FLEET_ID, number of this counter in the fleet, 0 for the host id
+
+	int errors; 	//lines that are not key=value, too long, or hold an invalid value
+	int unknown; 	//lines with a key the parser does not know (ignored)
+} LaserConfig;
+
+void laserConfigDefaults(LaserConfig* config);
+int  laserConfigParse   (LaserConfig* config, FILE* file);
+int  laserConfigLoad    (LaserConfig* config, const char* path);
+
+#endif /* LASER_CONFIG_H */
@@ -0,0 +1,220 @@
+#include "laser_counter.h"
+
+#include "laser_time.h"
+
+//This function adds a doorway made of the beams on pins pin1 and pin2
+//Returns the index of the doorway, or -1 if the pins are invalid, already used, or there are too many doorways
+int laserCounterAddDoorway(LaserCounter* counter, int pin1, int pin2)
+{
+	if(counter->numDoorways >= LASER_MAX_DOORWAYS || pin1 < 0 || pin1 > LASER_MAX_PIN ||
+	   pin2 < 0 || pin2 > LASER_MAX_PIN || pin1 == pin2)
+	{
+		return -1;
+	}
+
+	//A beam can only belong to one doorway
+	for(int i = 0; i < counter->numDoorways; i++)
+	{
+		const LaserDoorway* other = &counter->doorways[i];
+		if(other->pin1 == pin1 || other->pin1 == pin2 || other->pin2 == pin1 || other->pin2 == pin2)
+		{
+			return -1;
+		}
+	}
+
+	LaserDoorway* doorway = &counter->doorways[counter->numDoorways];
+	doorway->pin1 = pin1;
+	doorway->pin2 = pin2;
+	doorway->state = START;
+	doorway->counts = (LaserCounts){0, 0, 0, 0};
+	laserTrackerReset(&doorway->tracker);
+
+	//Debounce both beams of the doorway
+	counter->filter.pinMask |= (1u << pin1) | (1u << pin2);
+	return counter->numDoorways++;
+}
+
+//This function lists the pin of every beam into pins (room for 2 * LASER_MAX_DOORWAYS)
+//Returns the number of pins
+int laserCounterPins(const LaserCounter* counter, int* pins)
+{
+	for(int i = 0; i < counter->numDoorways; i++)
+	{
+		pins[2 * i] = counter->doorways[i].pin1;
+		pins[2 * i + 1] = counter->doorways[i].pin2;
+	}
+	return 2 * counter->numDoorways;
+}
+
+//This function debounces one sample of the level register and runs every doorway's state machine against it
+//edgeNs is the timestamp of the last GPIO edge before the sample, or 0 if it is not known
+//Returns the actions of every transition taken combined (0 if no doorway changed state)
+unsigned laserCounterProcess(LaserCounter* counter, uint32_t levels, uint64_t sampleNs, uint64_t edgeNs)
+{
+	unsigned actions = 0;
+	int changed = 0;
+
+	//Pass on only the beam changes that have been stable long enough
+	counter->filterDeadlineNs = UINT64_MAX;
+	levels = laserFilterUpdate(&counter->filter, levels, sampleNs, edgeNs, &counter->filterDeadlineNs);
+
+	if(counter->analytics != NULL)
+	{
+		laserAnalyticsTick(counter->analytics, sampleNs);
+	}
+
+	for(int i = 0; i < counter->numDoorways; i++)
+	{
+		LaserDoorway* doorway = &counter->doorways[i];
+
+		//Look up the next state and the actions to perform
+		unsigned beams = laserDoorwayBeams(doorway, levels);
+		const LaserTransition* transition = laserFsmStep(doorway->state, beams);
+		uint8_t from = doorway->state;
+		changed |= (transition->next != from);
+		doorway->state = transition->next;
+		unsigned transitionActions = transition->actions;
+
+		//When tracking, the tracker counts the objects in and out from the beam edges, timed by the filter
+		if(counter->tracking)
+		{
+			unsigned tracked = laserTrackerUpdate(&doorway->tracker, beams, counter->filter.since[doorway->pin1],
+			                                      counter->filter.since[doorway->pin2], &doorway->counts);
+			transitionActions &= ~(ACT_COUNT_IN | ACT_COUNT_OUT | ACT_STATS);
+			transitionActions |= tracked;
+			if(transitionActions & (ACT_BREAK1 | ACT_BREAK2 | ACT_COUNT_IN | ACT_COUNT_OUT))
+			{
+				transitionActions |= ACT_STATS;
+			}
+		}
+
+		//Time the phases of the crossing
+		LaserCrossing crossing;
+		int crossed = (transition->next != from && counter->analytics != NULL &&
+		               laserAnalyticsTransition(counter->analytics, i, from, transition, sampleNs, &crossing));
+
+		//Most lookups leave the state unchanged and have nothing to do
+		if(transitionActions == 0)
+		{
+			continue;
+		}
+		actions |= transitionActions;
+
+		//Update the break, in and out counts (the tracker has already counted its crossings)
+		laserFsmCountActions(counter->tracking ? transitionActions & (ACT_BREAK1 | ACT_BREAK2) : transitionActions,
+		                     &doorway->counts);
+
+		//With a single doorway the messages are logged exactly as before, without a doorway number
+		int number = (counter->numDoorways > 1) ? i : -1;
+
+		//Time the logging and the stats update when the loop is instrumented
+		LaserLoopMetrics* metrics = counter->metrics;
+		uint64_t startNs = 0;
+		if(metrics != NULL)
+		{
+			//The crossings counted by the tracker have a label of their own, apart from the state machine's messages
+			if(transition->message != MSG_NONE)
+			{
+				laserMetricAdd(&metrics->transitions[transition->message], 1);
+			}
+			if(counter->tracking && (transitionActions & (ACT_COUNT_IN | ACT_COUNT_OUT)))
+			{
+				laserMetricAdd(&metrics->transitions[METRICS_TRACKED], 1);
+			}
+			startNs = laserMonotonicNs();
+		}
+
+		//Output the transition message into the log file
+		if((transitionActions & ACT_LOG) && counter->log != NULL)
+		{
+			LOG_DOORWAY_MSG(counter->log, LOG_SINK_LOG, sampleNs, number, laserMessages[transition->message]);
+		}
+
+		//Output message into log file that an object has entered or exitted the room
+		if((transitionActions & ACT_COUNT_IN) && counter->log != NULL)
+		{
+			LOG_DOORWAY_MSG(counter->log, LOG_SINK_LOG, sampleNs, number, "An object has entered the room.\n\n");
+		}
+		if((transitionActions & ACT_COUNT_OUT) && counter->log != NULL)
+		{
+			LOG_DOORWAY_MSG(counter->log, LOG_SINK_LOG, sampleNs, number, "An object has exitted the room.\n\n");
+		}
+
+		//Follow it with the record of the crossing
+		if(crossed && crossing.direction != CROSSING_ABANDONED && counter->log != NULL)
+		{
+			laserLogPost(counter->log, LOG_SINK_LOG, sampleNs, number,
+			             "The crossing took %ld ms at %ld mm/s (%ld ms before both lasers were broken, %ld ms after).\n\n",
+			             crossing.durationUs / 1000, crossing.speedMmS, crossing.leadUs / 1000, crossing.trailUs / 1000);
+		}
+
+		//Archive the counted crossing, with its phase times when the crossings are analysed, or the abandoned one
+		if(counter->archive != NULL && ((transitionActions & (ACT_COUNT_IN | ACT_COUNT_OUT)) ||
+		                                (crossed && crossing.direction == CROSSING_ABANDONED)))
+		{
+			ArchiveCrossing record = {laserWallNs(sampleNs), (uint8_t)i, CROSSING_ABANDONED, 0, 0, 0};
+			if(transitionActions & (ACT_COUNT_IN | ACT_COUNT_OUT))
+			{
+				record.direction = (transitionActions & ACT_COUNT_IN) ? CROSSING_IN : CROSSING_OUT;
+			}
+			if(crossed && crossing.direction == record.direction)
+			{
+				record.leadUs = crossing.leadUs;
+				record.overlapUs = crossing.overlapUs;
+				record.trailUs = crossing.trailUs;
+			}
+			laserArchiveAdd(counter->archive, &record);
+		}
+
+		if(metrics != NULL && counter->log != NULL)
+		{
+			uint64_t nowNs = laserMonotonicNs();
+			laserMetricAdd(&metrics->logPosts, ((transitionActions & ACT_LOG) != 0) +
+			               ((transitionActions & (ACT_COUNT_IN | ACT_COUNT_OUT)) != 0));
+			laserMetricAdd(&metrics->logPostNs, nowNs - startNs);
+			startNs = nowNs;
+		}
+
+		//Output statistics to stats file to update counts
+		if((transitionActions & ACT_STATS) && counter->stats != NULL)
+		{
+			laserStatsUpdate(counter->stats, i, &doorway->counts, transitionActions, laserWallNs(sampleNs));
+
+			if(metrics != NULL)
+			{
+				laserMetricAdd(&metrics->statsUpdates, 1);
+				laserMetricAdd(&metrics->statsUpdateNs, laserMonotonicNs() - startNs);
+			}
+		}
+
+		//Add the counts to the history buckets
+		if(counter->rollup != NULL)
+		{
+			laserRollupAdd(counter->rollup, transitionActions, laserWallNs(sampleNs));
+		}
+
+		//Queue the new in and out counts for the fleet aggregator
+		if((transitionActions & (ACT_COUNT_IN | ACT_COUNT_OUT)) && counter->fleet != NULL)
+		{
+			laserFleetPost(counter->fleet, i, transitionActions, &doorway->counts, laserWallNs(sampleNs));
+		}
+	}
+
+	//Let the readers of the shared memory see the new states and counts
+	if((changed || actions) && counter->shm != NULL)
+	{
+		laserCounterPublish(counter, sampleNs);
+	}
+	return actions;
+}
+
+//This function publishes the state and counts of every doorway in the shared memory object
+void laserCounterPublish(LaserCounter* counter, uint64_t sampleNs)
+{
+	laserShmBegin(counter->shm);
+	for(int i = 0; i < counter->numDoorways; i++)
+	{
+		laserShmDoorway(counter->shm, i, counter->doorways[i].state, &counter->doorways[i].counts);
+	}
+	laserShmEnd(counter->shm, laserWallNs(sampleNs));
+}
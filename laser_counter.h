@@ -0,0 +1,100 @@
+
+#ifndef LASER_COUNTER_H
+#define LASER_COUNTER_H
+
+#include <stdint.h>
+
+#include "laser_fsm.h"
+#include "laser_filter.h"
+#include "laser_log.h"
+#include "laser_stats.h"
+#include "laser_shm.h"
+#include "laser_metrics.h"
+#include "laser_analytics.h"
+#include "laser_tracker.h"
+#include "laser_fleet.h"
+#include "laser_rollup.h"
+#include "laser_archive.h"
+
+//Every beam pin must be in the first level register so that one GPLEV read samples all of them
+#define LASER_MAX_PIN 31
+
+//A doorway is a pair of beams with its own state machine and counts
+//Laser 1 is the beam an entering object breaks first
+typedef struct
+{
+	int pin1;
+	int pin2;
+	uint8_t state;
+	LaserCounts counts;
+	LaserTracker tracker; 	//crossings in flight, used instead of the state machine to count in and out when tracking
+} LaserDoorway;
+
+//The sensor array: every doorway watched by this counter, and where their messages and stats go
+typedef struct
+{
+	int numDoorways;
+	LaserDoorway doorways[LASER_MAX_DOORWAYS];
+
+	//Debounce filter applied to every beam before the state machines see it
+	//After each sample, filterDeadlineNs holds when a pending change will be accepted (UINT64_MAX if none)
+	LaserFilter filter;
+	uint64_t filterDeadlineNs;
+
+	//When set, the in and out counts come from each doorway's tracker, which follows several objects at once,
+	//and the state machines only count the beam breaks and log the transitions
+	int tracking;
+
+	//Any of these may be NULL to count without logging, without a stats file or without publishing the live state
+	//(e.g. in a quiet replay)
+	LaserLog* log;
+	LaserStats* stats;
+	LaserShm* shm;
+
+	//Instrumentation counters, NULL if the loop is not instrumented
+	LaserLoopMetrics* metrics;
+
+	//Crossing timing and occupancy, NULL if the crossings are not analysed
+	LaserAnalytics* analytics;
+
+	//Sender of the in and out counts to the fleet aggregator, NULL if the counter is not part of a fleet
+	LaserFleet* fleet;
+
+	//Minute, hour and day buckets of the counts, NULL if no history is kept
+	LaserRollup* rollup;
+
+	//Archive of every crossing, NULL if the crossings are not archived
+	LaserArchive* archive;
+} LaserCounter;
+
+int      laserCounterAddDoorway(LaserCounter* counter, int pin1, int pin2);
+int      laserCounterPins      (const LaserCounter* counter, int* pins);
+unsigned laserCounterProcess   (LaserCounter* counter, uint32_t levels, uint64_t sampleNs, uint64_t edgeNs);
+void     laserCounterPublish   (LaserCounter* counter, uint64_t sampleNs);
+
+//This function extracts the beam mask of one doorway from a sample of the level register
+//A pin reads low when the laser beam does not reach its photodiode
+static inline unsigned laserDoorwayBeams(const LaserDoorway* doorway, uint32_t levels)
+{
+	return ((~levels >> doorway->pin1) & 1) | (((~levels >> doorway->pin2) & 1) << 1);
+}
+
+//This function tells whether a crossing may be in progress: a doorway is not in the idle state with both lasers
+//unbroken, or a beam change is waiting in the debounce filter
+static inline int laserCounterBusy(const LaserCounter* counter)
+{
+	if(counter->filterDeadlineNs != UINT64_MAX)
+	{
+		return 1;
+	}
+	for(int i = 0; i < counter->numDoorways; i++)
+	{
+		if(LASER_STATE(counter->doorways[i].state) != BOTH_UNBROKEN)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+#endif /* LASER_COUNTER_H */
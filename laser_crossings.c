@@ -0,0 +1,174 @@
+#define _GNU_SOURCE 		//for strptime()
+#include "laser_archive.h"
+#include "laser_analytics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+//This program queries the crossing archive written by the counter (see laser_archive.h)
+//Usage: laser_crossings <archive directory> [<from> <to>] [-c]
+//The times are local, "YYYY-mm-dd", "YYYY-mm-dd HH:MM" or "YYYY-mm-dd HH:MM:SS", and the range runs from 'from' up
+//to (not including) 'to'; without them every crossing is listed
+//With -c it prints the number of crossings of each doorway and direction instead of listing them
+//Only the blocks whose time range overlaps the query are decoded: the block of 'from' is found by a binary search
+//of each segment's index
+
+static const char* const directionNames[CROSSING_DIRECTIONS] = {"in", "out", "abandoned"};
+
+//This function parses a local time into wall clock nanoseconds
+//Returns 0 on success or -1 if the text is not a time
+static int parseTime(const char* text, int64_t* timeNs)
+{
+	struct tm local;
+	memset(&local, 0, sizeof(local));
+	const char* end = strptime(text, "%Y-%m-%d", &local);
+	if(end != NULL && *end != 0)
+	{
+		end = strptime(end, " %H:%M", &local);
+	}
+	if(end != NULL && *end != 0)
+	{
+		end = strptime(end, ":%S", &local);
+	}
+	if(end == NULL || *end != 0)
+	{
+		return -1;
+	}
+
+	local.tm_isdst = -1;
+	*timeNs = (int64_t)mktime(&local) * 1000000000;
+	return 0;
+}
+
+//This function prints one crossing
+static void printCrossing(const ArchiveCrossing* crossing)
+{
+	time_t seconds = (time_t)(crossing->timeNs / 1000000000);
+	struct tm local;
+	localtime_r(&seconds, &local);
+	char date[32];
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &local);
+
+	const char* direction = (crossing->direction < CROSSING_DIRECTIONS) ? directionNames[crossing->direction] : "?";
+	printf("%s.%06ld  doorway %d  %-9s  lead %8.1f ms  overlap %8.1f ms  trail %8.1f ms\n", date,
+	       (long)(crossing->timeNs % 1000000000 / 1000), crossing->doorway + 1, direction,
+	       crossing->leadUs / 1000.0, crossing->overlapUs / 1000.0, crossing->trailUs / 1000.0);
+}
+
+int main(const int argc, const char* const argv[])
+{
+	int64_t fromNs = INT64_MIN;
+	int64_t toNs = INT64_MAX;
+	int countOnly = (argc > 2 && strcmp(argv[argc - 1], "-c") == 0);
+	int numTimes = argc - 2 - countOnly;
+	if(argc < 2 || (numTimes != 0 && numTimes != 2) ||
+	   (numTimes == 2 && (parseTime(argv[2], &fromNs) < 0 || parseTime(argv[3], &toNs) < 0 || toNs <= fromNs)))
+	{
+		fprintf(stderr, "Usage: %s <archive directory> [<from> <to>] [-c]\n", argv[0]);
+		fprintf(stderr, "The times are local, \"YYYY-mm-dd\", \"YYYY-mm-dd HH:MM\" or \"YYYY-mm-dd HH:MM:SS\"\n");
+		return -1;
+	}
+
+	int first;
+	int last;
+	if(laserArchiveSegments(argv[1], &first, &last) < 0)
+	{
+		perror("The archive could not be opened");
+		return -1;
+	}
+
+	long counts[LASER_MAX_DOORWAYS][CROSSING_DIRECTIONS];
+	memset(counts, 0, sizeof(counts));
+	long blocksRead = 0;
+	long blocksTotal = 0;
+
+	static ArchiveSegment index;
+	static ArchiveCrossing crossings[ARCHIVE_BLOCK_CROSSINGS];
+	for(int number = first; number > 0 && number <= last; number++)
+	{
+		ArchiveSegment* segment = laserArchiveMapSegment(argv[1], number);
+		if(segment == NULL)
+		{
+			continue;
+		}
+
+		int numBlocks = laserArchiveReadIndex(segment, &index);
+		if(numBlocks < 0)
+		{
+			perror("An archive segment is stuck in the middle of an update");
+			laserArchiveUnmapSegment(segment);
+			return -1;
+		}
+		blocksTotal += numBlocks;
+		if(numBlocks == 0 || index.lastTimeNs < fromNs || index.firstTimeNs >= toNs)
+		{
+			laserArchiveUnmapSegment(segment);
+			continue;
+		}
+
+		//Find the first block that ends at or after 'from' (the blocks of a segment follow each other in time)
+		int low = 0;
+		int high = numBlocks;
+		while(low < high)
+		{
+			int middle = (low + high) / 2;
+			if(index.index[middle].lastTimeNs < fromNs)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+
+		for(int block = low; block < numBlocks && index.index[block].firstTimeNs < toNs; block++)
+		{
+			int count = laserArchiveReadBlock(segment, block, crossings);
+			if(count == -2)
+			{
+				perror("An archive segment is stuck in the middle of an update");
+				laserArchiveUnmapSegment(segment);
+				return -1;
+			}
+			blocksRead++;
+			for(int i = 0; i < count; i++)
+			{
+				const ArchiveCrossing* crossing = &crossings[i];
+				if(crossing->timeNs < fromNs || crossing->timeNs >= toNs)
+				{
+					continue;
+				}
+				if(countOnly)
+				{
+					if(crossing->direction < CROSSING_DIRECTIONS)
+					{
+						counts[crossing->doorway][crossing->direction]++;
+					}
+				}
+				else
+				{
+					printCrossing(crossing);
+				}
+			}
+		}
+		laserArchiveUnmapSegment(segment);
+	}
+
+	if(countOnly)
+	{
+		printf("%-8s %10s %10s %10s\n", "doorway", "in", "out", "abandoned");
+		for(int i = 0; i < LASER_MAX_DOORWAYS; i++)
+		{
+			if(counts[i][CROSSING_IN] || counts[i][CROSSING_OUT] || counts[i][CROSSING_ABANDONED])
+			{
+				printf("%-8d %10ld %10ld %10ld\n", i + 1, counts[i][CROSSING_IN], counts[i][CROSSING_OUT],
+				       counts[i][CROSSING_ABANDONED]);
+			}
+		}
+	}
+	fprintf(stderr, "(%ld of %ld blocks decoded)\n", blocksRead, blocksTotal);
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include "laser_filter.h"
+
+//This function sets the minimum stable time of a broken beam and the extra hysteresis of a restored beam
+//A stable time of 0 turns the filter off (every change is passed on immediately)
+void laserFilterConfigure(LaserFilter* filter, uint32_t stableUs, uint32_t hysteresisUs)
+{
+	filter->breakNs = (uint64_t)stableUs * 1000;
+	filter->restoreNs = stableUs ? ((uint64_t)stableUs + hysteresisUs) * 1000 : 0;
+}
+
+//This function filters one sample 'raw' of the level register taken at nowNs
+//edgeNs is the timestamp of the last edge seen before the sample (0 if unknown), used as the start of new changes
+//unless filter->edgeNs holds the pin's own edge timestamp: then simultaneous changes of several pins keep
+//their real order. The per pin timestamps are used up by the sample
+//Returns the filtered levels; if a change is still waiting to become stable, *deadlineNs is lowered
+//to the time it will be accepted, so the caller can sample again then instead of sleeping
+uint32_t laserFilterUpdate(LaserFilter* filter, uint32_t raw, uint64_t nowNs, uint64_t edgeNs, uint64_t* deadlineNs)
+{
+	if(!filter->primed)
+	{
+		filter->stable = raw;
+		filter->primed = 1;
+	}
+
+	uint32_t diff = (raw ^ filter->stable) & filter->pinMask;
+
+	//Pins that went back to their filtered level before becoming stable were glitches
+	uint32_t reverted = filter->pending & ~diff;
+	if(reverted)
+	{
+		unsigned long glitches = atomic_load_explicit(&filter->glitches, memory_order_relaxed);
+		atomic_store_explicit(&filter->glitches, glitches + __builtin_popcount(reverted), memory_order_relaxed);
+		filter->pending &= ~reverted;
+	}
+
+	//Only the pins that differ from their filtered level need any work
+	uint64_t start = (edgeNs != 0 && edgeNs <= nowNs) ? edgeNs : nowNs;
+	while(diff)
+	{
+		int pin = __builtin_ctz(diff);
+		uint32_t bit = 1u << pin;
+		diff &= diff - 1;
+
+		if(!(filter->pending & bit))
+		{
+			uint64_t pinEdgeNs = filter->edgeNs[pin];
+			filter->pending |= bit;
+			filter->since[pin] = (pinEdgeNs != 0 && pinEdgeNs <= nowNs) ? pinEdgeNs : start;
+		}
+		else if(filter->edgeNs[pin] > filter->since[pin] && filter->edgeNs[pin] <= nowNs)
+		{
+			//The pin went back and changed again between two samples: that bounce was a glitch, and the
+			//level has only held since the latest edge
+			unsigned long glitches = atomic_load_explicit(&filter->glitches, memory_order_relaxed);
+			atomic_store_explicit(&filter->glitches, glitches + 1, memory_order_relaxed);
+			filter->since[pin] = filter->edgeNs[pin];
+		}
+
+		//A pin going high means its beam was restored, which has to hold for longer (hysteresis)
+		uint64_t required = (raw & bit) ? filter->restoreNs : filter->breakNs;
+		uint64_t acceptNs = filter->since[pin] + required;
+
+		if(nowNs >= acceptNs)
+		{
+			filter->stable ^= bit;
+			filter->pending &= ~bit;
+		}
+		else if(acceptNs < *deadlineNs)
+		{
+			*deadlineNs = acceptNs;
+		}
+	}
+
+	//The edge timestamps only come with an edge, so there is nothing to clear after a sample without one
+	if(edgeNs != 0)
+	{
+		for(uint32_t pins = filter->pinMask; pins; pins &= pins - 1)
+		{
+			filter->edgeNs[__builtin_ctz(pins)] = 0;
+		}
+	}
+	return filter->stable;
+}
@@ -0,0 +1,32 @@
+
+#ifndef LASER_FILTER_H
+#define LASER_FILTER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+//Default minimum time a beam must stay broken before the state machine sees it, and the extra
+//time (hysteresis) a broken beam must stay restored before it counts as unbroken again
+#define FILTER_STABLE_US     2000
+#define FILTER_HYSTERESIS_US 1000
+
+//Per pin debounce filter between the level register and the state machines
+//A change of a pin is only passed on once the pin has held its new level for the stable time,
+//measured from the edge that started it; a change that reverts earlier is dropped as a glitch
+typedef struct
+{
+	uint32_t pinMask; 		//pins being filtered
+	uint32_t stable; 		//filtered levels passed on to the state machines
+	uint32_t pending; 		//pins whose raw level differs from the filtered level
+	int primed; 			//set once the first sample has been taken as the filtered level
+	uint64_t breakNs; 		//time a pin must stay low (beam broken)
+	uint64_t restoreNs; 	//time a pin must stay high (beam restored)
+	uint64_t since[32]; 	//when the pending change of each pin started
+	uint64_t edgeNs[32]; 	//kernel timestamp of the latest edge of each pin since the previous sample, 0 if unknown
+	atomic_ulong glitches; 	//changes dropped because they reverted early (only the sensing loop writes it)
+} LaserFilter;
+
+void     laserFilterConfigure(LaserFilter* filter, uint32_t stableUs, uint32_t hysteresisUs);
+uint32_t laserFilterUpdate   (LaserFilter* filter, uint32_t raw, uint64_t nowNs, uint64_t edgeNs, uint64_t* deadlineNs);
+
+#endif /* LASER_FILTER_H */
@@ -0,0 +1,284 @@
+#define _GNU_SOURCE 		//for sem_clockwait()
+#include "laser_fleet.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <netdb.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "laser_time.h"
+
+//This function opens a datagram socket for 'address': "unix:<path>" for a Unix socket, "<host>:<port>" for UDP
+//With receive set the socket is bound and receives at that address (an empty host receives on every interface),
+//otherwise it is connected to it and sends there
+//Returns the socket, or -1 if the address is invalid or the socket cannot be opened
+//A host that cannot be looked up (e.g. the name server is not reachable yet) fails with EHOSTUNREACH
+int laserFleetOpen(const char* address, int receive)
+{
+	if(strncmp(address, "unix:", 5) == 0)
+	{
+		struct sockaddr_un local;
+		memset(&local, 0, sizeof(local));
+		local.sun_family = AF_UNIX;
+		if(strlen(address + 5) >= sizeof(local.sun_path))
+		{
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		strcpy(local.sun_path, address + 5);
+
+		int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if(fd < 0)
+		{
+			return -1;
+		}
+		if(receive)
+		{
+			//Replace the socket left by a previous run
+			unlink(local.sun_path);
+		}
+		if((receive ? bind(fd, (struct sockaddr*)&local, sizeof(local)) :
+		              connect(fd, (struct sockaddr*)&local, sizeof(local))) < 0)
+		{
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	//Split "<host>:<port>" at the last colon
+	char host[256];
+	const char* colon = strrchr(address, ':');
+	if(colon == NULL || (size_t)(colon - address) >= sizeof(host))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(host, address, colon - address);
+	host[colon - address] = 0;
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = receive ? AI_PASSIVE : 0;
+
+	struct addrinfo* results;
+	int error = getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &results);
+	if(error != 0)
+	{
+		errno = (error == EAI_SERVICE || error == EAI_BADFLAGS || error == EAI_SOCKTYPE) ? EINVAL : EHOSTUNREACH;
+		return -1;
+	}
+
+	int fd = -1;
+	for(struct addrinfo* result = results; result != NULL && fd < 0; result = result->ai_next)
+	{
+		fd = socket(result->ai_family, result->ai_socktype | SOCK_CLOEXEC, result->ai_protocol);
+		if(fd < 0)
+		{
+			continue;
+		}
+		if((receive ? bind(fd, result->ai_addr, result->ai_addrlen) : connect(fd, result->ai_addr, result->ai_addrlen)) < 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(results);
+	return fd;
+}
+
+//This function writes a datagram of 'count' events numbered from 'sequence' into datagram (FLEET_DATAGRAM_MAX bytes)
+//Returns the length of the datagram
+int laserFleetEncode(uint8_t* datagram, uint32_t counterId, uint32_t bootId, uint64_t sequence,
+                     const FleetEvent* events, int count)
+{
+	FleetHeader header;
+	header.magic = FLEET_MAGIC;
+	header.version = FLEET_VERSION;
+	header.count = (uint16_t)count;
+	header.counterId = counterId;
+	header.bootId = bootId;
+	header.sequence = sequence;
+
+	memcpy(datagram, &header, sizeof(header));
+	memcpy(datagram + sizeof(header), events, count * sizeof(FleetEvent));
+	return (int)(sizeof(header) + count * sizeof(FleetEvent));
+}
+
+//This function closes the socket to the aggregator, if it is open
+static void closeSocket(LaserFleet* fleet)
+{
+	if(fleet->fd >= 0)
+	{
+		close(fleet->fd);
+		fleet->fd = -1;
+	}
+}
+
+//This function numbers a batch of events and sends it as one datagram
+//A failed send is not retried: the next snapshot makes up for the lost events
+static void sendBatch(LaserFleet* fleet, const FleetEvent* events, int count)
+{
+	uint8_t datagram[FLEET_DATAGRAM_MAX];
+	int length = laserFleetEncode(datagram, fleet->counterId, fleet->bootId, fleet->sequence + 1, events, count);
+	fleet->sequence += count;
+
+	if(fleet->fd >= 0 && send(fleet->fd, datagram, length, MSG_NOSIGNAL | MSG_DONTWAIT) == length)
+	{
+		unsigned long datagrams = atomic_load_explicit(&fleet->datagrams, memory_order_relaxed);
+		atomic_store_explicit(&fleet->datagrams, datagrams + 1, memory_order_relaxed);
+	}
+	else if(fleet->fd >= 0 && (errno == ECONNREFUSED || errno == ENOTCONN || errno == ENOENT))
+	{
+		//The aggregator is not there (e.g. it is restarting): connect again at the next snapshot
+		closeSocket(fleet);
+	}
+}
+
+//Sender thread: every batch interval (or when woken), sends the queued events in as few datagrams as possible,
+//and every snapshot interval sends the latest counts of every doorway again
+static void* senderThread(void* arg)
+{
+	LaserFleet* fleet = arg;
+	FleetEvent batch[FLEET_BATCH_EVENTS];
+	uint64_t snapshotNs = 0;
+
+	for(;;)
+	{
+		int running = atomic_load(&fleet->running);
+
+		//Take every queued event out, a datagram at a time
+		size_t tail = atomic_load_explicit(&fleet->tail, memory_order_relaxed);
+		size_t head = atomic_load_explicit(&fleet->head, memory_order_acquire);
+		while(tail != head)
+		{
+			int count = 0;
+			while(tail != head && count < FLEET_BATCH_EVENTS)
+			{
+				batch[count] = fleet->events[tail & (FLEET_QUEUE_SIZE - 1)];
+				if(batch[count].doorway < LASER_MAX_DOORWAYS)
+				{
+					fleet->latest[batch[count].doorway] = batch[count];
+				}
+				count++;
+				tail++;
+			}
+			atomic_store_explicit(&fleet->tail, tail, memory_order_release);
+			sendBatch(fleet, batch, count);
+		}
+
+		//The snapshot repeats the counts of every doorway, as of their latest event
+		uint64_t nowNs = laserMonotonicNs();
+		if(nowNs >= snapshotNs || !running)
+		{
+			if(fleet->fd < 0)
+			{
+				fleet->fd = laserFleetOpen(fleet->address, 0);
+			}
+
+			int count = 0;
+			for(int i = 0; i < fleet->numDoorways; i++)
+			{
+				if(fleet->latest[i].time != 0)
+				{
+					batch[count] = fleet->latest[i];
+					batch[count].actions = 0;
+					count++;
+				}
+			}
+			if(count > 0)
+			{
+				sendBatch(fleet, batch, count);
+			}
+			snapshotNs = nowNs + (uint64_t)fleet->snapshotMs * 1000000;
+		}
+
+		if(!running)
+		{
+			break;
+		}
+
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += fleet->batchMs / 1000;
+		deadline.tv_nsec += (long)(fleet->batchMs % 1000) * 1000000;
+		if(deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		while(sem_clockwait(&fleet->wakeup, CLOCK_MONOTONIC, &deadline) < 0 && errno == EINTR)
+		{
+		}
+	}
+	return NULL;
+}
+
+//This function connects to the aggregator at 'address' (see laserFleetOpen) and starts the sender thread
+//The counter is identified by counterId, and by a boot number drawn now so that the aggregator sees a restart
+//An aggregator that is not listening yet on its Unix socket, or whose host cannot be looked up yet, is connected to
+//later, at a snapshot (fleet->lookupFailed tells the caller about the lookup, so that it is logged once)
+//Returns 0 on success or -1 if the address is invalid, or the socket or the thread cannot be created
+int laserFleetStart(LaserFleet* fleet, const char* address, uint32_t counterId, int numDoorways)
+{
+	if(strlen(address) >= sizeof(fleet->address))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(fleet->address, address);
+
+	fleet->fd = laserFleetOpen(address, 0);
+	if(fleet->fd < 0 && errno != ENOENT && errno != ECONNREFUSED && errno != EHOSTUNREACH)
+	{
+		return -1;
+	}
+	fleet->lookupFailed = (fleet->fd < 0 && errno == EHOSTUNREACH);
+
+	if(getrandom(&fleet->bootId, sizeof(fleet->bootId), GRND_NONBLOCK) != sizeof(fleet->bootId))
+	{
+		fleet->bootId = (uint32_t)(laserWallNs(laserMonotonicNs()) ^ getpid());
+	}
+	fleet->counterId = counterId;
+	fleet->sequence = 0;
+	fleet->batchMs = FLEET_BATCH_MS;
+	fleet->snapshotMs = FLEET_SNAPSHOT_MS;
+	fleet->numDoorways = numDoorways;
+	memset(fleet->latest, 0, sizeof(fleet->latest));
+	atomic_init(&fleet->head, 0);
+	atomic_init(&fleet->tail, 0);
+	atomic_init(&fleet->dropped, 0);
+	atomic_init(&fleet->datagrams, 0);
+	atomic_init(&fleet->running, 1);
+
+	if(sem_init(&fleet->wakeup, 0, 0) < 0)
+	{
+		closeSocket(fleet);
+		return -1;
+	}
+	if(pthread_create(&fleet->sender, NULL, senderThread, fleet) != 0)
+	{
+		sem_destroy(&fleet->wakeup);
+		closeSocket(fleet);
+		return -1;
+	}
+	return 0;
+}
+
+//This function stops the sender thread after it has sent every queued event and a last snapshot
+void laserFleetStop(LaserFleet* fleet)
+{
+	atomic_store(&fleet->running, 0);
+	sem_post(&fleet->wakeup);
+	pthread_join(fleet->sender, NULL);
+	sem_destroy(&fleet->wakeup);
+	closeSocket(fleet);
+}
@@ -0,0 +1,117 @@
+
+#ifndef LASER_FLEET_H
+#define LASER_FLEET_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "laser_fsm.h"
+
+#define FLEET_MAGIC   0x314C464C 	//"LFL1"
+#define FLEET_VERSION 1
+
+//Events sent in one datagram at most (the datagram then fits in a 1500 byte Ethernet frame)
+#define FLEET_BATCH_EVENTS 60
+
+//Number of events the sensing loop can queue for the sender thread (must be a power of two)
+#define FLEET_QUEUE_SIZE 1024
+
+//Default time between two datagrams, and between two snapshots of every doorway's counts
+#define FLEET_BATCH_MS    100
+#define FLEET_SNAPSHOT_MS 5000
+
+//Default UDP port of the aggregator
+#define FLEET_PORT 7411
+
+//Header of a datagram, followed by 'count' events numbered from 'sequence' up
+//Every field is little-endian (the byte order of the Pi and of the aggregator hosts)
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t count;
+	uint32_t counterId; 		//FLEET_ID of the counter
+	uint32_t bootId; 			//random number drawn when the counter starts, so a restart is recognised
+	uint64_t sequence; 			//sequence number of the first event, numbered from 1 after every start
+} FleetHeader;
+
+//One count event: the counts of a doorway after a change (or in a snapshot)
+//As the counts are absolute, the latest event of a doorway gives its state: a lost event is made up for by the next
+//one, and a duplicated or late one is recognised by its sequence number
+typedef struct
+{
+	int64_t time; 				//wall clock nanoseconds
+	int32_t numberIn;
+	int32_t numberOut;
+	uint8_t doorway;
+	uint8_t actions; 			//ACT_COUNT_IN or ACT_COUNT_OUT, 0 for a snapshot
+	uint16_t reserved;
+	uint32_t reserved2;
+} FleetEvent;
+
+_Static_assert(sizeof(FleetHeader) == 24 && sizeof(FleetEvent) == 24, "the datagram layout must not depend on padding");
+
+#define FLEET_DATAGRAM_MAX (sizeof(FleetHeader) + FLEET_BATCH_EVENTS * sizeof(FleetEvent))
+
+//The sender: the sensing loop queues events without blocking, a thread batches them into datagrams
+typedef struct
+{
+	//Single producer (the sensing loop), single consumer (the sender thread) queue
+	FleetEvent events[FLEET_QUEUE_SIZE];
+	atomic_size_t head; 		//next slot the sensing loop writes
+	atomic_size_t tail; 		//next slot the sender thread reads
+
+	char address[112]; 			//address of the aggregator (see laserFleetOpen)
+	int fd; 					//socket connected to the aggregator, -1 while it cannot be reached
+	int lookupFailed; 			//the host could not be looked up when the sender started (set before the thread)
+	uint32_t counterId;
+	uint32_t bootId;
+	uint64_t sequence; 			//sequence number of the last event sent
+	int batchMs;
+	int snapshotMs;
+
+	//Latest counts sent for each doorway, sent again in every snapshot (only the sender thread uses them)
+	FleetEvent latest[LASER_MAX_DOORWAYS];
+	int numDoorways;
+
+	sem_t wakeup;
+	atomic_int running;
+	atomic_ulong dropped; 		//events dropped because the queue was full
+	atomic_ulong datagrams; 	//datagrams sent
+	pthread_t sender;
+} LaserFleet;
+
+int  laserFleetOpen (const char* address, int receive);
+int  laserFleetStart(LaserFleet* fleet, const char* address, uint32_t counterId, int numDoorways);
+void laserFleetStop (LaserFleet* fleet);
+int  laserFleetEncode(uint8_t* datagram, uint32_t counterId, uint32_t bootId, uint64_t sequence,
+                      const FleetEvent* events, int count);
+
+//This function queues the counts of a doorway for the aggregator, without blocking and without any system call
+//Only the sensing loop may call it
+//Returns 0 on success or -1 if the queue was full (the next snapshot makes up for the event)
+static inline int laserFleetPost(LaserFleet* fleet, int doorway, unsigned actions, const LaserCounts* counts, int64_t time)
+{
+	size_t head = atomic_load_explicit(&fleet->head, memory_order_relaxed);
+	if(head - atomic_load_explicit(&fleet->tail, memory_order_acquire) == FLEET_QUEUE_SIZE)
+	{
+		unsigned long dropped = atomic_load_explicit(&fleet->dropped, memory_order_relaxed);
+		atomic_store_explicit(&fleet->dropped, dropped + 1, memory_order_relaxed);
+		return -1;
+	}
+
+	FleetEvent* event = &fleet->events[head & (FLEET_QUEUE_SIZE - 1)];
+	event->time = time;
+	event->numberIn = counts->numberIn;
+	event->numberOut = counts->numberOut;
+	event->doorway = (uint8_t)doorway;
+	event->actions = (uint8_t)(actions & (ACT_COUNT_IN | ACT_COUNT_OUT));
+	event->reserved = 0;
+	event->reserved2 = 0;
+	atomic_store_explicit(&fleet->head, head + 1, memory_order_release);
+	return 0;
+}
+
+#endif /* LASER_FLEET_H */
@@ -0,0 +1,226 @@
+#include "laser_fleet.h"
+#include "laser_time.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+//This program simulates a fleet of counters sending their counts to an aggregator, to test it without the hardware
+//Each counter numbers and batches its events like the fleet sender of the counter, and the network is made
+//unreliable on purpose: datagrams are dropped, sent twice or held back and sent after the next ones
+//When every event is sent, each counter sends one last snapshot of its counts (never dropped), after which the
+//aggregator must show the totals printed at the end
+//Usage: laser_fleetsim [-a <address>] [-n <counters>] [-d <doorways>] [-e <events per counter>] [-r <events/s>]
+//                      [-l <loss %>] [-u <duplicate %>] [-o <reorder %>]
+
+//Events a simulated counter puts in one datagram
+#define SIM_BATCH_EVENTS 8
+
+typedef struct
+{
+	uint32_t counterId;
+	uint32_t bootId;
+	uint64_t sequence; 							//sequence number of the last event numbered
+	LaserCounts counts[LASER_MAX_DOORWAYS];
+	uint8_t held[FLEET_DATAGRAM_MAX]; 			//datagram held back to be sent out of order
+	int heldLength;
+} SimCounter;
+
+typedef struct
+{
+	int fd;
+	int loss;
+	int duplicate;
+	int reorder;
+	unsigned long sent;
+	unsigned long dropped;
+	unsigned long duplicated;
+	unsigned long reordered;
+} SimNetwork;
+
+static void sendDatagram(SimNetwork* network, const uint8_t* datagram, int length)
+{
+	while(send(network->fd, datagram, length, 0) < 0 && (errno == EAGAIN || errno == ENOBUFS || errno == EINTR))
+	{
+		//A Unix socket is full while the aggregator catches up
+		usleep(100);
+	}
+	network->sent++;
+}
+
+//This function sends a datagram through the unreliable network: it may be lost, duplicated, or held back and
+//sent after the counter's next datagram
+static void sendUnreliable(SimNetwork* network, SimCounter* counter, const uint8_t* datagram, int length)
+{
+	if(rand() % 100 < network->loss)
+	{
+		network->dropped++;
+		return;
+	}
+	if(counter->heldLength == 0 && rand() % 100 < network->reorder)
+	{
+		memcpy(counter->held, datagram, length);
+		counter->heldLength = length;
+		network->reordered++;
+		return;
+	}
+
+	sendDatagram(network, datagram, length);
+	if(rand() % 100 < network->duplicate)
+	{
+		sendDatagram(network, datagram, length);
+		network->duplicated++;
+	}
+
+	if(counter->heldLength != 0)
+	{
+		sendDatagram(network, counter->held, counter->heldLength);
+		counter->heldLength = 0;
+	}
+}
+
+int main(const int argc, const char* const argv[])
+{
+	char defaultAddress[32];
+	snprintf(defaultAddress, sizeof(defaultAddress), "localhost:%d", FLEET_PORT);
+	const char* address = defaultAddress;
+	int numCounters = 100;
+	int numDoorways = 2;
+	long eventsPerCounter = 1000;
+	long rate = 10000;
+	SimNetwork network = {-1, 0, 0, 0, 0, 0, 0, 0};
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2)
+		{
+			fprintf(stderr, "Usage: %s [-a <address>] [-n <counters>] [-d <doorways>] [-e <events per counter>] [-r <events/s>] "
+			        "[-l <loss %%>] [-u <duplicate %%>] [-o <reorder %%>]\n", argv[0]);
+			return -1;
+		}
+		const char* value = argv[++i];
+		switch(argv[i - 1][1])
+		{
+			case 'a': address = value; break;
+			case 'n': numCounters = atoi(value); break;
+			case 'd': numDoorways = atoi(value); break;
+			case 'e': eventsPerCounter = atol(value); break;
+			case 'r': rate = atol(value); break;
+			case 'l': network.loss = atoi(value); break;
+			case 'u': network.duplicate = atoi(value); break;
+			case 'o': network.reorder = atoi(value); break;
+			default:
+				fprintf(stderr, "Unknown option -%c\n", argv[i - 1][1]);
+				return -1;
+		}
+	}
+	if(numCounters <= 0 || numDoorways <= 0 || numDoorways > LASER_MAX_DOORWAYS || eventsPerCounter < 0 || rate <= 0)
+	{
+		fprintf(stderr, "Invalid option value\n");
+		return -1;
+	}
+
+	laserTimeInit();
+	srand((unsigned)time(NULL));
+
+	network.fd = laserFleetOpen(address, 0);
+	if(network.fd < 0)
+	{
+		fprintf(stderr, "Cannot send to %s: %s\n", address, strerror(errno));
+		return -1;
+	}
+
+	SimCounter* counters = calloc(numCounters, sizeof(SimCounter));
+	for(int i = 0; i < numCounters; i++)
+	{
+		counters[i].counterId = 1000 + i;
+		counters[i].bootId = (uint32_t)rand();
+	}
+
+	//Every round, each counter sends one datagram of events, paced to the requested rate over the whole fleet
+	uint8_t datagram[FLEET_DATAGRAM_MAX];
+	FleetEvent batch[SIM_BATCH_EVENTS];
+	long events = 0;
+	uint64_t startNs = laserMonotonicNs();
+	for(long round = 0; round * SIM_BATCH_EVENTS < eventsPerCounter; round++)
+	{
+		for(int i = 0; i < numCounters; i++)
+		{
+			SimCounter* counter = &counters[i];
+			int count = 0;
+			while(count < SIM_BATCH_EVENTS && round * SIM_BATCH_EVENTS + count < eventsPerCounter)
+			{
+				//Enter more often than exit, so that the building fills up
+				int doorway = rand() % numDoorways;
+				unsigned actions = (rand() % 5 < 3) ? ACT_COUNT_IN : ACT_COUNT_OUT;
+				laserFsmCountActions(actions, &counter->counts[doorway]);
+
+				FleetEvent* event = &batch[count++];
+				memset(event, 0, sizeof(*event));
+				event->time = laserWallNs(laserMonotonicNs());
+				event->numberIn = counter->counts[doorway].numberIn;
+				event->numberOut = counter->counts[doorway].numberOut;
+				event->doorway = (uint8_t)doorway;
+				event->actions = (uint8_t)actions;
+			}
+
+			int length = laserFleetEncode(datagram, counter->counterId, counter->bootId, counter->sequence + 1, batch, count);
+			counter->sequence += count;
+			events += count;
+			sendUnreliable(&network, counter, datagram, length);
+		}
+
+		//Pace the rounds
+		uint64_t dueNs = startNs + (uint64_t)(events * 1e9 / rate);
+		uint64_t nowNs = laserMonotonicNs();
+		if(dueNs > nowNs)
+		{
+			struct timespec pause = {(time_t)((dueNs - nowNs) / 1000000000), (long)((dueNs - nowNs) % 1000000000)};
+			nanosleep(&pause, NULL);
+		}
+	}
+	uint64_t elapsedNs = laserMonotonicNs() - startNs;
+
+	//The final snapshots: every doorway's counts, and any datagram still held back
+	long totalIn = 0;
+	long totalOut = 0;
+	for(int i = 0; i < numCounters; i++)
+	{
+		SimCounter* counter = &counters[i];
+		if(counter->heldLength != 0)
+		{
+			sendDatagram(&network, counter->held, counter->heldLength);
+			counter->heldLength = 0;
+		}
+
+		FleetEvent snapshot[LASER_MAX_DOORWAYS];
+		memset(snapshot, 0, sizeof(snapshot));
+		for(int j = 0; j < numDoorways; j++)
+		{
+			snapshot[j].time = laserWallNs(laserMonotonicNs());
+			snapshot[j].numberIn = counter->counts[j].numberIn;
+			snapshot[j].numberOut = counter->counts[j].numberOut;
+			snapshot[j].doorway = (uint8_t)j;
+			totalIn += counter->counts[j].numberIn;
+			totalOut += counter->counts[j].numberOut;
+		}
+		int length = laserFleetEncode(datagram, counter->counterId, counter->bootId, counter->sequence + 1, snapshot, numDoorways);
+		counter->sequence += numDoorways;
+		sendDatagram(&network, datagram, length);
+	}
+
+	printf("Sent %ld events from %d counters in %.3f s (%.0f events/s)\n", events, numCounters, elapsedNs / 1e9,
+	       events * 1e9 / (elapsedNs ? elapsedNs : 1));
+	printf("Datagrams: %lu sent, %lu dropped, %lu duplicated, %lu reordered\n", network.sent, network.dropped,
+	       network.duplicated, network.reordered);
+	printf("Expected: laser_fleet_occupancy %ld, laser_fleet_entered_total %ld, laser_fleet_exited_total %ld\n",
+	       totalIn - totalOut, totalIn, totalOut);
+
+	free(counters);
+	close(network.fd);
+	return 0;
+}
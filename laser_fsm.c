@@ -0,0 +1,78 @@
+#include "laser_fsm.h"
+
+//The transition table is generated at compile time from the rules below
+//Every entry is a constant expression of the machine state _s and the beam mask _m,
+//so the compiler evaluates the whole state machine (see Fig. 2) into a read-only table
+//and the sensing loop only performs a lookup
+
+#define S_IS(_s, _state)  (LASER_STATE(_s) == (_state))
+
+//Next State, before the break flags are merged in
+#define FSM_NEXT_STATE(_s, _m) \
+	(S_IS(_s, START) ? ((_m) == BEAMS_NONE ? BOTH_UNBROKEN : DONE) : \
+	 S_IS(_s, BOTH_UNBROKEN) ? ((_m) == BEAMS_LASER1 ? ONLY_LASER1_BROKEN : \
+	                            (_m) == BEAMS_LASER2 ? ONLY_LASER2_BROKEN : BOTH_UNBROKEN) : \
+	 S_IS(_s, ONLY_LASER1_BROKEN) ? ((_m) == BEAMS_NONE ? BOTH_UNBROKEN : \
+	                                 (_m) == BEAMS_BOTH ? BOTH_BROKEN : ONLY_LASER1_BROKEN) : \
+	 S_IS(_s, ONLY_LASER2_BROKEN) ? ((_m) == BEAMS_NONE ? BOTH_UNBROKEN : \
+	                                 (_m) == BEAMS_BOTH ? BOTH_BROKEN : ONLY_LASER2_BROKEN) : \
+	 S_IS(_s, BOTH_BROKEN) ? ((_m) == BEAMS_LASER1 ? ONLY_LASER1_BROKEN : \
+	                          (_m) == BEAMS_LASER2 ? ONLY_LASER2_BROKEN : BOTH_BROKEN) : \
+	 DONE)
+
+//Break flags: cleared once both lasers are unbroken, set by the laser that breaks first
+#define FSM_NEXT_FLAGS(_s, _m) \
+	(FSM_NEXT_STATE(_s, _m) == BOTH_UNBROKEN ? 0 : \
+	 S_IS(_s, BOTH_UNBROKEN) ? (FSM_NEXT_STATE(_s, _m) == ONLY_LASER1_BROKEN ? LASER1_HAS_BROKEN : \
+	                            FSM_NEXT_STATE(_s, _m) == ONLY_LASER2_BROKEN ? LASER2_HAS_BROKEN : 0) : \
+	 ((_s) & (LASER1_HAS_BROKEN | LASER2_HAS_BROKEN)))
+
+#define FSM_NEXT(_s, _m)  (FSM_NEXT_STATE(_s, _m) | FSM_NEXT_FLAGS(_s, _m))
+
+//Actions: a laser breaking from the unbroken state counts that laser, the second laser breaking
+//counts the other one, and returning to the unbroken state counts an object in or out
+//depending on which laser was broken first
+#define FSM_ACTIONS(_s, _m) \
+	(S_IS(_s, START) ? ((_m) == BEAMS_NONE ? ACT_LOG : ACT_LOG | ACT_ABORT) : \
+	 S_IS(_s, BOTH_UNBROKEN) ? ((_m) == BEAMS_LASER1 ? ACT_BREAK1 | ACT_LOG | ACT_STATS : \
+	                            (_m) == BEAMS_LASER2 ? ACT_BREAK2 | ACT_LOG | ACT_STATS : 0) : \
+	 S_IS(_s, ONLY_LASER1_BROKEN) ? ((_m) == BEAMS_NONE ? ACT_LOG | (((_s) & LASER2_HAS_BROKEN) ? ACT_COUNT_OUT | ACT_STATS : 0) : \
+	                                 (_m) == BEAMS_BOTH ? ACT_BREAK2 | ACT_LOG | ACT_STATS : 0) : \
+	 S_IS(_s, ONLY_LASER2_BROKEN) ? ((_m) == BEAMS_NONE ? ACT_LOG | (((_s) & LASER1_HAS_BROKEN) ? ACT_COUNT_IN | ACT_STATS : 0) : \
+	                                 (_m) == BEAMS_BOTH ? ACT_BREAK1 | ACT_LOG | ACT_STATS : 0) : \
+	 S_IS(_s, BOTH_BROKEN) ? ((_m) == BEAMS_LASER1 || (_m) == BEAMS_LASER2 ? ACT_LOG : 0) : \
+	 S_IS(_s, DONE) ? 0 : ACT_ABORT)
+
+#define FSM_MESSAGE(_s, _m) \
+	(S_IS(_s, START) ? ((_m) == BEAMS_NONE ? MSG_STARTED : MSG_MUST_START_UNBROKEN) : \
+	 S_IS(_s, BOTH_UNBROKEN) ? ((_m) == BEAMS_LASER1 ? MSG_LASER1_BROKEN : \
+	                            (_m) == BEAMS_LASER2 ? MSG_LASER2_BROKEN : MSG_NONE) : \
+	 S_IS(_s, ONLY_LASER1_BROKEN) || S_IS(_s, ONLY_LASER2_BROKEN) ? ((_m) == BEAMS_NONE ? MSG_BOTH_UNBROKEN : \
+	                                                                 (_m) == BEAMS_BOTH ? MSG_BOTH_BROKEN : MSG_NONE) : \
+	 S_IS(_s, BOTH_BROKEN) ? ((_m) == BEAMS_LASER1 ? MSG_LASER2_UNBROKEN : \
+	                          (_m) == BEAMS_LASER2 ? MSG_LASER1_UNBROKEN : MSG_NONE) : \
+	 MSG_NONE)
+
+#define FSM_ENTRY(_s, _m) { FSM_NEXT(_s, _m), FSM_ACTIONS(_s, _m), FSM_MESSAGE(_s, _m) }
+#define FSM_ROW(_s)       { FSM_ENTRY(_s, 0), FSM_ENTRY(_s, 1), FSM_ENTRY(_s, 2), FSM_ENTRY(_s, 3) }
+#define FSM_ROWS8(_s)     FSM_ROW(_s), FSM_ROW(_s + 1), FSM_ROW(_s + 2), FSM_ROW(_s + 3), \
+                          FSM_ROW(_s + 4), FSM_ROW(_s + 5), FSM_ROW(_s + 6), FSM_ROW(_s + 7)
+
+const LaserTransition laserTransitionTable[LASER_FSM_STATES][4] =
+{
+	FSM_ROWS8(0), FSM_ROWS8(8), FSM_ROWS8(16), FSM_ROWS8(24)
+};
+
+//Log text for every LaserMessage
+const char* const laserMessages[] =
+{
+	[MSG_NONE]                = "",
+	[MSG_STARTED]             = "Both lasers unbroken: program successfully started.\n\n",
+	[MSG_MUST_START_UNBROKEN] = "Must start with both lasers unbroken: exiting program.\n\n",
+	[MSG_LASER1_BROKEN]       = "Laser 1 has been broken.\n\n",
+	[MSG_LASER2_BROKEN]       = "Laser 2 has been broken.\n\n",
+	[MSG_BOTH_UNBROKEN]       = "Both lasers are now unbroken.\n\n",
+	[MSG_BOTH_BROKEN]         = "Both lasers are now broken.\n\n",
+	[MSG_LASER2_UNBROKEN]     = "Laser 2 has unbroken: only Laser 1 is now broken.\n\n",
+	[MSG_LASER1_UNBROKEN]     = "Laser 1 has unbroken: only Laser 2 is now broken.\n\n",
+};
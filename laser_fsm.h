@@ -0,0 +1,82 @@
+
+#ifndef LASER_FSM_H
+#define LASER_FSM_H
+
+#include <stdint.h>
+
+//Beam masks sampled from the photodiodes
+//Bit 0 is set when laser 1 is broken and bit 1 is set when laser 2 is broken
+#define BEAMS_NONE   0x0
+#define BEAMS_LASER1 0x1
+#define BEAMS_LASER2 0x2
+#define BEAMS_BOTH   0x3
+
+//States of the laser state machine (see Fig. 2)
+typedef enum{START, ONLY_LASER1_BROKEN, ONLY_LASER2_BROKEN, BOTH_BROKEN, BOTH_UNBROKEN, DONE}State;
+
+//A machine state packs the State in the low three bits together with the flags recording
+//which laser was broken first since both lasers were last unbroken
+#define LASER_STATE_MASK  0x07
+#define LASER1_HAS_BROKEN 0x08
+#define LASER2_HAS_BROKEN 0x10
+#define LASER_FSM_STATES  32
+
+#define LASER_STATE(_s)   ((State)((_s) & LASER_STATE_MASK))
+
+//Action flags attached to a transition
+#define ACT_COUNT_IN   0x01 	//an object has entered the room
+#define ACT_COUNT_OUT  0x02 	//an object has exitted the room
+#define ACT_BREAK1     0x04 	//increment the number of times laser 1 was broken
+#define ACT_BREAK2     0x08 	//increment the number of times laser 2 was broken
+#define ACT_LOG        0x10 	//log the transition message
+#define ACT_STATS      0x20 	//the counts changed and the stats should be output
+#define ACT_ABORT      0x40 	//the program cannot continue
+
+//Messages logged by transitions, indexed by LaserTransition.message
+typedef enum{MSG_NONE, MSG_STARTED, MSG_MUST_START_UNBROKEN, MSG_LASER1_BROKEN, MSG_LASER2_BROKEN,
+	MSG_BOTH_UNBROKEN, MSG_BOTH_BROKEN, MSG_LASER2_UNBROKEN, MSG_LASER1_UNBROKEN, LASER_MESSAGES}LaserMessage;
+
+typedef struct
+{
+	uint8_t next;
+	uint8_t actions;
+	uint8_t message;
+} LaserTransition;
+
+//Largest number of doorways (each with its own state machine) a counter can watch
+#define LASER_MAX_DOORWAYS 8
+
+//Counts kept by the state machine
+typedef struct
+{
+	int laser1Count;
+	int laser2Count;
+	int numberIn;
+	int numberOut;
+} LaserCounts;
+
+extern const LaserTransition laserTransitionTable[LASER_FSM_STATES][4];
+extern const char* const laserMessages[];
+
+//This function looks up the transition taken from the machine state 'state' for the beam mask 'beams'
+static inline const LaserTransition* laserFsmStep(uint8_t state, unsigned beams)
+{
+	return &laserTransitionTable[state & (LASER_FSM_STATES - 1)][beams & BEAMS_BOTH];
+}
+
+//This function applies the counting actions 'actions' to the counts
+static inline void laserFsmCountActions(unsigned actions, LaserCounts* counts)
+{
+	counts->laser1Count += (actions & ACT_BREAK1) != 0;
+	counts->laser2Count += (actions & ACT_BREAK2) != 0;
+	counts->numberIn += (actions & ACT_COUNT_IN) != 0;
+	counts->numberOut += (actions & ACT_COUNT_OUT) != 0;
+}
+
+//This function applies the counting actions of a transition to the counts
+static inline void laserFsmCount(const LaserTransition* transition, LaserCounts* counts)
+{
+	laserFsmCountActions(transition->actions, counts);
+}
+
+#endif /* LASER_FSM_H */
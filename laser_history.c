@@ -0,0 +1,215 @@
+#define _GNU_SOURCE 		//for strptime() and timegm()
+#include "laser_rollup.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+//This program answers questions about the counting history from the rollup file, without reading any raw event
+//Usage: laser_history <rollup file> <from> <to> [-m | -h | -d]
+//The times are local, "YYYY-mm-dd" or "YYYY-mm-dd HH:MM", and the range runs from 'from' up to (not including) 'to'
+//Without an option it prints the totals over the range, read from as few buckets as possible: whole days from the day
+//buckets, whole hours from the hour buckets and only the minutes at the edges from the minute buckets
+//With -m, -h or -d it prints every minute, hour or day bucket of the range instead
+
+//This function parses a local time into local seconds (seconds since the epoch plus the UTC offset)
+//Returns 0 on success or -1 if the text is not a time from 1970 on
+static int parseTime(const char* text, int64_t* seconds)
+{
+	struct tm local;
+	memset(&local, 0, sizeof(local));
+	const char* end = strptime(text, "%Y-%m-%d", &local);
+	if(end != NULL && *end != 0)
+	{
+		end = strptime(end, " %H:%M", &local);
+	}
+	if(end == NULL || *end != 0)
+	{
+		return -1;
+	}
+
+	//The local seconds are what the wall clock shows taken as UTC
+	//The buckets are numbered from 1970, so an earlier time (or one timegm cannot convert) is refused
+	*seconds = (int64_t)timegm(&local);
+	if(*seconds < 0)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+//This function formats local seconds as a local time
+static void formatTime(int64_t seconds, char* buffer, size_t size)
+{
+	time_t time = (time_t)seconds;
+	struct tm local;
+	gmtime_r(&time, &local);
+	strftime(buffer, size, "%Y-%m-%d %H:%M", &local);
+}
+
+//Totals over a range of buckets
+typedef struct
+{
+	long numberIn;
+	long numberOut;
+	long laser1Count;
+	long laser2Count;
+	long peakOccupancy;
+	int hasPeak;
+	long buckets; 		//buckets read
+	long missing; 		//seconds of the range no longer kept by any ring
+} HistoryTotals;
+
+static void addBucket(HistoryTotals* totals, const RollupBucket* bucket, int found)
+{
+	totals->buckets++;
+	if(found != 1)
+	{
+		return;
+	}
+	totals->numberIn += bucket->numberIn;
+	totals->numberOut += bucket->numberOut;
+	totals->laser1Count += bucket->laser1Count;
+	totals->laser2Count += bucket->laser2Count;
+	if(!totals->hasPeak || bucket->peakOccupancy > totals->peakOccupancy)
+	{
+		totals->peakOccupancy = bucket->peakOccupancy;
+		totals->hasPeak = 1;
+	}
+}
+
+//This function adds up the counts of [fromS, toS) from the coarsest buckets that fit
+//Where the coarse bucket has aged out of its ring, the finer ones are tried, and the other way around
+//Returns 0, or -1 if the rollup is stuck in the middle of an update
+static int sumRange(const LaserRollup* rollup, int64_t fromS, int64_t toS, HistoryTotals* totals)
+{
+	int64_t t = fromS;
+	while(t < toS)
+	{
+		//Try the coarsest bucket that starts at t and ends within the range first
+		int done = 0;
+		for(int r = ROLLUP_RESOLUTIONS - 1; r >= 0 && !done; r--)
+		{
+			int64_t width = laserRollupWidths[r];
+			if(t % width != 0 || t + width > toS)
+			{
+				continue;
+			}
+
+			RollupBucket bucket;
+			int found = laserRollupRead(rollup, (RollupResolution)r, t / width, &bucket);
+			if(found == -2)
+			{
+				return -1;
+			}
+			if(found >= 0)
+			{
+				addBucket(totals, &bucket, found);
+				t += width;
+				done = 1;
+			}
+		}
+
+		//Not a single bucket keeps this minute: skip it
+		if(!done)
+		{
+			totals->missing += laserRollupWidths[ROLLUP_MINUTE];
+			t += laserRollupWidths[ROLLUP_MINUTE];
+		}
+	}
+	return 0;
+}
+
+int main(const int argc, const char* const argv[])
+{
+	int64_t fromS;
+	int64_t toS;
+	if(argc < 4 || parseTime(argv[2], &fromS) < 0 || parseTime(argv[3], &toS) < 0 || toS <= fromS ||
+	   (argc > 4 && strcmp(argv[4], "-m") != 0 && strcmp(argv[4], "-h") != 0 && strcmp(argv[4], "-d") != 0))
+	{
+		fprintf(stderr, "Usage: %s <rollup file> <from> <to> [-m | -h | -d]\n", argv[0]);
+		fprintf(stderr, "The times are local, \"YYYY-mm-dd\" or \"YYYY-mm-dd HH:MM\", from 1970 on\n");
+		return -1;
+	}
+
+	LaserRollup rollup;
+	if(laserRollupMap(&rollup, argv[1]) < 0)
+	{
+		perror("The rollup file could not be opened");
+		return -1;
+	}
+
+	//The range is counted in whole minutes
+	fromS -= fromS % 60;
+	toS -= toS % 60;
+
+	char from[32];
+	char to[32];
+	char start[32];
+	formatTime(fromS, from, sizeof(from));
+	formatTime(toS, to, sizeof(to));
+
+	if(argc > 4)
+	{
+		//List every bucket of the range at one resolution
+		RollupResolution resolution = (argv[4][1] == 'm') ? ROLLUP_MINUTE : (argv[4][1] == 'h') ? ROLLUP_HOUR : ROLLUP_DAY;
+		int64_t width = laserRollupWidths[resolution];
+
+		printf("%-16s %8s %8s %8s %8s %6s\n", "start", "in", "out", "laser 1", "laser 2", "peak");
+		for(int64_t key = fromS / width; key * width < toS; key++)
+		{
+			RollupBucket bucket;
+			int found = laserRollupRead(&rollup, resolution, key, &bucket);
+			if(found == -2)
+			{
+				perror("The rollup file is stuck in the middle of an update");
+				laserRollupClose(&rollup);
+				return -1;
+			}
+			formatTime(key * width, start, sizeof(start));
+			if(found < 0)
+			{
+				printf("%-16s %8s\n", start, "-");
+			}
+			else if(found == 0)
+			{
+				printf("%-16s %8d %8d %8d %8d %6s\n", start, 0, 0, 0, 0, "-");
+			}
+			else
+			{
+				printf("%-16s %8d %8d %8d %8d %6d\n", start, bucket.numberIn, bucket.numberOut, bucket.laser1Count,
+				       bucket.laser2Count, bucket.peakOccupancy);
+			}
+		}
+	}
+	else
+	{
+		HistoryTotals totals;
+		memset(&totals, 0, sizeof(totals));
+		if(sumRange(&rollup, fromS, toS, &totals) < 0)
+		{
+			perror("The rollup file is stuck in the middle of an update");
+			laserRollupClose(&rollup);
+			return -1;
+		}
+
+		printf("From %s to %s:\n", from, to);
+		printf("%ld objects entered the room\n", totals.numberIn);
+		printf("%ld objects exitted the room\n", totals.numberOut);
+		printf("Laser 1 was broken %ld times\n", totals.laser1Count);
+		printf("Laser 2 was broken %ld times\n", totals.laser2Count);
+		if(totals.hasPeak)
+		{
+			printf("At most %ld objects were in the room\n", totals.peakOccupancy);
+		}
+		if(totals.missing > 0)
+		{
+			printf("%ld minutes of the range are no longer kept\n", totals.missing / 60);
+		}
+		fprintf(stderr, "(%ld buckets read)\n", totals.buckets);
+	}
+
+	laserRollupClose(&rollup);
+	return 0;
+}
@@ -0,0 +1,225 @@
+#define _GNU_SOURCE 		//for sem_clockwait()
+#include "laser_log.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+
+//This function queues one record without blocking and without any system call
+//(apart from waking the writer in LOG_IMMEDIATE mode)
+//Returns 0 on success or -1 if the queue was full and the record was dropped
+int laserLogPost(LaserLog* log, LogSink sink, uint64_t timeNs, int doorway,
+                 const char* format, long a0, long a1, long a2, long a3)
+{
+	LogRecord* record;
+	size_t pos = atomic_load_explicit(&log->enqueuePos, memory_order_relaxed);
+
+	//Claim a slot: a slot is free when its sequence number equals the position being claimed
+	for(;;)
+	{
+		record = &log->records[pos & (LOG_QUEUE_SIZE - 1)];
+		size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+		if(diff == 0)
+		{
+			if(atomic_compare_exchange_weak_explicit(&log->enqueuePos, &pos, pos + 1,
+			                                         memory_order_relaxed, memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if(diff < 0 && atomic_load_explicit(&log->durability, memory_order_relaxed) == LOG_LOSSLESS)
+		{
+			//Wake the writer and let it run until it has freed this slot
+			sem_post(&log->wakeup);
+			sched_yield();
+			pos = atomic_load_explicit(&log->enqueuePos, memory_order_relaxed);
+		}
+		else if(diff < 0)
+		{
+			//The writer has not caught up: drop rather than stall the sensing loop
+			atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+			return -1;
+		}
+		else
+		{
+			pos = atomic_load_explicit(&log->enqueuePos, memory_order_relaxed);
+		}
+	}
+
+	record->sink = sink;
+	record->doorway = doorway;
+	record->time = timeNs;
+	record->format = format;
+	record->args[0] = a0;
+	record->args[1] = a1;
+	record->args[2] = a2;
+	record->args[3] = a3;
+
+	//Publish the record to the writer thread
+	atomic_store_explicit(&record->sequence, pos + 1, memory_order_release);
+
+	if(atomic_load_explicit(&log->durability, memory_order_relaxed) == LOG_IMMEDIATE)
+	{
+		sem_post(&log->wakeup);
+	}
+	return 0;
+}
+
+//This function writes every queued record to its file and flushes the files that were written
+//Returns the number of records written
+static int drainRecords(LaserLog* log)
+{
+	int written[LOG_SINKS] = {0};
+	int total = 0;
+
+	char timeText[LASER_TIME_LEN];
+
+	for(;;)
+	{
+		LogRecord* record = &log->records[log->dequeuePos & (LOG_QUEUE_SIZE - 1)];
+		size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+
+		//Stop when the next slot has not been published yet
+		if(sequence != log->dequeuePos + 1)
+		{
+			break;
+		}
+
+		FILE* file = log->sinks[record->sink];
+		if(file != NULL)
+		{
+			//The date is only formatted again when the second changes
+			laserFormatTime(&log->timeCache, record->time, timeText);
+
+			//Same layout as PRINT_MSG: time : program name : message
+			fprintf(file, "%s : %s : ", timeText, log->programName);
+			if(record->doorway >= 0)
+			{
+				fprintf(file, "Doorway %d: ", record->doorway + 1);
+			}
+			fprintf(file, record->format, record->args[0], record->args[1], record->args[2], record->args[3]);
+			written[record->sink]++;
+		}
+
+		//Hand the slot back to the producers for the next lap around the queue
+		atomic_store_explicit(&record->sequence, log->dequeuePos + LOG_QUEUE_SIZE, memory_order_release);
+		log->dequeuePos++;
+		total++;
+	}
+
+	//One flush per file per batch instead of one per message
+	for(int i = 0; i < LOG_SINKS; i++)
+	{
+		if(written[i] > 0)
+		{
+			fflush(log->sinks[i]);
+			if(atomic_load_explicit(&log->durability, memory_order_relaxed) == LOG_FSYNC)
+			{
+				fsync(fileno(log->sinks[i]));
+			}
+		}
+	}
+	return total;
+}
+
+//Background writer thread: waits for the flush interval (or a wakeup) and writes out a batch
+static void* writerThread(void* arg)
+{
+	LaserLog* log = arg;
+	uint64_t refreshedNs = laserMonotonicNs();
+
+	while(atomic_load(&log->running))
+	{
+		int intervalMs = atomic_load_explicit(&log->flushIntervalMs, memory_order_relaxed);
+		//Monotonic deadline: an NTP step of the wall clock (the Pi has no RTC) must not stretch or skip a flush
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += intervalMs / 1000;
+		deadline.tv_nsec += (long)(intervalMs % 1000) * 1000000;
+		if(deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		//Either the interval expires or a producer (or laserLogStop) wakes us early
+		while(sem_clockwait(&log->wakeup, CLOCK_MONOTONIC, &deadline) < 0 && errno == EINTR)
+		{
+		}
+
+		//Follow NTP corrections of the wall clock, off the sensing thread and before the batch is formatted
+		uint64_t nowNs = laserMonotonicNs();
+		if(nowNs - refreshedNs >= 1000000000ull)
+		{
+			laserTimeRefresh();
+			refreshedNs = nowNs;
+		}
+
+		drainRecords(log);
+
+		//Start a new segment of the log file once the current one is full or old enough
+		//If the next segment cannot be opened the log sink is lost, rather than writing to a closed file
+		if(log->rotate != NULL && log->sinks[LOG_SINK_LOG] != NULL &&
+		   laserRotateCheck(log->rotate, log->sinks[LOG_SINK_LOG]) < 0)
+		{
+			log->sinks[LOG_SINK_LOG] = NULL;
+		}
+	}
+
+	//Write whatever was posted before the logger was stopped
+	drainRecords(log);
+	return NULL;
+}
+
+//This function initializes the queue and starts the writer thread
+//Returns 0 on success or -1 if the thread could not be started
+int laserLogStart(LaserLog* log, FILE* logFile, const char* programName,
+                  int flushIntervalMs, LogDurability durability)
+{
+	for(size_t i = 0; i < LOG_QUEUE_SIZE; i++)
+	{
+		atomic_init(&log->records[i].sequence, i);
+	}
+	atomic_init(&log->enqueuePos, 0);
+	log->dequeuePos = 0;
+
+	log->sinks[LOG_SINK_LOG] = logFile;
+	log->programName = programName;
+	atomic_init(&log->flushIntervalMs, flushIntervalMs > 0 ? flushIntervalMs : LOG_FLUSH_INTERVAL_MS);
+	atomic_init(&log->durability, durability);
+	log->timeCache.second = -1;
+	log->timeCache.prefix[0] = 0;
+
+	atomic_init(&log->running, 1);
+	atomic_init(&log->dropped, 0);
+
+	if(sem_init(&log->wakeup, 0, 0) < 0)
+	{
+		return -1;
+	}
+	if(pthread_create(&log->writer, NULL, writerThread, log) != 0)
+	{
+		sem_destroy(&log->wakeup);
+		return -1;
+	}
+	return 0;
+}
+
+//This function changes the flush interval and durability of a running logger
+//The new interval applies from the next batch
+void laserLogConfigure(LaserLog* log, int flushIntervalMs, LogDurability durability)
+{
+	atomic_store(&log->flushIntervalMs, flushIntervalMs > 0 ? flushIntervalMs : LOG_FLUSH_INTERVAL_MS);
+	atomic_store(&log->durability, durability);
+}
+
+//This function stops the writer thread after it has written every queued record
+void laserLogStop(LaserLog* log)
+{
+	atomic_store(&log->running, 0);
+	sem_post(&log->wakeup);
+	pthread_join(log->writer, NULL);
+	sem_destroy(&log->wakeup);
+}
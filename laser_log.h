@@ -0,0 +1,81 @@
+
+#ifndef LASER_LOG_H
+#define LASER_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "laser_time.h"
+#include "laser_rotate.h"
+
+//Number of records the queue can hold (must be a power of two)
+#define LOG_QUEUE_SIZE 1024
+
+//Default time between two batches written by the writer thread
+#define LOG_FLUSH_INTERVAL_MS 200
+
+//Files a record can be written to
+typedef enum{LOG_SINK_LOG, LOG_SINKS}LogSink;
+
+//How hard the writer thread works to get records onto the disk
+//LOG_BATCH:     write and fflush once per flush interval
+//LOG_IMMEDIATE: wake the writer for every record (the old PRINT_MSG behaviour, but off the sensing loop)
+//LOG_FSYNC:     like LOG_BATCH, and fsync the files after every batch
+//LOG_LOSSLESS:  like LOG_BATCH, but a full queue makes the poster wait for the writer instead of dropping
+//               (for the offline replay, where no record may be lost and nothing has a deadline)
+typedef enum{LOG_BATCH, LOG_IMMEDIATE, LOG_FSYNC, LOG_LOSSLESS}LogDurability;
+
+//A fixed-size log record
+//The format string must stay valid (a string literal), the writer thread formats it with the arguments
+typedef struct
+{
+	atomic_size_t sequence;
+	uint8_t sink;
+	int8_t doorway; 		//doorway the message is about, or -1
+	uint64_t time; 			//monotonic nanoseconds when the event was captured
+	const char* format;
+	long args[4];
+} LogRecord;
+
+typedef struct
+{
+	//Bounded lock-free queue: any thread may post, only the writer thread takes records out
+	LogRecord records[LOG_QUEUE_SIZE];
+	atomic_size_t enqueuePos;
+	size_t dequeuePos;
+
+	FILE* sinks[LOG_SINKS];
+	LaserRotate* rotate; 			//rotation of the log sink, set before laserLogStart (NULL to never rotate)
+	const char* programName;
+	atomic_int flushIntervalMs; 	//may be changed while running (config reload)
+	atomic_int durability;
+
+	sem_t wakeup;
+	atomic_int running;
+	atomic_ulong dropped;
+	pthread_t writer;
+	LaserTimeCache timeCache;
+} LaserLog;
+
+int  laserLogStart(LaserLog* log, FILE* logFile, const char* programName,
+                   int flushIntervalMs, LogDurability durability);
+void laserLogStop (LaserLog* log);
+void laserLogConfigure(LaserLog* log, int flushIntervalMs, LogDurability durability);
+
+int  laserLogPost (LaserLog* log, LogSink sink, uint64_t timeNs, int doorway,
+                   const char* format, long a0, long a1, long a2, long a3);
+
+//Macro to queue a message for the given sink, stamped with the monotonic time it was captured at
+//It never blocks (except in LOG_LOSSLESS mode): if the queue is full the message is dropped and counted
+#define LOG_MSG(log, sink, timeNs, str) \
+	laserLogPost(log, sink, timeNs, -1, str, 0, 0, 0, 0)
+
+//Macro to queue a message about one doorway, the writer prefixes it with the doorway number
+#define LOG_DOORWAY_MSG(log, sink, timeNs, doorway, str) \
+	laserLogPost(log, sink, timeNs, doorway, str, 0, 0, 0, 0)
+
+#endif /* LASER_LOG_H */
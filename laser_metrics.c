@@ -0,0 +1,348 @@
+#include "laser_metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "laser_time.h"
+
+//How long the server waits for a client's request, and between checks that it should keep running
+#define METRICS_REQUEST_MS 100
+#define METRICS_POLL_MS    500
+
+//Label of each transition message, and of the crossings counted by the crossing tracker
+//MSG_NONE is never counted: a transition without a message has nothing to do
+static const char* const messageLabels[METRICS_TRANSITIONS] =
+{
+	[MSG_NONE]                = "none",
+	[MSG_STARTED]             = "started",
+	[MSG_MUST_START_UNBROKEN] = "must_start_unbroken",
+	[MSG_LASER1_BROKEN]       = "laser1_broken",
+	[MSG_LASER2_BROKEN]       = "laser2_broken",
+	[MSG_BOTH_UNBROKEN]       = "both_unbroken",
+	[MSG_BOTH_BROKEN]         = "both_broken",
+	[MSG_LASER2_UNBROKEN]     = "laser2_unbroken",
+	[MSG_LASER1_UNBROKEN]     = "laser1_unbroken",
+	[METRICS_TRACKED]         = "tracker",
+};
+
+//Appends text to the page, keeping track of the room left
+#define PAGE_PRINTF(...) \
+	do{ \
+		int _n = snprintf(page + length, (length < size) ? size - length : 0, __VA_ARGS__); \
+		length += (_n > 0) ? (size_t)_n : 0; \
+	}while(0)
+
+//Appends one metric with its help and type lines
+#define PAGE_METRIC(name, type, help, format, value) \
+	PAGE_PRINTF("# HELP " name " " help "\n# TYPE " name " " type "\n" name " " format "\n", value)
+
+#define LOAD(_metric) atomic_load_explicit(&(_metric), memory_order_relaxed)
+
+//This function writes every metric into page in the Prometheus text format
+//Returns the length of the page (truncated to size - 1 characters if it does not fit)
+int laserMetricsFormat(const LaserMetrics* metrics, char* page, size_t size)
+{
+	size_t length = 0;
+
+	PAGE_METRIC("laser_uptime_seconds", "gauge", "Time since the counter started.", "%.3f",
+	            (laserMonotonicNs() - metrics->startNs) / 1e9);
+
+	const LaserLoopMetrics* loop = metrics->loop;
+	if(loop != NULL)
+	{
+		PAGE_METRIC("laser_loop_iterations_total", "counter", "Iterations of the sensing loop.", "%lu", LOAD(loop->iterations));
+		PAGE_METRIC("laser_gplev_reads_total", "counter", "Reads of the GPIO level register.", "%lu", LOAD(loop->levelReads));
+
+		PAGE_PRINTF("# HELP laser_transitions_total State machine transitions taken, by the message they log.\n"
+		            "# TYPE laser_transitions_total counter\n");
+		for(int i = MSG_NONE + 1; i < METRICS_TRANSITIONS; i++)
+		{
+			PAGE_PRINTF("laser_transitions_total{message=\"%s\"} %lu\n", messageLabels[i], LOAD(loop->transitions[i]));
+		}
+
+		PAGE_METRIC("laser_log_posts_total", "counter", "Messages queued for the log writer by the sensing loop.", "%lu",
+		            LOAD(loop->logPosts));
+		PAGE_METRIC("laser_log_post_seconds_total", "counter", "Time the sensing loop spent queueing log messages.", "%.9f",
+		            LOAD(loop->logPostNs) / 1e9);
+		PAGE_METRIC("laser_stats_updates_total", "counter", "Updates of the mapped stats file.", "%lu",
+		            LOAD(loop->statsUpdates));
+		PAGE_METRIC("laser_stats_update_seconds_total", "counter", "Time the sensing loop spent updating the stats file.", "%.9f",
+		            LOAD(loop->statsUpdateNs) / 1e9);
+		PAGE_METRIC("laser_edge_waits_total", "counter", "Waits for GPIO edge events.", "%lu", LOAD(loop->waits));
+		PAGE_METRIC("laser_edge_wait_seconds_total", "counter", "Time the sensing loop spent waiting for edge events.", "%.9f",
+		            LOAD(loop->waitNs) / 1e9);
+		PAGE_METRIC("laser_poll_sleeps_total", "counter", "Sleeps of the polling loop while no crossing is in progress.", "%lu",
+		            LOAD(loop->pollSleeps));
+		PAGE_METRIC("laser_poll_sleep_seconds_total", "counter", "Time the polling loop spent sleeping.", "%.9f",
+		            LOAD(loop->pollSleepNs) / 1e9);
+		PAGE_METRIC("laser_loop_max_busy_seconds", "gauge", "Longest time between two samples, not counting the waits.", "%.9f",
+		            LOAD(loop->maxBusyNs) / 1e9);
+
+		//The histogram buckets are cumulative in the exposition format
+		PAGE_PRINTF("# HELP laser_edge_latency_seconds Time from a GPIO edge (when polling, from the previous sample) to the end of the processing of its sample.\n"
+		            "# TYPE laser_edge_latency_seconds histogram\n");
+		unsigned long cumulative = 0;
+		for(int i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+		{
+			cumulative += LOAD(loop->latency[i]);
+			if(i < METRICS_LATENCY_BUCKETS - 1)
+			{
+				PAGE_PRINTF("laser_edge_latency_seconds_bucket{le=\"%g\"} %lu\n", laserLatencyBounds[i] / 1e9, cumulative);
+			}
+			else
+			{
+				PAGE_PRINTF("laser_edge_latency_seconds_bucket{le=\"+Inf\"} %lu\n", cumulative);
+			}
+		}
+		PAGE_PRINTF("laser_edge_latency_seconds_sum %.9f\n", LOAD(loop->latencySumNs) / 1e9);
+		PAGE_PRINTF("laser_edge_latency_seconds_count %lu\n", LOAD(loop->decisions));
+
+		PAGE_METRIC("laser_edge_latency_max_seconds", "gauge", "Longest time from a GPIO edge to the end of its processing.",
+		            "%.9f", LOAD(loop->latencyMaxNs) / 1e9);
+		PAGE_METRIC("laser_latency_budget_misses_total", "counter", "Edges processed later than the latency budget.", "%lu",
+		            LOAD(loop->budgetMisses));
+	}
+
+	const LaserAnalytics* analytics = metrics->analytics;
+	if(analytics != NULL)
+	{
+		static const char* const directionLabels[CROSSING_DIRECTIONS] = {"in", "out", "abandoned"};
+		PAGE_PRINTF("# HELP laser_crossings_total Crossings of a doorway, by direction.\n"
+		            "# TYPE laser_crossings_total counter\n");
+		for(int i = 0; i < analytics->numDoorways; i++)
+		{
+			for(int j = 0; j < CROSSING_DIRECTIONS; j++)
+			{
+				PAGE_PRINTF("laser_crossings_total{doorway=\"%d\",direction=\"%s\"} %lu\n", i + 1, directionLabels[j],
+				            LOAD(analytics->doorways[i].crossings[j]));
+			}
+		}
+
+		PAGE_PRINTF("# HELP laser_crossing_speed_meters_per_second Speed of the counted crossings.\n"
+		            "# TYPE laser_crossing_speed_meters_per_second histogram\n");
+		for(int i = 0; i < analytics->numDoorways; i++)
+		{
+			const LaserDoorwayAnalytics* timing = &analytics->doorways[i];
+			unsigned long cumulative = 0;
+			for(int j = 0; j < ANALYTICS_SPEED_BUCKETS; j++)
+			{
+				cumulative += LOAD(timing->speed[j]);
+				if(j < ANALYTICS_SPEED_BUCKETS - 1)
+				{
+					PAGE_PRINTF("laser_crossing_speed_meters_per_second_bucket{doorway=\"%d\",le=\"%g\"} %lu\n", i + 1,
+					            laserSpeedBounds[j] / 1e3, cumulative);
+				}
+				else
+				{
+					PAGE_PRINTF("laser_crossing_speed_meters_per_second_bucket{doorway=\"%d\",le=\"+Inf\"} %lu\n", i + 1,
+					            cumulative);
+				}
+			}
+			PAGE_PRINTF("laser_crossing_speed_meters_per_second_sum{doorway=\"%d\"} %.3f\n", i + 1,
+			            LOAD(timing->speedSumMmS) / 1e3);
+			PAGE_PRINTF("laser_crossing_speed_meters_per_second_count{doorway=\"%d\"} %lu\n", i + 1, cumulative);
+		}
+
+		PAGE_PRINTF("# HELP laser_crossing_dwell_seconds Time at least one beam was broken during a crossing.\n"
+		            "# TYPE laser_crossing_dwell_seconds histogram\n");
+		for(int i = 0; i < analytics->numDoorways; i++)
+		{
+			const LaserDoorwayAnalytics* timing = &analytics->doorways[i];
+			unsigned long cumulative = 0;
+			for(int j = 0; j < ANALYTICS_DWELL_BUCKETS; j++)
+			{
+				cumulative += LOAD(timing->dwell[j]);
+				if(j < ANALYTICS_DWELL_BUCKETS - 1)
+				{
+					PAGE_PRINTF("laser_crossing_dwell_seconds_bucket{doorway=\"%d\",le=\"%g\"} %lu\n", i + 1,
+					            laserDwellBounds[j] / 1e6, cumulative);
+				}
+				else
+				{
+					PAGE_PRINTF("laser_crossing_dwell_seconds_bucket{doorway=\"%d\",le=\"+Inf\"} %lu\n", i + 1, cumulative);
+				}
+			}
+			PAGE_PRINTF("laser_crossing_dwell_seconds_sum{doorway=\"%d\"} %.6f\n", i + 1, LOAD(timing->dwellSumUs) / 1e6);
+			PAGE_PRINTF("laser_crossing_dwell_seconds_count{doorway=\"%d\"} %lu\n", i + 1, cumulative);
+		}
+
+		static const char* const phaseLabels[3] = {"lead", "overlap", "trail"};
+		PAGE_PRINTF("# HELP laser_crossing_phase_seconds_total Time the counted crossings spent in each phase.\n"
+		            "# TYPE laser_crossing_phase_seconds_total counter\n");
+		for(int i = 0; i < analytics->numDoorways; i++)
+		{
+			const LaserDoorwayAnalytics* timing = &analytics->doorways[i];
+			unsigned long phases[3] = {LOAD(timing->leadSumUs), LOAD(timing->overlapSumUs), LOAD(timing->trailSumUs)};
+			for(int j = 0; j < 3; j++)
+			{
+				PAGE_PRINTF("laser_crossing_phase_seconds_total{doorway=\"%d\",phase=\"%s\"} %.6f\n", i + 1, phaseLabels[j],
+				            phases[j] / 1e6);
+			}
+		}
+
+		PAGE_PRINTF("# HELP laser_occupancy_ratio Moving average of the fraction of each minute a beam was broken.\n"
+		            "# TYPE laser_occupancy_ratio gauge\n");
+		for(int i = 0; i < analytics->numDoorways; i++)
+		{
+			PAGE_PRINTF("laser_occupancy_ratio{doorway=\"%d\"} %.6f\n", i + 1, LOAD(analytics->doorways[i].occupancyPpm) / 1e6);
+		}
+		PAGE_PRINTF("# HELP laser_crossings_per_minute Moving average of the crossings per minute.\n"
+		            "# TYPE laser_crossings_per_minute gauge\n");
+		for(int i = 0; i < analytics->numDoorways; i++)
+		{
+			PAGE_PRINTF("laser_crossings_per_minute{doorway=\"%d\"} %.3f\n", i + 1, LOAD(analytics->doorways[i].ratePerMinute) / 1e3);
+		}
+	}
+
+	if(metrics->numTrackers > 0)
+	{
+		PAGE_PRINTF("# HELP laser_tracker_tailgates_total Crossings completed while another one was in flight.\n"
+		            "# TYPE laser_tracker_tailgates_total counter\n");
+		for(int i = 0; i < metrics->numTrackers; i++)
+		{
+			PAGE_PRINTF("laser_tracker_tailgates_total{doorway=\"%d\"} %lu\n", i + 1, LOAD(metrics->trackers[i]->tailgates));
+		}
+		PAGE_PRINTF("# HELP laser_tracker_overflows_total Crossings pushed out uncounted by a full tracker queue.\n"
+		            "# TYPE laser_tracker_overflows_total counter\n");
+		for(int i = 0; i < metrics->numTrackers; i++)
+		{
+			PAGE_PRINTF("laser_tracker_overflows_total{doorway=\"%d\"} %lu\n", i + 1, LOAD(metrics->trackers[i]->overflows));
+		}
+	}
+
+	if(metrics->filter != NULL)
+	{
+		PAGE_METRIC("laser_filter_glitches_total", "counter", "Beam changes dropped by the debounce filter.", "%lu",
+		            LOAD(metrics->filter->glitches));
+	}
+
+	if(metrics->log != NULL)
+	{
+		PAGE_METRIC("laser_log_dropped_total", "counter", "Log messages dropped because the queue was full.", "%lu",
+		            LOAD(metrics->log->dropped));
+	}
+
+	const LaserWatchdog* watchdog = metrics->watchdog;
+	if(watchdog != NULL)
+	{
+		unsigned long kicks = LOAD(watchdog->kicks);
+		PAGE_METRIC("laser_watchdog_kicks_total", "counter", "Watchdog kicks.", "%lu", kicks);
+		PAGE_METRIC("laser_watchdog_refused_total", "counter", "Kicks refused because the sensing loop had stalled.", "%lu",
+		            LOAD(watchdog->refused));
+		PAGE_METRIC("laser_watchdog_jitter_seconds_total", "counter", "Total lateness of the kicks against their schedule.",
+		            "%.9f", LOAD(watchdog->jitterSumNs) / 1e9);
+		PAGE_METRIC("laser_watchdog_jitter_max_seconds", "gauge", "Largest lateness of a kick.", "%.9f",
+		            LOAD(watchdog->jitterMaxNs) / 1e9);
+	}
+
+	if(length >= size && size > 0)
+	{
+		length = size - 1;
+	}
+	return (int)length;
+}
+
+//This function answers one client with the metrics page
+static void serveClient(LaserMetrics* metrics, int client)
+{
+	//Read (and ignore) the request, if the client sends one
+	struct pollfd request = {client, POLLIN, 0};
+	if(poll(&request, 1, METRICS_REQUEST_MS) > 0)
+	{
+		char discard[1024];
+		ssize_t ignored = read(client, discard, sizeof(discard));
+		(void)ignored;
+	}
+
+	static char page[METRICS_PAGE_SIZE];
+	int length = laserMetricsFormat(metrics, page, sizeof(page));
+
+	char head[128];
+	int headLength = snprintf(head, sizeof(head),
+	                          "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\n\r\n",
+	                          length);
+
+	if(send(client, head, headLength, MSG_NOSIGNAL) == headLength)
+	{
+		send(client, page, length, MSG_NOSIGNAL);
+	}
+}
+
+//Metrics thread: accepts the clients one at a time, away from the sensing loop
+static void* metricsThread(void* arg)
+{
+	LaserMetrics* metrics = arg;
+
+	while(atomic_load(&metrics->running))
+	{
+		struct pollfd listener = {metrics->fd, POLLIN, 0};
+		if(poll(&listener, 1, METRICS_POLL_MS) <= 0)
+		{
+			continue;
+		}
+
+		int client = accept(metrics->fd, NULL, NULL);
+		if(client < 0)
+		{
+			continue;
+		}
+		serveClient(metrics, client);
+		close(client);
+	}
+	return NULL;
+}
+
+//This function starts serving the metrics on the Unix socket at path
+//The sources (loop, log, watchdog, filter) must be set before, any of them may be NULL
+//Returns 0 on success or -1 if the socket or the thread cannot be created
+int laserMetricsStart(LaserMetrics* metrics, const char* path)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(address.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(address.sun_path, path);
+	strcpy(metrics->path, path);
+
+	metrics->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(metrics->fd < 0)
+	{
+		return -1;
+	}
+
+	//Replace the socket left by a previous run
+	unlink(path);
+	if(bind(metrics->fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(metrics->fd, 4) < 0)
+	{
+		close(metrics->fd);
+		return -1;
+	}
+
+	metrics->startNs = laserMonotonicNs();
+	atomic_init(&metrics->running, 1);
+	if(pthread_create(&metrics->thread, NULL, metricsThread, metrics) != 0)
+	{
+		close(metrics->fd);
+		unlink(path);
+		return -1;
+	}
+	return 0;
+}
+
+//This function stops the metrics thread and removes the socket
+void laserMetricsStop(LaserMetrics* metrics)
+{
+	atomic_store(&metrics->running, 0);
+	pthread_join(metrics->thread, NULL);
+	close(metrics->fd);
+	unlink(metrics->path);
+}
@@ -0,0 +1,123 @@
+
+#ifndef LASER_METRICS_H
+#define LASER_METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "laser_fsm.h"
+#include "laser_filter.h"
+#include "laser_log.h"
+#include "laser_watchdog.h"
+#include "laser_analytics.h"
+#include "laser_tracker.h"
+
+//Unix socket the metrics are served on when the config file does not name one
+#define METRICS_SOCKET_PATH "/tmp/laser_counter.sock"
+
+//Largest metrics page served
+#define METRICS_PAGE_SIZE 32768
+
+//A counter written by a single thread and read by the metrics thread
+typedef atomic_ulong LaserMetric;
+
+//This function adds n to a metric only its owning thread writes
+//A relaxed load and store is enough, so no locked instruction is needed in the sensing loop
+static inline void laserMetricAdd(LaserMetric* metric, unsigned long n)
+{
+	atomic_store_explicit(metric, atomic_load_explicit(metric, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+//This function raises a metric only its owning thread writes to value, if value is larger
+static inline void laserMetricMax(LaserMetric* metric, unsigned long value)
+{
+	if(value > atomic_load_explicit(metric, memory_order_relaxed))
+	{
+		atomic_store_explicit(metric, value, memory_order_relaxed);
+	}
+}
+
+//Upper bounds of the edge-to-decision latency histogram, in nanoseconds (the last bucket is unbounded)
+#define METRICS_LATENCY_BUCKETS 9
+static const uint64_t laserLatencyBounds[METRICS_LATENCY_BUCKETS - 1] =
+{
+	10000, 50000, 100000, 500000, 1000000, 5000000, 10000000, 50000000
+};
+
+//Slot of LaserLoopMetrics.transitions that counts the crossings counted by the crossing tracker,
+//after the one slot per LaserMessage
+#define METRICS_TRACKED     LASER_MESSAGES
+#define METRICS_TRANSITIONS (LASER_MESSAGES + 1)
+
+//Counters of the sensing loop, only written by the sensing thread
+typedef struct
+{
+	LaserMetric iterations; 					//loop iterations
+	LaserMetric levelReads; 					//reads of the GPLEV register
+	LaserMetric transitions[METRICS_TRANSITIONS]; 	//transitions taken, by the message they log
+	LaserMetric logPosts; 						//messages queued for the log writer
+	LaserMetric logPostNs; 						//time spent queueing them
+	LaserMetric statsUpdates; 					//updates of the mapped stats file
+	LaserMetric statsUpdateNs; 					//time spent updating it
+	LaserMetric waits; 							//waits for edge events
+	LaserMetric waitNs; 						//time spent waiting for edge events
+	LaserMetric maxBusyNs; 						//longest time between two samples, not counting the waits
+	LaserMetric decisions; 						//samples processed after a GPIO edge
+	LaserMetric latencySumNs; 					//total time from those edges to the end of their processing
+	LaserMetric latencyMaxNs; 					//longest of those times
+	LaserMetric latency[METRICS_LATENCY_BUCKETS]; 	//histogram of those times (not cumulative)
+	LaserMetric budgetMisses; 					//those times that exceeded the latency budget
+	LaserMetric pollSleeps; 					//sleeps of the polling loop while idle (without edge events)
+	LaserMetric pollSleepNs; 					//time spent in them
+} LaserLoopMetrics;
+
+//This function records the time from a GPIO edge to the end of the processing of the sample that saw it
+//Returns 1 if it exceeds budgetNs (0 for no budget), 0 otherwise
+static inline int laserMetricsLatency(LaserLoopMetrics* loop, uint64_t latencyNs, uint64_t budgetNs)
+{
+	int bucket = 0;
+	while(bucket < METRICS_LATENCY_BUCKETS - 1 && latencyNs > laserLatencyBounds[bucket])
+	{
+		bucket++;
+	}
+
+	laserMetricAdd(&loop->decisions, 1);
+	laserMetricAdd(&loop->latencySumNs, latencyNs);
+	laserMetricMax(&loop->latencyMaxNs, latencyNs);
+	laserMetricAdd(&loop->latency[bucket], 1);
+
+	if(budgetNs != 0 && latencyNs > budgetNs)
+	{
+		laserMetricAdd(&loop->budgetMisses, 1);
+		return 1;
+	}
+	return 0;
+}
+
+//The metrics server: a thread answering every connection to a Unix socket with the metrics in the
+//Prometheus text format (as an HTTP response, e.g. curl --unix-socket <path> http://localhost/metrics)
+//Each source is optional
+typedef struct
+{
+	const LaserLoopMetrics* loop;
+	const LaserLog* log;
+	const LaserWatchdog* watchdog;
+	const LaserFilter* filter;
+	const LaserAnalytics* analytics;
+	const LaserTracker* trackers[LASER_MAX_DOORWAYS]; 	//the crossing tracker of each doorway, when tracking
+	int numTrackers;
+	uint64_t startNs;
+
+	char path[108];
+	int fd;
+	atomic_int running;
+	pthread_t thread;
+} LaserMetrics;
+
+int  laserMetricsStart (LaserMetrics* metrics, const char* path);
+void laserMetricsStop  (LaserMetrics* metrics);
+int  laserMetricsFormat(const LaserMetrics* metrics, char* page, size_t size);
+
+#endif /* LASER_METRICS_H */
@@ -0,0 +1,30 @@
+#include "laser_poll.h"
+
+#include <time.h>
+#include <sys/prctl.h>
+
+//This function sets up adaptive polling so that a beam change is seen within maxLatencyUs while idle
+//(0 spins all the time, as the loop used to)
+//The kernel may end a sleep late by the timer slack of the thread, so a tenth of the bound is set aside for it
+//A bound shorter than POLL_MIN_SLEEP_NS is kept: every sleep, the first one included, is cut down to it
+void laserPollInit(LaserPoll* poll, uint32_t maxLatencyUs)
+{
+	uint64_t boundNs = (uint64_t)maxLatencyUs * 1000;
+	poll->slackNs = boundNs / 10;
+	poll->maxSleepNs = boundNs - poll->slackNs;
+	poll->sleepNs = 0;
+
+	//The default slack of 50 us would be most of a short bound
+	if(poll->slackNs != 0)
+	{
+		prctl(PR_SET_TIMERSLACK, (unsigned long)poll->slackNs, 0, 0, 0);
+	}
+}
+
+//This function sleeps until the monotonic time untilNs
+//An absolute deadline keeps the interval exact however long the loop took, and a signal (e.g. SIGHUP) ends the sleep
+void laserPollSleep(uint64_t untilNs)
+{
+	struct timespec deadline = {(time_t)(untilNs / 1000000000), (long)(untilNs % 1000000000)};
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+}
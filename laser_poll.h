@@ -0,0 +1,46 @@
+
+#ifndef LASER_POLL_H
+#define LASER_POLL_H
+
+#include <stdint.h>
+
+//Default worst-case time between a beam changing and the polling loop seeing it while idle
+#define POLL_MAX_LATENCY_US 2000
+
+//First sleep after the loop goes idle: the sleeps start short, so that an object following closely behind the
+//previous one is still seen quickly
+#define POLL_MIN_SLEEP_NS 50000
+
+//Adaptive polling, used when GPIO edge events are not available
+//The loop spins while a crossing is in progress and, once every doorway is idle, sleeps for doubling intervals up to
+//the longest one that keeps the detection latency within its bound
+typedef struct
+{
+	uint64_t maxSleepNs; 		//longest sleep, 0 to spin all the time
+	uint64_t sleepNs; 			//current sleep, 0 while spinning
+	uint64_t slackNs; 			//timer slack asked of the kernel for the sleeps
+} LaserPoll;
+
+void laserPollInit (LaserPoll* poll, uint32_t maxLatencyUs);
+void laserPollSleep(uint64_t untilNs);
+
+//This function returns how long the polling loop should sleep before its next sample, 0 to sample again at once
+//busy is set when a crossing is in progress or a beam change is waiting in the debounce filter
+static inline uint64_t laserPollNext(LaserPoll* poll, int busy)
+{
+	if(busy || poll->maxSleepNs == 0)
+	{
+		poll->sleepNs = 0;
+		return 0;
+	}
+
+	//Back off: double the sleep every idle sample, up to the bound (which may be below the first sleep)
+	poll->sleepNs = (poll->sleepNs == 0) ? POLL_MIN_SLEEP_NS : poll->sleepNs * 2;
+	if(poll->sleepNs > poll->maxSleepNs)
+	{
+		poll->sleepNs = poll->maxSleepNs;
+	}
+	return poll->sleepNs;
+}
+
+#endif /* LASER_POLL_H */
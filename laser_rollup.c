@@ -0,0 +1,244 @@
+#include "laser_rollup.h"
+
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//Width of a bucket at each resolution, in seconds
+const int64_t laserRollupWidths[ROLLUP_RESOLUTIONS] = {60, 3600, 86400};
+
+static const uint32_t rollupCapacities[ROLLUP_RESOLUTIONS] = {ROLLUP_MINUTES, ROLLUP_HOURS, ROLLUP_DAYS};
+
+//This function returns the length of a rollup file
+static size_t rollupLength(void)
+{
+	return sizeof(RollupHeader) + (size_t)(ROLLUP_MINUTES + ROLLUP_HOURS + ROLLUP_DAYS) * sizeof(RollupBucket);
+}
+
+//This function points the rings into the mapping
+static void mapRings(LaserRollup* rollup, void* map, size_t length)
+{
+	rollup->header = map;
+	rollup->length = length;
+	rollup->rings[ROLLUP_MINUTE] = (RollupBucket*)(rollup->header + 1);
+	rollup->rings[ROLLUP_HOUR] = rollup->rings[ROLLUP_MINUTE] + ROLLUP_MINUTES;
+	rollup->rings[ROLLUP_DAY] = rollup->rings[ROLLUP_HOUR] + ROLLUP_HOURS;
+	rollup->offsetS = 0;
+	rollup->offsetUntilS = INT64_MIN;
+}
+
+//This function opens the rollup file and maps it, creating it if needed
+//The file has a constant size and keeps the buckets of the previous runs; a file of another layout starts empty
+//occupancy is the current occupancy of the counter (e.g. restored from the stats checkpoint)
+//Returns 0 on success or -1 if the file cannot be created or mapped
+int laserRollupOpen(LaserRollup* rollup, const char* path, int occupancy)
+{
+	size_t length = rollupLength();
+
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd < 0)
+	{
+		return -1;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) < 0 || ((size_t)st.st_size != length && ftruncate(fd, length) < 0))
+	{
+		close(fd);
+		return -1;
+	}
+
+	void* map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		return -1;
+	}
+	mapRings(rollup, map, length);
+
+	RollupHeader* header = rollup->header;
+	if((size_t)st.st_size != length || header->magic != ROLLUP_MAGIC || header->version != ROLLUP_VERSION)
+	{
+		memset(map, 0, length);
+		header->version = ROLLUP_VERSION;
+		for(int i = 0; i < ROLLUP_RESOLUTIONS; i++)
+		{
+			header->latestKey[i] = -1;
+			header->capacity[i] = rollupCapacities[i];
+		}
+	}
+	atomic_init(&header->sequence, 0);
+	header->occupancy = occupancy;
+
+	//The magic number is written last so that a reader never trusts a half initialized file
+	atomic_thread_fence(memory_order_release);
+	header->magic = ROLLUP_MAGIC;
+	return 0;
+}
+
+//This function maps an existing rollup file read-only (used by the query tool)
+//Returns 0 on success or -1 if the file is missing or is not a rollup file
+int laserRollupMap(LaserRollup* rollup, const char* path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		return -1;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size != rollupLength())
+	{
+		close(fd);
+		return -1;
+	}
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		return -1;
+	}
+	mapRings(rollup, map, st.st_size);
+
+	if(rollup->header->magic != ROLLUP_MAGIC || rollup->header->version != ROLLUP_VERSION)
+	{
+		laserRollupClose(rollup);
+		return -1;
+	}
+	return 0;
+}
+
+//This function writes the mapped pages back and unmaps the rollup file
+void laserRollupClose(LaserRollup* rollup)
+{
+	if(rollup->header != NULL)
+	{
+		msync(rollup->header, rollup->length, MS_ASYNC);
+		munmap(rollup->header, rollup->length);
+		rollup->header = NULL;
+	}
+}
+
+//This function converts wall clock nanoseconds to local seconds (seconds since the epoch plus the UTC offset)
+//The offset is looked up with localtime_r at most once per hour, when daylight saving time may change
+int64_t laserRollupLocalSeconds(LaserRollup* rollup, int64_t wallNs)
+{
+	int64_t seconds = wallNs / 1000000000;
+	if(seconds >= rollup->offsetUntilS || seconds < rollup->offsetUntilS - 3600)
+	{
+		time_t now = (time_t)seconds;
+		struct tm local;
+		localtime_r(&now, &local);
+		rollup->offsetS = local.tm_gmtoff;
+		rollup->offsetUntilS = seconds - seconds % 3600 + 3600;
+	}
+	return seconds + rollup->offsetS;
+}
+
+//This function adds the counting actions of one transition to the minute, hour and day buckets of its time
+//It takes constant time: a bucket whose slot still holds an older period is cleared before it is counted into
+void laserRollupAdd(LaserRollup* rollup, unsigned actions, int64_t wallNs)
+{
+	if(!(actions & (ACT_COUNT_IN | ACT_COUNT_OUT | ACT_BREAK1 | ACT_BREAK2)))
+	{
+		return;
+	}
+
+	RollupHeader* header = rollup->header;
+	int64_t localS = laserRollupLocalSeconds(rollup, wallNs);
+	unsigned sequence = atomic_load_explicit(&header->sequence, memory_order_relaxed);
+
+	//Mark the rollup as being updated
+	atomic_store_explicit(&header->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	//A new bucket starts at the occupancy carried into it, so an exit as its first event does not hide that level
+	int32_t before = header->occupancy;
+	header->occupancy += ((actions & ACT_COUNT_IN) != 0) - ((actions & ACT_COUNT_OUT) != 0);
+
+	for(int i = 0; i < ROLLUP_RESOLUTIONS; i++)
+	{
+		int64_t key = localS / laserRollupWidths[i];
+		RollupBucket* bucket = &rollup->rings[i][key % header->capacity[i]];
+		if(bucket->key != key)
+		{
+			memset(bucket, 0, sizeof(*bucket));
+			bucket->key = key;
+			bucket->peakOccupancy = before;
+		}
+
+		bucket->numberIn += (actions & ACT_COUNT_IN) != 0;
+		bucket->numberOut += (actions & ACT_COUNT_OUT) != 0;
+		bucket->laser1Count += (actions & ACT_BREAK1) != 0;
+		bucket->laser2Count += (actions & ACT_BREAK2) != 0;
+		if(header->occupancy > bucket->peakOccupancy)
+		{
+			bucket->peakOccupancy = header->occupancy;
+		}
+
+		if(key > header->latestKey[i])
+		{
+			header->latestKey[i] = key;
+		}
+	}
+
+	//Mark the update as complete
+	atomic_store_explicit(&header->sequence, sequence + 2, memory_order_release);
+}
+
+//This function copies the bucket with key 'key' at a resolution, consistently with the writer
+//Returns 1 if the bucket holds counts, 0 if nothing was counted in that period,
+//or -1 if the period is older than the ring keeps, newer than the latest event or before 1970 (a negative key)
+//Returns -2 (errno EAGAIN) if the rollup is still being updated after ROLLUP_READ_RETRIES copies, as when the
+//counter died in the middle of an update
+int laserRollupRead(const LaserRollup* rollup, RollupResolution resolution, int64_t key, RollupBucket* bucket)
+{
+	const RollupHeader* header = rollup->header;
+	unsigned before;
+	unsigned after;
+	int found;
+
+	for(int retries = 0; ; retries++)
+	{
+		before = atomic_load_explicit(&header->sequence, memory_order_acquire);
+
+		int64_t latest = header->latestKey[resolution];
+		uint32_t capacity = header->capacity[resolution];
+
+		//The range is checked before the ring is indexed: a key before 1970 or outside the ring has no slot
+		if(key < 0 || capacity == 0 || latest < 0 || key > latest || key <= latest - capacity)
+		{
+			found = -1;
+		}
+		else
+		{
+			*bucket = rollup->rings[resolution][key % capacity];
+			found = (bucket->key == key);
+		}
+
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&header->sequence, memory_order_relaxed);
+		if(!(before & 1) && before == after)
+		{
+			break;
+		}
+		if(retries == ROLLUP_READ_RETRIES)
+		{
+			errno = EAGAIN;
+			return -2;
+		}
+		sched_yield();
+	}
+
+	if(found != 1)
+	{
+		memset(bucket, 0, sizeof(*bucket));
+		bucket->key = key;
+	}
+	return found;
+}
@@ -0,0 +1,73 @@
+
+#ifndef LASER_ROLLUP_H
+#define LASER_ROLLUP_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "laser_fsm.h"
+
+#define ROLLUP_MAGIC   0x3152414C 	//"LAR1"
+#define ROLLUP_VERSION 1
+
+//Resolutions of the rollup, finest first
+typedef enum{ROLLUP_MINUTE, ROLLUP_HOUR, ROLLUP_DAY, ROLLUP_RESOLUTIONS}RollupResolution;
+
+//Buckets kept at each resolution: a week of minutes, 90 days of hours and 10 years of days (about 500 KiB)
+#define ROLLUP_MINUTES (7 * 24 * 60)
+#define ROLLUP_HOURS   (90 * 24)
+#define ROLLUP_DAYS    (10 * 366)
+
+//Number of copies laserRollupRead makes before it gives up on a consistent bucket
+#define ROLLUP_READ_RETRIES 10000
+
+//Counts of every doorway over one minute, hour or day
+//A bucket is keyed by its start in local time (seconds since the epoch plus the UTC offset), so that days start at
+//local midnight; a slot of the ring whose key is not the expected one holds no counts for that period
+typedef struct
+{
+	int64_t key; 				//local time the bucket starts at, divided by the bucket width
+	int32_t numberIn;
+	int32_t numberOut;
+	int32_t laser1Count;
+	int32_t laser2Count;
+	int32_t peakOccupancy; 		//highest occupancy (entries minus exits over every doorway) during the bucket
+	int32_t reserved;
+} RollupBucket;
+
+//Fixed-size header at the start of the rollup file, followed by the three rings of buckets
+//Like the stats header, the sequence number is odd while an update is in progress
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	atomic_uint sequence;
+	int32_t occupancy; 							//occupancy after the latest event
+	int64_t latestKey[ROLLUP_RESOLUTIONS]; 		//key of the newest bucket at each resolution, -1 if none yet
+	uint32_t capacity[ROLLUP_RESOLUTIONS];
+	uint32_t reserved;
+} RollupHeader;
+
+typedef struct
+{
+	RollupHeader* header;
+	RollupBucket* rings[ROLLUP_RESOLUTIONS];
+	size_t length;
+
+	//UTC offset of the local time, valid until the next hour starts (only the writer uses them)
+	int64_t offsetS;
+	int64_t offsetUntilS;
+} LaserRollup;
+
+extern const int64_t laserRollupWidths[ROLLUP_RESOLUTIONS];
+
+int  laserRollupOpen (LaserRollup* rollup, const char* path, int occupancy);
+int  laserRollupMap  (LaserRollup* rollup, const char* path);
+void laserRollupClose(LaserRollup* rollup);
+
+int64_t laserRollupLocalSeconds(LaserRollup* rollup, int64_t wallNs);
+void    laserRollupAdd (LaserRollup* rollup, unsigned actions, int64_t wallNs);
+int     laserRollupRead(const LaserRollup* rollup, RollupResolution resolution, int64_t key, RollupBucket* bucket);
+
+#endif /* LASER_ROLLUP_H */
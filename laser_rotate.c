@@ -0,0 +1,245 @@
+#define _GNU_SOURCE 		//for fallocate()
+#include "laser_rotate.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sched.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+//This function reserves the blocks of a whole segment without changing the file size
+//Appends then only fill blocks that are already allocated
+static void preallocate(FILE* file, uint64_t maxBytes)
+{
+	fallocate(fileno(file), FALLOC_FL_KEEP_SIZE, 0, (off_t)maxBytes);
+}
+
+//This function splits the log file path into its directory and its name
+static void splitPath(const char* path, char* directory, size_t size, const char** name)
+{
+	const char* slash = strrchr(path, '/');
+	if(slash == NULL)
+	{
+		snprintf(directory, size, ".");
+		*name = path;
+	}
+	else
+	{
+		snprintf(directory, size, "%.*s", (int)(slash - path) ? (int)(slash - path) : 1, path);
+		*name = slash + 1;
+	}
+}
+
+//This function returns 1 if the directory entry 'entry' is a closed segment of the log file 'name'
+static int isSegment(const char* entry, const char* name)
+{
+	size_t length = strlen(name);
+	return strncmp(entry, name, length) == 0 && entry[length] == '.' && entry[length + 1] >= '0' && entry[length + 1] <= '9';
+}
+
+//This function orders segment names by age: by their time, then by their number within the second,
+//whether they are compressed or not
+static int compareNames(const void* a, const void* b)
+{
+	char x[NAME_MAX + 1];
+	char y[NAME_MAX + 1];
+	snprintf(x, sizeof(x), "%s", *(char* const*)a);
+	snprintf(y, sizeof(y), "%s", *(char* const*)b);
+
+	char* gz = strstr(x, ".gz");
+	if(gz != NULL)
+	{
+		*gz = 0;
+	}
+	gz = strstr(y, ".gz");
+	if(gz != NULL)
+	{
+		*gz = 0;
+	}
+	return strverscmp(x, y);
+}
+
+//This function starts gzip on one closed segment, at idle priority so that it only uses spare CPU time
+static pid_t startGzip(const char* segment)
+{
+	posix_spawnattr_t attributes;
+	posix_spawnattr_init(&attributes);
+	struct sched_param param = {.sched_priority = 0};
+	posix_spawnattr_setschedpolicy(&attributes, SCHED_IDLE);
+	posix_spawnattr_setschedparam(&attributes, &param);
+	posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSCHEDULER);
+
+	pid_t pid;
+	char* const argv[] = {"gzip", "-f", "-q", (char*)segment, NULL};
+	int failed = posix_spawnp(&pid, "gzip", NULL, &attributes, argv, environ);
+	posix_spawnattr_destroy(&attributes);
+	return failed ? 0 : pid;
+}
+
+//This function compresses the oldest closed segment that is not compressed yet (one at a time),
+//and deletes the oldest segments beyond the limit
+static void tidySegments(LaserRotate* rotate)
+{
+	char directory[ROTATE_PATH_MAX];
+	const char* name;
+	splitPath(rotate->path, directory, sizeof(directory), &name);
+
+	DIR* dir = opendir(directory);
+	if(dir == NULL)
+	{
+		return;
+	}
+
+	//The segment names end with the time they were closed, so their order is their age
+	char** segments = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	struct dirent* entry;
+	while((entry = readdir(dir)) != NULL)
+	{
+		if(!isSegment(entry->d_name, name))
+		{
+			continue;
+		}
+		if(count == capacity)
+		{
+			capacity = capacity ? 2 * capacity : 16;
+			char** grown = realloc(segments, capacity * sizeof(char*));
+			if(grown == NULL)
+			{
+				break;
+			}
+			segments = grown;
+		}
+		segments[count] = strdup(entry->d_name);
+		count += (segments[count] != NULL);
+	}
+	closedir(dir);
+	qsort(segments, count, sizeof(char*), compareNames);
+
+	char segment[2 * ROTATE_PATH_MAX];
+	size_t pruned = (rotate->keep > 0 && count > (size_t)rotate->keep) ? count - rotate->keep : 0;
+	for(size_t i = 0; i < count; i++)
+	{
+		snprintf(segment, sizeof(segment), "%s/%s", directory, segments[i]);
+		size_t length = strlen(segments[i]);
+
+		if(i < pruned)
+		{
+			unlink(segment);
+		}
+		else if(rotate->compress && rotate->gzip == 0 && (length < 3 || strcmp(segments[i] + length - 3, ".gz") != 0))
+		{
+			rotate->gzip = startGzip(segment);
+		}
+		free(segments[i]);
+	}
+	free(segments);
+	rotate->scan = 0;
+}
+
+//This function sets up the rotation of the log file at 'path', already opened as 'file' for appending
+//The live segment is preallocated, and closed segments left by a previous run are compressed and pruned
+//Returns 0 on success or -1 if the path is too long
+int laserRotateStart(LaserRotate* rotate, FILE* file, const char* path, uint64_t maxBytes, int maxAgeS,
+                     int keep, int compress)
+{
+	if(strlen(path) >= sizeof(rotate->path))
+	{
+		return -1;
+	}
+	strcpy(rotate->path, path);
+	rotate->maxBytes = maxBytes;
+	rotate->maxAgeS = maxAgeS;
+	rotate->keep = keep;
+	rotate->compress = compress;
+	rotate->openedAt = time(NULL);
+	rotate->closedAt = 0;
+	rotate->number = 0;
+	rotate->gzip = 0;
+	rotate->scan = 1;
+	rotate->rotations = 0;
+
+	preallocate(file, maxBytes);
+	return 0;
+}
+
+//This function closes the live segment if it has reached its size or age limit, and opens the next one in its place
+//(the FILE keeps the same address, so every pointer to it stays valid)
+//It also reaps the compressor and starts it on the next closed segment
+//Called by the log writer thread after each batch, with the file flushed
+//Returns 1 if the segment was rotated, 0 if not, or -1 if the next segment could not be opened (the file is then closed)
+int laserRotateCheck(LaserRotate* rotate, FILE* file)
+{
+	//Reap the compressor, and look for more work once it is done
+	if(rotate->gzip != 0 && waitpid(rotate->gzip, NULL, WNOHANG) != 0)
+	{
+		rotate->gzip = 0;
+		rotate->scan = 1;
+	}
+
+	time_t now = time(NULL);
+	long size = ftell(file);
+	int rotated = 0;
+	if((size > 0 && (uint64_t)size >= rotate->maxBytes) ||
+	   (size > 0 && rotate->maxAgeS > 0 && now - rotate->openedAt >= rotate->maxAgeS))
+	{
+		//Name the closed segment after the time it was closed (and its number, if two close within a second)
+		char stamp[32];
+		struct tm local;
+		localtime_r(&now, &local);
+		strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+
+		//(the name must not be taken by a segment, compressed or not, even one already pruned in this second)
+		rotate->number = (now == rotate->closedAt) ? rotate->number + 1 : 0;
+		rotate->closedAt = now;
+
+		char segment[ROTATE_PATH_MAX + 48];
+		char compressed[ROTATE_PATH_MAX + 52];
+		struct stat st;
+		do
+		{
+			if(rotate->number == 0)
+			{
+				snprintf(segment, sizeof(segment), "%s.%s", rotate->path, stamp);
+			}
+			else
+			{
+				snprintf(segment, sizeof(segment), "%s.%s-%d", rotate->path, stamp, rotate->number);
+			}
+			snprintf(compressed, sizeof(compressed), "%s.gz", segment);
+		}
+		while((stat(segment, &st) == 0 || stat(compressed, &st) == 0) && ++rotate->number < 1000);
+
+		//Give back the blocks preallocated past the end of the closed segment, then open the next one
+		//If the segment cannot be renamed, it stays live and the next attempt waits for the age limit
+		if(ftruncate(fileno(file), size) < 0 || rename(rotate->path, segment) < 0)
+		{
+			rotate->openedAt = now;
+			return 0;
+		}
+		if(freopen(rotate->path, "a", file) == NULL)
+		{
+			return -1;
+		}
+
+		preallocate(file, rotate->maxBytes);
+		rotate->openedAt = now;
+		rotate->rotations++;
+		rotate->scan = 1;
+		rotated = 1;
+	}
+
+	if(rotate->scan && rotate->gzip == 0)
+	{
+		tidySegments(rotate);
+	}
+	return rotated;
+}
@@ -0,0 +1,43 @@
+
+#ifndef LASER_ROTATE_H
+#define LASER_ROTATE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+//Default limits of a log segment, and the number of closed segments kept
+#define ROTATE_SEGMENT_KB    4096
+#define ROTATE_SEGMENT_HOURS 24
+#define ROTATE_SEGMENTS      10
+
+//Longest log file path a rotator handles
+#define ROTATE_PATH_MAX 256
+
+//Segmented rotation of a log file, run by the log writer thread between two batches
+//The live segment keeps the log file's name; a closed segment is renamed <name>.<YYYYmmdd-HHMMSS> (the time it
+//was closed), compressed to <name>.<YYYYmmdd-HHMMSS>.gz by a gzip child at idle priority, and the oldest ones
+//beyond the limit are deleted
+//Each segment is preallocated to its size limit, so that appending never has to allocate filesystem blocks
+typedef struct
+{
+	char path[ROTATE_PATH_MAX];
+	uint64_t maxBytes; 		//size a segment is closed at
+	int maxAgeS; 			//age a segment is closed at, 0 for no age limit
+	int keep; 				//closed segments kept, 0 to keep all
+	int compress; 			//compress the closed segments
+
+	time_t openedAt; 		//when the live segment was opened
+	time_t closedAt; 		//when the last segment was closed
+	int number; 			//number of the last segment closed within that second
+	pid_t gzip; 			//compressor running, 0 if none
+	int scan; 				//the closed segments must be looked at again (for compression and pruning)
+	unsigned long rotations;
+} LaserRotate;
+
+int  laserRotateStart(LaserRotate* rotate, FILE* file, const char* path, uint64_t maxBytes, int maxAgeS,
+                      int keep, int compress);
+int  laserRotateCheck(LaserRotate* rotate, FILE* file);
+
+#endif /* LASER_ROTATE_H */
@@ -0,0 +1,78 @@
+#define _GNU_SOURCE 		//for pthread_setaffinity_np()
+#include "laser_rt.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+//This function writes to every page of a stack frame of RT_STACK_PREFAULT bytes
+static void __attribute__((noinline)) prefaultStack(void)
+{
+	volatile unsigned char stack[RT_STACK_PREFAULT];
+	for(int i = 0; i < RT_STACK_PREFAULT; i += 4096)
+	{
+		stack[i] = 0;
+	}
+	(void)stack[0];
+}
+
+//This function keeps the calling thread, and every thread it starts afterwards, off 'cpu'
+//Called before the log, stats, keepalive and metrics threads are started, it leaves that CPU to the sensing loop
+//Returns 0 on success or -1 if 'cpu' is the only CPU the thread may run on (the affinity is then left as it is)
+int laserRtReserve(int cpu)
+{
+	cpu_set_t set;
+	if(pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+	{
+		return -1;
+	}
+
+	CPU_CLR(cpu, &set);
+	if(CPU_COUNT(&set) == 0 || pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+//This function turns the calling thread (the sensing loop) into a real-time thread:
+//every page of the process is locked in memory (mapped files and the queues included), the stack is prefaulted,
+//the thread is pinned to 'cpu' (unless it is negative) and runs under SCHED_FIFO at 'priority'
+//It must be called after the other threads are started, so that they keep the normal policy
+//Returns 0 if every step succeeded, otherwise the RT_FAILED_* flags of the steps that failed
+int laserRtEnter(int priority, int cpu)
+{
+	int failed = 0;
+
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+	{
+		failed |= RT_FAILED_MLOCK;
+	}
+	prefaultStack();
+
+	if(cpu >= 0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		{
+			failed |= RT_FAILED_AFFINITY;
+		}
+	}
+
+	struct sched_param param = {.sched_priority = priority};
+	if(pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+	{
+		failed |= RT_FAILED_SCHED;
+	}
+	return failed;
+}
+
+//This function puts the calling thread back under the normal scheduling policy
+//(used when the sensing loop has to fall back to polling, which would starve the other threads under SCHED_FIFO)
+void laserRtLeave(void)
+{
+	struct sched_param param = {.sched_priority = 0};
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+}
@@ -0,0 +1,17 @@
+
+#ifndef LASER_RT_H
+#define LASER_RT_H
+
+//Stack touched up front, so that the sensing loop never faults in a stack page
+#define RT_STACK_PREFAULT (256 * 1024)
+
+//Steps of laserRtEnter that failed
+#define RT_FAILED_MLOCK    0x1
+#define RT_FAILED_AFFINITY 0x2
+#define RT_FAILED_SCHED    0x4
+
+int  laserRtReserve(int cpu);
+int  laserRtEnter(int priority, int cpu);
+void laserRtLeave(void);
+
+#endif /* LASER_RT_H */
@@ -0,0 +1,94 @@
+#include "laser_shm.h"
+
+//This function creates (or resets) the shared memory object and maps it for writing
+//Returns 0 on success or -1 if it cannot be created or mapped
+int laserShmCreate(LaserShm* shm, const char* name, const char* programName, int numDoorways)
+{
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd < 0)
+	{
+		return -1;
+	}
+
+	if(ftruncate(fd, sizeof(LaserShmState)) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	void* map = mmap(NULL, sizeof(LaserShmState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		return -1;
+	}
+
+	LaserShmState* state = map;
+	shm->state = state;
+
+	//Readers ignore the object until the magic number is written
+	state->magic = 0;
+	atomic_thread_fence(memory_order_release);
+	memset((char*)state + sizeof(state->magic), 0, sizeof(LaserShmState) - sizeof(state->magic));
+	state->version = SHM_VERSION;
+	strncpy(state->programName, programName, sizeof(state->programName) - 1);
+	atomic_init(&state->sequence, 0);
+	state->pid = getpid();
+	state->numDoorways = numDoorways;
+
+	atomic_thread_fence(memory_order_release);
+	state->magic = SHM_MAGIC;
+	return 0;
+}
+
+//This function marks the counter as stopped and unmaps the shared memory object
+//The object itself is kept, so readers still see the last state
+void laserShmClose(LaserShm* shm)
+{
+	if(shm->state != NULL)
+	{
+		unsigned sequence = atomic_load_explicit(&shm->state->sequence, memory_order_relaxed);
+		atomic_store_explicit(&shm->state->sequence, sequence + 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+		shm->state->pid = 0;
+		atomic_store_explicit(&shm->state->sequence, sequence + 2, memory_order_release);
+
+		munmap(shm->state, sizeof(LaserShmState));
+		shm->state = NULL;
+	}
+}
+
+//This function starts an update: readers retry until laserShmEnd completes it
+void laserShmBegin(LaserShm* shm)
+{
+	LaserShmState* state = shm->state;
+	unsigned sequence = atomic_load_explicit(&state->sequence, memory_order_relaxed);
+
+	//Mark the state as being updated
+	atomic_store_explicit(&state->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+//This function completes an update: it sums the totals of the doorways and stamps the update with timeNs
+//(wall clock nanoseconds)
+//Neither function makes a system call
+void laserShmEnd(LaserShm* shm, int64_t timeNs)
+{
+	LaserShmState* state = shm->state;
+
+	LaserCounts totals = {0, 0, 0, 0};
+	for(uint32_t i = 0; i < state->numDoorways && i < LASER_MAX_DOORWAYS; i++)
+	{
+		totals.laser1Count += state->doorways[i].counts.laser1Count;
+		totals.laser2Count += state->doorways[i].counts.laser2Count;
+		totals.numberIn += state->doorways[i].counts.numberIn;
+		totals.numberOut += state->doorways[i].counts.numberOut;
+	}
+	state->totals = totals;
+	state->lastEventNs = timeNs;
+	state->updates++;
+
+	//Mark the update as complete
+	unsigned sequence = atomic_load_explicit(&state->sequence, memory_order_relaxed);
+	atomic_store_explicit(&state->sequence, sequence + 1, memory_order_release);
+}
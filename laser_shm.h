@@ -0,0 +1,151 @@
+
+#ifndef LASER_SHM_H
+#define LASER_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "laser_fsm.h"
+
+//Name of the POSIX shared memory object the counter publishes its live state in
+#define SHM_NAME    "/laser_counter"
+#define SHM_MAGIC   0x314D484C 	//"LHM1"
+#define SHM_VERSION 1
+
+//Number of copies a reader makes before it gives up on a consistent snapshot
+//An update takes well under a microsecond, so running out means the counter is stuck in the middle of one
+#define SHM_READ_RETRIES 10000
+
+//Live state of one doorway
+typedef struct
+{
+	uint8_t state; 			//machine state: LASER_STATE() of it is the State, the rest are the HAS_BROKEN flags
+	uint8_t reserved[3];
+	LaserCounts counts; 	//laser1Count and laser2Count are the break totals of the two beams
+} ShmDoorway;
+
+//The shared memory object, rewritten in place by the counter after every sample that changed something
+//The sequence number is odd while an update is in progress, readers retry until they see the same even value
+//before and after copying
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	char programName[32];
+	atomic_uint sequence;
+	int32_t pid; 			//process id of the counter, 0 once it has stopped
+	uint64_t updates; 		//number of updates published
+	int64_t lastEventNs; 	//wall clock nanoseconds of the last sample that changed a state or a count
+	uint32_t numDoorways;
+	uint32_t reserved;
+	LaserCounts totals; 	//counts over every doorway
+	ShmDoorway doorways[LASER_MAX_DOORWAYS];
+} LaserShmState;
+
+//Publisher side (the counter), see laser_shm.c
+typedef struct
+{
+	LaserShmState* state;
+} LaserShm;
+
+int  laserShmCreate (LaserShm* shm, const char* name, const char* programName, int numDoorways);
+void laserShmClose  (LaserShm* shm);
+void laserShmBegin  (LaserShm* shm);
+void laserShmEnd    (LaserShm* shm, int64_t timeNs);
+
+//This function stores the machine state and counts of one doorway, between laserShmBegin and laserShmEnd
+static inline void laserShmDoorway(LaserShm* shm, int doorway, uint8_t state, const LaserCounts* counts)
+{
+	shm->state->doorways[doorway].state = state;
+	shm->state->doorways[doorway].counts = *counts;
+}
+
+//Client side: a reader only needs this header
+//This function maps the counter's shared memory object read-only
+//Returns the mapping, or NULL if the counter has not published one or it is not a counter's state
+static inline const LaserShmState* laserShmOpen(const char* name)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	if(fd < 0)
+	{
+		return NULL;
+	}
+
+	void* map = mmap(NULL, sizeof(LaserShmState), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	const LaserShmState* state = map;
+	if(state->magic != SHM_MAGIC || state->version != SHM_VERSION)
+	{
+		munmap(map, sizeof(LaserShmState));
+		return NULL;
+	}
+	return state;
+}
+
+//This function unmaps a state mapped by laserShmOpen
+static inline void laserShmUnmap(const LaserShmState* state)
+{
+	munmap((void*)state, sizeof(LaserShmState));
+}
+
+//This function copies a consistent snapshot of the live state
+//It never blocks the counter and takes no lock: it only copies again if the counter updated the state meanwhile
+//Returns 0 with the sequence number of the snapshot in copy->sequence, or -1 if there is no consistent state
+//to copy: errno is ESRCH if the counter died in the middle of an update, EAGAIN if it is still in one after
+//SHM_READ_RETRIES copies
+static inline int laserShmRead(const LaserShmState* state, LaserShmState* copy)
+{
+	unsigned before;
+	unsigned after;
+
+	for(int retries = 0; ; retries++)
+	{
+		before = atomic_load_explicit(&state->sequence, memory_order_acquire);
+
+		copy->magic = state->magic;
+		copy->version = state->version;
+		memcpy(copy->programName, state->programName, sizeof(copy->programName));
+		copy->pid = state->pid;
+		copy->updates = state->updates;
+		copy->lastEventNs = state->lastEventNs;
+		copy->numDoorways = state->numDoorways;
+		copy->totals = state->totals;
+		memcpy(copy->doorways, state->doorways, sizeof(copy->doorways));
+
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&state->sequence, memory_order_relaxed);
+		if(!(before & 1) && before == after)
+		{
+			break;
+		}
+
+		//A counter that is killed during an update leaves the sequence odd for good: check it is still running
+		if((before & 1) && copy->pid != 0 && kill(copy->pid, 0) < 0 && errno == ESRCH)
+		{
+			return -1;
+		}
+		if(retries == SHM_READ_RETRIES)
+		{
+			errno = EAGAIN;
+			return -1;
+		}
+		sched_yield();
+	}
+
+	atomic_init(&copy->sequence, after);
+	return 0;
+}
+
+#endif /* LASER_SHM_H */
@@ -0,0 +1,345 @@
+#include "laser_stats.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//This function returns the checksum of a checkpoint, computed with its checksum field set to 0
+//It is FNV-1a taken a 32-bit word at a time, which is enough to catch a torn write
+static uint32_t checkpointChecksum(const StatsCheckpoint* checkpoint)
+{
+	StatsCheckpoint copy = *checkpoint;
+	copy.checksum = 0;
+
+	uint32_t words[sizeof(copy) / sizeof(uint32_t)];
+	memcpy(words, &copy, sizeof(words));
+
+	uint32_t hash = 2166136261u;
+	for(size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+	{
+		hash = (hash ^ words[i]) * 16777619u;
+	}
+	return hash;
+}
+
+//This function finds the newest checkpoint whose checksum is valid
+//Returns it, or NULL if neither slot holds a valid checkpoint
+static const StatsCheckpoint* newestCheckpoint(const StatsHeader* header)
+{
+	const StatsCheckpoint* newest = NULL;
+	for(int i = 0; i < 2; i++)
+	{
+		const StatsCheckpoint* checkpoint = &header->checkpoints[i];
+		if(checkpoint->sequence != 0 && checkpoint->numDoorways <= LASER_MAX_DOORWAYS &&
+		   checkpoint->checksum == checkpointChecksum(checkpoint) &&
+		   (newest == NULL || checkpoint->sequence > newest->sequence))
+		{
+			newest = checkpoint;
+		}
+	}
+	return newest;
+}
+
+//This function writes the counts of every doorway into the older checkpoint slot
+static void writeCheckpoint(LaserStats* stats, int64_t time)
+{
+	StatsHeader* header = stats->header;
+	uint64_t sequence = ++stats->checkpointSequence;
+
+	StatsCheckpoint* checkpoint = &header->checkpoints[sequence & 1];
+	checkpoint->sequence = sequence;
+	checkpoint->time = time;
+	checkpoint->numDoorways = header->numDoorways;
+	memcpy(checkpoint->doorways, header->doorways, sizeof(checkpoint->doorways));
+	checkpoint->checksum = checkpointChecksum(checkpoint);
+}
+
+//This function opens the stats file and maps it, creating it if needed
+//The file has a constant size: the header followed by journalRecords events (0 disables the journal)
+//If the file holds a valid checkpoint for the same number of doorways, the counts of the previous run are
+//restored (stats->restored is set) and its journal is kept; otherwise the counts start from zero
+//Returns 0 on success or -1 if the file cannot be created or mapped
+int laserStatsOpen(LaserStats* stats, const char* path, const char* programName, int numDoorways,
+                   uint32_t journalRecords)
+{
+	size_t length = sizeof(StatsHeader) + (size_t)journalRecords * sizeof(StatsEvent);
+
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd < 0)
+	{
+		return -1;
+	}
+
+	//Size the file once, every later update happens inside this mapping
+	//(a file that already has this size keeps its contents)
+	struct stat st;
+	if(fstat(fd, &st) < 0 || ((size_t)st.st_size != length && ftruncate(fd, length) < 0))
+	{
+		close(fd);
+		return -1;
+	}
+
+	void* map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		return -1;
+	}
+
+	stats->header = map;
+	stats->journal = (StatsEvent*)(stats->header + 1);
+	stats->length = length;
+	stats->restored = 0;
+	stats->checkpointSequence = 0;
+	atomic_init(&stats->syncing, 0);
+
+	//Look for the checkpoint of the previous run
+	StatsHeader* header = stats->header;
+	StatsCheckpoint checkpoints[2];
+	const StatsCheckpoint* newest = NULL;
+	int keepJournal = 0;
+	uint64_t journalNext = 0;
+	if((size_t)st.st_size >= sizeof(StatsHeader) && header->magic == STATS_MAGIC && header->version == STATS_VERSION)
+	{
+		newest = newestCheckpoint(header);
+		if(newest != NULL && newest->numDoorways == (uint32_t)numDoorways)
+		{
+			memcpy(checkpoints, header->checkpoints, sizeof(checkpoints));
+			newest = &checkpoints[newest - header->checkpoints];
+			keepJournal = (header->journalCapacity == journalRecords && (size_t)st.st_size == length);
+			journalNext = header->journalNext;
+		}
+		else
+		{
+			newest = NULL;
+		}
+	}
+
+	//Rebuild the header, from the checkpoint if there is one and from zero counts otherwise
+	memset(map, 0, keepJournal ? sizeof(StatsHeader) : length);
+	header->version = STATS_VERSION;
+	strncpy(header->programName, programName, sizeof(header->programName) - 1);
+	atomic_init(&header->sequence, 0);
+	header->journalCapacity = journalRecords;
+	header->numDoorways = numDoorways;
+
+	if(newest != NULL)
+	{
+		memcpy(header->checkpoints, checkpoints, sizeof(checkpoints));
+		memcpy(header->doorways, newest->doorways, sizeof(header->doorways));
+		for(int i = 0; i < numDoorways; i++)
+		{
+			header->counts.laser1Count += header->doorways[i].laser1Count;
+			header->counts.laser2Count += header->doorways[i].laser2Count;
+			header->counts.numberIn += header->doorways[i].numberIn;
+			header->counts.numberOut += header->doorways[i].numberOut;
+		}
+		header->updated = newest->time;
+		header->journalNext = keepJournal ? journalNext : 0;
+		stats->checkpointSequence = newest->sequence;
+		stats->restored = 1;
+	}
+
+	//The magic number is written last so that a reader never trusts a half initialized header
+	atomic_thread_fence(memory_order_release);
+	header->magic = STATS_MAGIC;
+	return 0;
+}
+
+//This function maps an existing stats file read-only (used by the reader tool)
+//Returns 0 on success or -1 if the file is missing or is not a stats file
+int laserStatsMap(LaserStats* stats, const char* path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		return -1;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(StatsHeader))
+	{
+		close(fd);
+		return -1;
+	}
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		return -1;
+	}
+
+	stats->header = map;
+	stats->journal = (StatsEvent*)(stats->header + 1);
+	stats->length = st.st_size;
+	stats->restored = 0;
+	stats->checkpointSequence = 0;
+	atomic_init(&stats->syncing, 0);
+
+	//Reject files that are not stats files or whose journal does not fit in the file
+	StatsHeader* header = stats->header;
+	if(header->magic != STATS_MAGIC || header->version != STATS_VERSION ||
+	   sizeof(StatsHeader) + (size_t)header->journalCapacity * sizeof(StatsEvent) > stats->length)
+	{
+		laserStatsClose(stats);
+		return -1;
+	}
+	return 0;
+}
+
+//Background thread writing the header, and so the latest checkpoint, through to the disk after every update
+//A burst of updates is written once
+static void* syncThread(void* arg)
+{
+	LaserStats* stats = arg;
+
+	for(;;)
+	{
+		while(sem_wait(&stats->dirty) < 0 && errno == EINTR)
+		{
+		}
+		while(sem_trywait(&stats->dirty) == 0)
+		{
+		}
+
+		msync(stats->header, sizeof(StatsHeader), MS_SYNC);
+
+		if(!atomic_load(&stats->syncing))
+		{
+			break;
+		}
+	}
+	return NULL;
+}
+
+//This function starts the thread that writes every checkpoint through to the disk, so that the counts
+//survive a watchdog reset or a power loss and not only a crash of the process
+//The sensing loop only posts a semaphore when the counts change
+//Returns 0 on success or -1 if the thread could not be started
+int laserStatsStartSync(LaserStats* stats)
+{
+	if(sem_init(&stats->dirty, 0, 0) < 0)
+	{
+		return -1;
+	}
+	atomic_store(&stats->syncing, 1);
+	if(pthread_create(&stats->syncer, NULL, syncThread, stats) != 0)
+	{
+		atomic_store(&stats->syncing, 0);
+		sem_destroy(&stats->dirty);
+		return -1;
+	}
+	return 0;
+}
+
+//This function stops the sync thread, writes the mapped pages back and unmaps the stats file
+void laserStatsClose(LaserStats* stats)
+{
+	if(atomic_load(&stats->syncing))
+	{
+		atomic_store(&stats->syncing, 0);
+		sem_post(&stats->dirty);
+		pthread_join(stats->syncer, NULL);
+		sem_destroy(&stats->dirty);
+	}
+
+	if(stats->header != NULL)
+	{
+		msync(stats->header, stats->length, MS_ASYNC);
+		munmap(stats->header, stats->length);
+		stats->header = NULL;
+	}
+}
+
+//This function stores the new counts of one doorway in the header, updates the totals
+//and appends the change to the journal (doorway -1 only records the current totals)
+//It only writes to memory: no formatting, and no system call unless the sync thread has to be woken
+void laserStatsUpdate(LaserStats* stats, int doorway, const LaserCounts* counts, uint32_t actions, int64_t time)
+{
+	StatsHeader* header = stats->header;
+	unsigned sequence = atomic_load_explicit(&header->sequence, memory_order_relaxed);
+
+	//Mark the header as being updated
+	atomic_store_explicit(&header->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	if(doorway >= 0)
+	{
+		//Move the totals by the change in this doorway's counts
+		LaserCounts* previous = &header->doorways[doorway];
+		header->counts.laser1Count += counts->laser1Count - previous->laser1Count;
+		header->counts.laser2Count += counts->laser2Count - previous->laser2Count;
+		header->counts.numberIn += counts->numberIn - previous->numberIn;
+		header->counts.numberOut += counts->numberOut - previous->numberOut;
+		*previous = *counts;
+
+		//Checkpoint the counts of every doorway for the next start
+		writeCheckpoint(stats, time);
+	}
+	header->updated = time;
+
+	if(header->journalCapacity > 0)
+	{
+		StatsEvent* event = &stats->journal[header->journalNext % header->journalCapacity];
+		event->time = time;
+		event->actions = actions;
+		event->doorway = doorway;
+		event->counts = (doorway >= 0) ? *counts : header->counts;
+		header->journalNext++;
+	}
+
+	//Mark the update as complete
+	atomic_store_explicit(&header->sequence, sequence + 2, memory_order_release);
+
+	//Have the checkpoint written to the disk
+	if(doorway >= 0 && atomic_load_explicit(&stats->syncing, memory_order_relaxed))
+	{
+		sem_post(&stats->dirty);
+	}
+}
+
+//This function copies a consistent snapshot of the header
+//Returns 0 with the sequence number of the snapshot in copy->sequence, or -1 (errno EAGAIN) if the header is
+//still being updated after STATS_READ_RETRIES copies, as when the counter died in the middle of an update
+int laserStatsRead(const LaserStats* stats, StatsHeader* copy)
+{
+	StatsHeader* header = stats->header;
+	unsigned before;
+	unsigned after;
+
+	for(int retries = 0; ; retries++)
+	{
+		before = atomic_load_explicit(&header->sequence, memory_order_acquire);
+
+		copy->magic = header->magic;
+		copy->version = header->version;
+		memcpy(copy->programName, header->programName, sizeof(copy->programName));
+		copy->journalCapacity = header->journalCapacity;
+		copy->updated = header->updated;
+		copy->counts = header->counts;
+		copy->numDoorways = header->numDoorways;
+		memcpy(copy->doorways, header->doorways, sizeof(copy->doorways));
+		copy->journalNext = header->journalNext;
+
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&header->sequence, memory_order_relaxed);
+		if(!(before & 1) && before == after)
+		{
+			break;
+		}
+		if(retries == STATS_READ_RETRIES)
+		{
+			errno = EAGAIN;
+			return -1;
+		}
+		sched_yield();
+	}
+
+	atomic_init(&copy->sequence, after);
+	return 0;
+}
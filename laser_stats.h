@@ -0,0 +1,85 @@
+
+#ifndef LASER_STATS_H
+#define LASER_STATS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "laser_fsm.h"
+
+#define STATS_MAGIC   0x3153414C 	//"LAS1"
+#define STATS_VERSION 4
+
+//Default number of events kept in the journal that follows the header
+#define STATS_JOURNAL_RECORDS 4096
+
+//Number of copies laserStatsRead makes before it gives up on a consistent header
+#define STATS_READ_RETRIES 10000
+
+//One journal record per count change
+typedef struct
+{
+	int64_t time; 			//wall clock nanoseconds
+	uint32_t actions; 		//ACT_* flags of the transition, 0 for the initial record
+	int32_t doorway; 		//doorway whose counts changed, -1 for the initial record
+	LaserCounts counts; 	//counts of that doorway after the change (the totals for the initial record)
+} StatsEvent;
+
+//A checkpoint of every doorway's counts, restored when the counter starts again
+//Two slots are written in turn, so a checkpoint torn by a crash or power loss still leaves the previous one,
+//and the valid slot with the highest sequence number is the one restored
+typedef struct
+{
+	uint64_t sequence; 		//number of checkpoints ever written, 0 for an empty slot
+	int64_t time; 			//wall clock nanoseconds
+	uint32_t numDoorways;
+	uint32_t checksum; 		//FNV-1a of the rest of the checkpoint
+	LaserCounts doorways[LASER_MAX_DOORWAYS];
+} StatsCheckpoint;
+
+//Fixed-size header at the start of the stats file, updated in place
+//The sequence number is odd while an update is in progress, readers retry until they see the same even value
+//before and after copying
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	char programName[32];
+	atomic_uint sequence;
+	uint32_t journalCapacity;
+	int64_t updated; 		//wall clock nanoseconds
+	LaserCounts counts; 	//totals over every doorway
+	uint32_t numDoorways;
+	uint32_t reserved;
+	LaserCounts doorways[LASER_MAX_DOORWAYS];
+	uint64_t journalNext; 	//number of events ever written, the next slot is journalNext % journalCapacity
+	StatsCheckpoint checkpoints[2];
+} StatsHeader;
+
+typedef struct
+{
+	StatsHeader* header;
+	StatsEvent* journal;
+	size_t length;
+	int restored; 			//the counts were restored from the checkpoint of a previous run
+	uint64_t checkpointSequence; 	//sequence number of the last checkpoint written
+
+	//Optional thread writing every checkpoint through to the disk
+	sem_t dirty;
+	atomic_int syncing;
+	pthread_t syncer;
+} LaserStats;
+
+int  laserStatsOpen  (LaserStats* stats, const char* path, const char* programName, int numDoorways,
+                      uint32_t journalRecords);
+int  laserStatsMap   (LaserStats* stats, const char* path);
+void laserStatsClose (LaserStats* stats);
+int  laserStatsStartSync(LaserStats* stats);
+
+void laserStatsUpdate(LaserStats* stats, int doorway, const LaserCounts* counts, uint32_t actions, int64_t time);
+int  laserStatsRead  (const LaserStats* stats, StatsHeader* header);
+
+#endif /* LASER_STATS_H */
@@ -0,0 +1,81 @@
+#include "laser_time.h"
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <string.h>
+
+//Difference between the wall clock and the monotonic clock
+//The Pi has no real time clock, so the wall clock is stepped by NTP some time after start-up: the offset is
+//taken again by laserTimeRefresh, and readers on any thread pick up the new value with a single atomic load
+static _Atomic int64_t wallOffsetNs;
+
+//Set once a replay has installed the offset of a recording, which a refresh must then leave alone
+static atomic_bool offsetPinned;
+
+//This function returns the current difference between the wall clock and the monotonic clock
+//The wall clock is read between two monotonic reads and paired with their midpoint, to keep out a preemption
+static int64_t measureOffset(void)
+{
+	struct timespec wall;
+	uint64_t before = laserMonotonicNs();
+	clock_gettime(CLOCK_REALTIME, &wall);
+	uint64_t after = laserMonotonicNs();
+
+	return ((int64_t)wall.tv_sec * 1000000000ll + wall.tv_nsec) - (int64_t)(before + (after - before) / 2);
+}
+
+//This function records the offset used to convert monotonic timestamps to wall clock time
+void laserTimeInit(void)
+{
+	atomic_store_explicit(&wallOffsetNs, measureOffset(), memory_order_relaxed);
+}
+
+//This function takes the offset again, so that a wall clock set or corrected after start-up reaches the
+//timestamps written from then on
+//It is called about once per second by the log writer thread; it does nothing while a replay offset is pinned
+void laserTimeRefresh(void)
+{
+	if(!atomic_load_explicit(&offsetPinned, memory_order_relaxed))
+	{
+		atomic_store_explicit(&wallOffsetNs, measureOffset(), memory_order_relaxed);
+	}
+}
+
+//This function replaces the offset, so that the timestamps of a recorded trace are converted with the offset
+//of the run that recorded them
+//The offset stays in place until the program ends: laserTimeRefresh no longer changes it
+void laserTimeSetOffset(int64_t offsetNs)
+{
+	atomic_store_explicit(&offsetPinned, 1, memory_order_relaxed);
+	atomic_store_explicit(&wallOffsetNs, offsetNs, memory_order_relaxed);
+}
+
+//This function converts a monotonic timestamp to wall clock nanoseconds since the epoch
+int64_t laserWallNs(uint64_t monotonicNs)
+{
+	return (int64_t)monotonicNs + atomic_load_explicit(&wallOffsetNs, memory_order_relaxed);
+}
+
+//This function writes the time of a monotonic timestamp into buffer (LASER_TIME_LEN characters)
+void laserFormatTime(LaserTimeCache* cache, uint64_t monotonicNs, char* buffer)
+{
+	laserFormatWallTime(cache, laserWallNs(monotonicNs), buffer);
+}
+
+//This function writes a wall clock time into buffer (LASER_TIME_LEN characters) in the month, day, year
+//and 24 hour time format of the log, followed by the microseconds
+//The date and time of day are only formatted again when the second changes
+void laserFormatWallTime(LaserTimeCache* cache, int64_t wall, char* buffer)
+{
+	int64_t second = wall / 1000000000ll;
+
+	if(second != cache->second || cache->prefix[0] == 0)
+	{
+		time_t curtime = (time_t)second;
+		struct tm local;
+		strftime(cache->prefix, sizeof(cache->prefix), "%m-%d-%Y  %T", localtime_r(&curtime, &local));
+		cache->second = second;
+	}
+
+	snprintf(buffer, LASER_TIME_LEN, "%s.%06u", cache->prefix, (unsigned)(wall % 1000000000ll / 1000) % 1000000);
+}
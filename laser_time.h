@@ -0,0 +1,35 @@
+
+#ifndef LASER_TIME_H
+#define LASER_TIME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+//Length of a formatted time such as "10-17-2026  07:39:32.123456"
+#define LASER_TIME_LEN 32
+
+//Remembers the text of the last second formatted, so that localtime and strftime run at most once per second
+typedef struct
+{
+	int64_t second;
+	char prefix[24];
+} LaserTimeCache;
+
+void    laserTimeInit   (void);
+void    laserTimeRefresh(void);
+void    laserTimeSetOffset(int64_t offsetNs);
+int64_t laserWallNs     (uint64_t monotonicNs);
+void    laserFormatTime (LaserTimeCache* cache, uint64_t monotonicNs, char* buffer);
+void    laserFormatWallTime(LaserTimeCache* cache, int64_t wallNs, char* buffer);
+
+//This function returns the monotonic clock in nanoseconds
+//Events are stamped with it when they are captured, and converted to wall clock time only when written out
+static inline uint64_t laserMonotonicNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#endif /* LASER_TIME_H */
@@ -0,0 +1,152 @@
+#include "laser_trace.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "laser_time.h"
+
+//Size of the stdio buffer of the trace writer, so that recording only makes a system call every few thousand changes
+#define TRACE_BUFFER_SIZE 65536
+
+//This function creates a trace file recording the pins in pinMask
+//Returns 0 on success or -1 if the file cannot be created
+int laserTraceCreate(LaserTraceWriter* writer, const char* path, uint32_t pinMask)
+{
+	writer->file = fopen(path, "w");
+	if(writer->file == NULL)
+	{
+		return -1;
+	}
+	setvbuf(writer->file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+	TraceHeader header = {TRACE_MAGIC, TRACE_VERSION, laserWallNs(0), pinMask, 0};
+	fwrite(&header, sizeof(header), 1, writer->file);
+
+	writer->pinMask = pinMask;
+	writer->lastLevels = 0;
+	writer->started = 0;
+	writer->unflushed = 0;
+	return 0;
+}
+
+//This function writes out the buffered records, if there are any
+//The sensing loop calls it before it sleeps, so a trace is complete up to the last idle period
+void laserTraceFlush(LaserTraceWriter* writer)
+{
+	if(writer->unflushed > 0)
+	{
+		fflush(writer->file);
+		writer->unflushed = 0;
+	}
+}
+
+//This function writes out the buffered records and closes the trace file
+void laserTraceClose(LaserTraceWriter* writer)
+{
+	if(writer->file != NULL)
+	{
+		fclose(writer->file);
+		writer->file = NULL;
+	}
+}
+
+//This function maps a trace file for replay
+//Returns 0 on success or -1 if the file is missing or is not a trace file
+int laserTraceMap(LaserTrace* trace, const char* path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		return -1;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(TraceHeader))
+	{
+		close(fd);
+		return -1;
+	}
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		return -1;
+	}
+
+	//The records are read in order exactly once
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	trace->header = map;
+	trace->records = (const TraceRecord*)(trace->header + 1);
+	trace->count = (st.st_size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+	trace->length = st.st_size;
+
+	if(trace->header->magic != TRACE_MAGIC || trace->header->version != TRACE_VERSION)
+	{
+		laserTraceUnmap(trace);
+		return -1;
+	}
+	return 0;
+}
+
+//This function unmaps a trace file
+void laserTraceUnmap(LaserTrace* trace)
+{
+	if(trace->header != NULL)
+	{
+		munmap((void*)trace->header, trace->length);
+		trace->header = NULL;
+	}
+}
+
+//This function feeds one recorded change of the levels to the counter
+//The samples the live loop would have taken when a debounced change became stable are replayed first,
+//so the counts and log lines are the same as in the recorded run
+void laserReplayChange(LaserReplay* replay, LaserCounter* counter, uint64_t timeNs, uint32_t levels)
+{
+	if(replay->actions & ACT_ABORT)
+	{
+		return;
+	}
+
+	//Wake up where the live loop would have sampled the unchanged levels again for the filter
+	while(replay->changes > 0 && counter->filterDeadlineNs <= timeNs && !(replay->actions & ACT_ABORT))
+	{
+		replay->actions |= laserCounterProcess(counter, replay->levels, counter->filterDeadlineNs, 0);
+	}
+
+	//Every record is a change, so its time is also the time of the edge
+	replay->actions |= laserCounterProcess(counter, levels, timeNs, timeNs);
+	replay->levels = levels;
+	replay->lastNs = timeNs;
+	replay->changes++;
+}
+
+//This function lets the changes still pending at the end of a recording settle
+//Returns the number of changes replayed, or -1 if the counter aborted (a doorway did not start unbroken)
+long laserReplayFinish(LaserReplay* replay, LaserCounter* counter)
+{
+	while(replay->changes > 0 && counter->filterDeadlineNs != UINT64_MAX && !(replay->actions & ACT_ABORT))
+	{
+		replay->lastNs = counter->filterDeadlineNs;
+		replay->actions |= laserCounterProcess(counter, replay->levels, counter->filterDeadlineNs, 0);
+	}
+	return (replay->actions & ACT_ABORT) ? -1 : replay->changes;
+}
+
+//This function drives the counter with every record of the trace, as fast as the CPU allows
+//Returns the number of records replayed, or -1 if the counter aborted
+long laserTraceReplay(const LaserTrace* trace, LaserCounter* counter, LaserReplay* replay)
+{
+	//Stamp the messages with the wall clock of the recorded run
+	laserTimeSetOffset(trace->header->wallOffsetNs);
+
+	for(size_t i = 0; i < trace->count && !(replay->actions & ACT_ABORT); i++)
+	{
+		laserReplayChange(replay, counter, trace->records[i].timeNs, trace->records[i].levels);
+	}
+	return laserReplayFinish(replay, counter);
+}
@@ -0,0 +1,84 @@
+
+#ifndef LASER_TRACE_H
+#define LASER_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "laser_counter.h"
+
+#define TRACE_MAGIC   0x3152544C 	//"LTR1"
+#define TRACE_VERSION 1
+
+//A trace file is this header followed by one record per change of the beam pins
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	int64_t wallOffsetNs; 	//wall clock minus monotonic clock of the recording run
+	uint32_t pinMask; 		//beam pins recorded
+	uint32_t reserved;
+} TraceHeader;
+
+typedef struct
+{
+	uint64_t timeNs; 		//monotonic time of the sample
+	uint32_t levels; 		//level register, masked to the beam pins
+	uint32_t reserved;
+} TraceRecord;
+
+//Writer used by the live counter to record a trace
+typedef struct
+{
+	FILE* file;
+	uint32_t pinMask;
+	uint32_t lastLevels;
+	int started;
+	int unflushed; 			//records written since the last flush
+} LaserTraceWriter;
+
+//Progress of a replay, shared by every recorded format
+typedef struct
+{
+	uint32_t levels; 		//levels of the last change replayed
+	unsigned actions; 		//actions of every transition taken so far combined
+	uint64_t lastNs; 		//time of the last sample replayed
+	long changes; 			//number of changes replayed
+} LaserReplay;
+
+//A trace mapped for replay
+typedef struct
+{
+	const TraceHeader* header;
+	const TraceRecord* records;
+	size_t count;
+	size_t length;
+} LaserTrace;
+
+int  laserTraceCreate(LaserTraceWriter* writer, const char* path, uint32_t pinMask);
+void laserTraceFlush (LaserTraceWriter* writer);
+void laserTraceClose (LaserTraceWriter* writer);
+
+int  laserTraceMap   (LaserTrace* trace, const char* path);
+void laserTraceUnmap (LaserTrace* trace);
+long laserTraceReplay(const LaserTrace* trace, LaserCounter* counter, LaserReplay* replay);
+
+void laserReplayChange(LaserReplay* replay, LaserCounter* counter, uint64_t timeNs, uint32_t levels);
+long laserReplayFinish(LaserReplay* replay, LaserCounter* counter);
+
+//This function records a sample if any beam pin changed since the last recorded sample
+static inline void laserTraceRecord(LaserTraceWriter* writer, uint32_t levels, uint64_t timeNs)
+{
+	levels &= writer->pinMask;
+	if(levels != writer->lastLevels || !writer->started)
+	{
+		TraceRecord record = {timeNs, levels, 0};
+		fwrite(&record, sizeof(record), 1, writer->file);
+		writer->lastLevels = levels;
+		writer->started = 1;
+		writer->unflushed++;
+	}
+}
+
+#endif /* LASER_TRACE_H */
@@ -0,0 +1,103 @@
+#include "laser_tracker.h"
+
+//This function adds n to a counter only the sensing loop writes
+static void add(atomic_ulong* counter, unsigned long n)
+{
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+//This function empties the queue of crossings in flight
+void laserTrackerReset(LaserTracker* tracker)
+{
+	tracker->head = 0;
+	tracker->count = 0;
+	tracker->beams = BEAMS_NONE;
+}
+
+//This function removes the crossing at position 'position' of the queue (0 is the oldest), keeping the order of the others
+static void removeTrack(LaserTracker* tracker, int position)
+{
+	for(int i = position; i + 1 < tracker->count; i++)
+	{
+		tracker->tracks[(tracker->head + i) % TRACKER_DEPTH] = tracker->tracks[(tracker->head + i + 1) % TRACKER_DEPTH];
+	}
+	tracker->count--;
+}
+
+//This function applies one edge of a beam (TRACKER_LASER1 or TRACKER_LASER2), which broke or was restored at timeNs
+//A beam breaking is either the far beam reached by the oldest crossing still on its near beam, or a new crossing;
+//a beam being restored means every object on it has left it: a crossing leaving its far beam after its near beam is
+//complete, one leaving its far beam first has turned back, and one leaving its near beam before reaching the far beam
+//is abandoned
+//The queue holds at most TRACKER_DEPTH crossings, so an edge takes constant time
+//Returns ACT_COUNT_IN and/or ACT_COUNT_OUT if crossings were completed (and counted in counts), 0 otherwise
+unsigned laserTrackerEdge(LaserTracker* tracker, int beam, int broken, uint64_t timeNs, LaserCounts* counts)
+{
+	if(broken)
+	{
+		for(int i = 0; i < tracker->count; i++)
+		{
+			LaserTrack* track = &tracker->tracks[(tracker->head + i) % TRACKER_DEPTH];
+			if(track->near != beam && !(track->flags & (TRACK_NEAR_CLEARED | TRACK_FAR_BROKEN)))
+			{
+				track->flags |= TRACK_FAR_BROKEN;
+				return 0;
+			}
+		}
+
+		//A new object, which pushes the oldest one out when the queue is full
+		if(tracker->count == TRACKER_DEPTH)
+		{
+			tracker->head = (tracker->head + 1) % TRACKER_DEPTH;
+			tracker->count--;
+			add(&tracker->overflows, 1);
+		}
+		LaserTrack* track = &tracker->tracks[(tracker->head + tracker->count) % TRACKER_DEPTH];
+		track->near = (uint8_t)beam;
+		track->flags = 0;
+		track->startNs = timeNs;
+		tracker->count++;
+		return 0;
+	}
+
+	unsigned actions = 0;
+	for(int i = 0; i < tracker->count; )
+	{
+		LaserTrack* track = &tracker->tracks[(tracker->head + i) % TRACKER_DEPTH];
+		if(track->near == beam && !(track->flags & TRACK_NEAR_CLEARED))
+		{
+			//Left the near beam: on its way unless it never reached the far beam
+			track->flags |= TRACK_NEAR_CLEARED;
+			if(!(track->flags & TRACK_FAR_BROKEN))
+			{
+				removeTrack(tracker, i);
+				continue;
+			}
+		}
+		else if(track->near != beam && (track->flags & TRACK_FAR_BROKEN))
+		{
+			if(track->flags & TRACK_NEAR_CLEARED)
+			{
+				//Left the far beam last: the crossing is complete
+				if(track->near == TRACKER_LASER1)
+				{
+					counts->numberIn++;
+					actions |= ACT_COUNT_IN;
+				}
+				else
+				{
+					counts->numberOut++;
+					actions |= ACT_COUNT_OUT;
+				}
+				add(&tracker->tailgates, tracker->count > 1);
+				removeTrack(tracker, i);
+				continue;
+			}
+
+			//Left the far beam while still on the near one: it turned back
+			track->flags &= ~TRACK_FAR_BROKEN;
+		}
+		i++;
+	}
+	return actions;
+}
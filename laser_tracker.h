@@ -0,0 +1,85 @@
+
+#ifndef LASER_TRACKER_H
+#define LASER_TRACKER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "laser_fsm.h"
+
+//Largest number of crossings a doorway can have in flight at once
+//A new crossing arriving when the queue is full pushes the oldest one out uncounted
+#define TRACKER_DEPTH 4
+
+//Beams of a doorway, as indexed by the tracker
+#define TRACKER_LASER1 0
+#define TRACKER_LASER2 1
+
+//Progress of a crossing through the far beam (the near beam is the one it broke first)
+#define TRACK_NEAR_CLEARED 0x1 	//the object has left the near beam
+#define TRACK_FAR_BROKEN   0x2 	//the object has reached the far beam
+
+//One object between the beams
+typedef struct
+{
+	uint8_t near; 			//TRACKER_LASER1 for an object coming in, TRACKER_LASER2 for one going out
+	uint8_t flags;
+	uint64_t startNs; 		//edge time of the break of the near beam
+} LaserTrack;
+
+//The crossings in flight through one doorway, oldest first
+//Objects cannot pass each other between the beams, so every beam edge belongs to the oldest crossing it can belong to
+typedef struct
+{
+	LaserTrack tracks[TRACKER_DEPTH];
+	uint8_t head; 			//index of the oldest crossing
+	uint8_t count;
+	uint8_t beams; 			//BEAMS_* mask of the broken beams, as last seen by the tracker
+	atomic_ulong overflows; 	//crossings pushed out of a full queue (only the sensing loop writes it)
+	atomic_ulong tailgates; 	//crossings completed while another one was in flight (only the sensing loop writes it)
+} LaserTracker;
+
+void     laserTrackerReset(LaserTracker* tracker);
+unsigned laserTrackerEdge (LaserTracker* tracker, int beam, int broken, uint64_t timeNs, LaserCounts* counts);
+
+//This function feeds the tracker the beams of a filtered sample, whose changes happened at time1Ns (laser 1)
+//and time2Ns (laser 2)
+//When both beams changed in the same sample, their edges are replayed in the order they happened
+//Returns ACT_COUNT_IN and/or ACT_COUNT_OUT if crossings were completed (and counted in counts), 0 otherwise
+static inline unsigned laserTrackerUpdate(LaserTracker* tracker, unsigned beams, uint64_t time1Ns, uint64_t time2Ns,
+                                          LaserCounts* counts)
+{
+	unsigned changed = (beams ^ tracker->beams) & BEAMS_BOTH;
+	if(changed == 0)
+	{
+		return 0;
+	}
+	tracker->beams = (uint8_t)beams;
+
+	unsigned actions = 0;
+	if(changed == BEAMS_BOTH && time2Ns < time1Ns)
+	{
+		actions |= laserTrackerEdge(tracker, TRACKER_LASER2, (beams & BEAMS_LASER2) != 0, time2Ns, counts);
+		actions |= laserTrackerEdge(tracker, TRACKER_LASER1, (beams & BEAMS_LASER1) != 0, time1Ns, counts);
+	}
+	else
+	{
+		if(changed & BEAMS_LASER1)
+		{
+			actions |= laserTrackerEdge(tracker, TRACKER_LASER1, (beams & BEAMS_LASER1) != 0, time1Ns, counts);
+		}
+		if(changed & BEAMS_LASER2)
+		{
+			actions |= laserTrackerEdge(tracker, TRACKER_LASER2, (beams & BEAMS_LASER2) != 0, time2Ns, counts);
+		}
+	}
+
+	//Once both beams are unbroken no object is left between them, whatever the queue still holds
+	if(beams == BEAMS_NONE)
+	{
+		tracker->count = 0;
+	}
+	return actions;
+}
+
+#endif /* LASER_TRACKER_H */
@@ -0,0 +1,131 @@
+#include "laser_watchdog.h"
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/watchdog.h>
+
+#include "laser_time.h"
+
+//Keepalive thread: kicks the watchdog every kickIntervalNs as long as the sensing loop is healthy
+static void* keepaliveThread(void* arg)
+{
+	LaserWatchdog* watchdog = arg;
+	uint64_t nextKickNs = laserMonotonicNs();
+	int stalled = 0;
+
+	pthread_mutex_lock(&watchdog->lock);
+	while(watchdog->running)
+	{
+		uint64_t nowNs = laserMonotonicNs();
+
+		if(nowNs >= nextKickNs)
+		{
+			uint64_t heartbeat = atomic_load_explicit(&watchdog->heartbeat, memory_order_relaxed);
+
+			//The sensing loop may beat between the clock read above and this load, leaving the heartbeat
+			//ahead of nowNs: that is the healthiest case, not a wrapped difference
+			if(heartbeat >= nowNs || nowNs - heartbeat < watchdog->stallNs)
+			{
+				//Kick the watchdog
+				ioctl(watchdog->fd, WDIOC_KEEPALIVE, 0);
+				atomic_fetch_add_explicit(&watchdog->kicks, 1, memory_order_relaxed);
+
+				//Record how late the kick was (only this thread writes these)
+				uint64_t lateNs = nowNs - nextKickNs;
+				unsigned long sum = atomic_load_explicit(&watchdog->jitterSumNs, memory_order_relaxed);
+				atomic_store_explicit(&watchdog->jitterSumNs, sum + lateNs, memory_order_relaxed);
+				if(lateNs > atomic_load_explicit(&watchdog->jitterMaxNs, memory_order_relaxed))
+				{
+					atomic_store_explicit(&watchdog->jitterMaxNs, lateNs, memory_order_relaxed);
+				}
+
+				//Print a message to the log file that the watchdog has been kicked
+				LOG_MSG(watchdog->log, LOG_SINK_LOG, nowNs, "The watchdog has been kicked.\n\n");
+				stalled = 0;
+			}
+			else
+			{
+				//The sensing loop has stopped reporting: let the watchdog expire
+				atomic_fetch_add_explicit(&watchdog->refused, 1, memory_order_relaxed);
+				if(!stalled)
+				{
+					LOG_MSG(watchdog->log, LOG_SINK_LOG, nowNs, "The sensing loop has stalled: the watchdog was not kicked.\n\n");
+					stalled = 1;
+				}
+			}
+
+			//Schedule the next kick from the previous deadline so the kicks do not drift
+			nextKickNs += watchdog->kickIntervalNs;
+			if(nextKickNs < nowNs)
+			{
+				nextKickNs = nowNs + watchdog->kickIntervalNs;
+			}
+		}
+
+		struct timespec deadline;
+		deadline.tv_sec = nextKickNs / 1000000000ull;
+		deadline.tv_nsec = nextKickNs % 1000000000ull;
+		pthread_cond_timedwait(&watchdog->wakeup, &watchdog->lock, &deadline);
+	}
+	pthread_mutex_unlock(&watchdog->lock);
+	return NULL;
+}
+
+//This function starts kicking the opened watchdog file descriptor 'fd'
+//timeOut is the value read back with WDIOC_GETTIMEOUT, and the watchdog is kicked kicksPerTimeout times per timeout
+//Returns 0 on success or -1 if the thread could not be started
+int laserWatchdogStart(LaserWatchdog* watchdog, int fd, int timeOut, int kicksPerTimeout, LaserLog* log)
+{
+	if(kicksPerTimeout < 2)
+	{
+		kicksPerTimeout = WATCHDOG_KICKS_PER_TIMEOUT;
+	}
+
+	watchdog->fd = fd;
+	watchdog->kickIntervalNs = (uint64_t)timeOut * 1000000000ull / kicksPerTimeout;
+	watchdog->stallNs = (uint64_t)timeOut * 1000000000ull / 2;
+	watchdog->log = log;
+	watchdog->running = 1;
+
+	atomic_init(&watchdog->heartbeat, laserMonotonicNs());
+	atomic_init(&watchdog->kicks, 0);
+	atomic_init(&watchdog->refused, 0);
+	atomic_init(&watchdog->jitterSumNs, 0);
+	atomic_init(&watchdog->jitterMaxNs, 0);
+
+	//The thread waits on the monotonic clock, the same clock the deadlines are computed with
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&watchdog->wakeup, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&watchdog->lock, NULL);
+
+	if(pthread_create(&watchdog->thread, NULL, keepaliveThread, watchdog) != 0)
+	{
+		pthread_cond_destroy(&watchdog->wakeup);
+		pthread_mutex_destroy(&watchdog->lock);
+		return -1;
+	}
+	return 0;
+}
+
+//This function stops the keepalive thread
+//If disable is set, 'V' is written to the watchdog file to disable it before it is closed
+void laserWatchdogStop(LaserWatchdog* watchdog, int disable)
+{
+	pthread_mutex_lock(&watchdog->lock);
+	watchdog->running = 0;
+	pthread_cond_signal(&watchdog->wakeup);
+	pthread_mutex_unlock(&watchdog->lock);
+	pthread_join(watchdog->thread, NULL);
+
+	if(disable)
+	{
+		write(watchdog->fd, "V", 1);
+	}
+	close(watchdog->fd);
+
+	pthread_cond_destroy(&watchdog->wakeup);
+	pthread_mutex_destroy(&watchdog->lock);
+}
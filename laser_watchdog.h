@@ -0,0 +1,45 @@
+
+#ifndef LASER_WATCHDOG_H
+#define LASER_WATCHDOG_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "laser_log.h"
+
+//Default number of kicks per watchdog timeout (i.e. kick every third of WDIOC_GETTIMEOUT)
+#define WATCHDOG_KICKS_PER_TIMEOUT 3
+
+//The keepalive runs on its own thread, paced by the monotonic clock
+//The sensing loop reports a heartbeat on every iteration, and the thread refuses to kick the watchdog
+//once the heartbeat is older than half the timeout, so a stalled sensing loop still ends in a reset
+typedef struct
+{
+	int fd;
+	uint64_t kickIntervalNs;
+	uint64_t stallNs;
+	LaserLog* log;
+
+	atomic_uint_least64_t heartbeat;
+	atomic_ulong kicks;
+	atomic_ulong refused;
+	atomic_ulong jitterSumNs; 	//total lateness of the kicks against their schedule
+	atomic_ulong jitterMaxNs; 	//largest lateness of a kick
+
+	int running;
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup;
+	pthread_t thread;
+} LaserWatchdog;
+
+int  laserWatchdogStart(LaserWatchdog* watchdog, int fd, int timeOut, int kicksPerTimeout, LaserLog* log);
+void laserWatchdogStop (LaserWatchdog* watchdog, int disable);
+
+//This function records that the sensing loop is still making progress
+static inline void laserWatchdogHeartbeat(LaserWatchdog* watchdog, uint64_t nowNs)
+{
+	atomic_store_explicit(&watchdog->heartbeat, nowNs, memory_order_relaxed);
+}
+
+#endif /* LASER_WATCHDOG_H */
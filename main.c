@@ -1,5 +1,17 @@
 #include "gpiolib_addr.h"
 #include "gpiolib_reg.h"
+#include "gpiolib_events.h"
+#include "laser_fsm.h"
+#include "laser_log.h"
+#include "laser_stats.h"
+#include "laser_time.h"
+#include "laser_watchdog.h"
+#include "laser_counter.h"
+#include "laser_trace.h"
+#include "laser_capture.h"
+#include "laser_config.h"
+#include "laser_rt.h"
+#include "laser_poll.h"
 
 #include <string.h>
 #include <stdint.h>
@@ -10,7 +22,8 @@
 #include <sys/ioctl.h> 			//needed for the ioctl function
 #include <stdlib.h> 			//for atoi
 #include <time.h> 				//for time_t and the time() function
-#include <sys/time.h>           //for gettimeofday()
+#include <signal.h> 				//for the SIGHUP handler
+#include <errno.h>
 
 //Macro to print messages onto a file
 //Passes in file name, current time, program name, and message
@@ -24,315 +37,14 @@
 //This Macro will be used to see if the log file and stats file have the correct directory
 #define DIRECTORY "/home/pi"
 
-//Define the following Macros for string comparison
-//when reading the config file in the 'readConfig' function
-#define TIMEOUT "WATCHDOG_TIMEOUT"
-#define LOGFILE "LOGFILE"
-#define STATSFILE "STATSFILE"
-
-//This function will read the config value to obtain the following:
-//Watchdog timeout value, name of log file, and name of stats file
-void readConfig(FILE* configfile, int* timeout, char* logfilename, char* statsfilename)
-{
-
-	//Create a buffer array for configuration file contents
-	char buffer[500];
-
-	//Assign timeout to be 0 for calculations
-	*timeout = 0;
-
-	//These will be character counters for arrays for logfilename and statsfilename
-	int logCounter = 0;
-	int statsCounter = 0;
-
-	//Character array 'evaluate' will store the string before every equal sign encountered.
-	//This array will then be used to assess which variable is being altered.
-	char evaluate[50];
-
-	//evalCounter will be character counter for the evaluate string
-	int evalCounter = 0;
-
-	typedef enum{START, NEW_LINE, GOT_HASH, GOT_CHAR, GOT_EQUAL, TIME_OUT, LOG_FILE, STATS_FILE, DONE}State;
-
-	//Initialize CONFIG_STATE to START
-	State CONFIG_STATE = START;
-
-	//Assign all contents of the configfile into the buffer array
-	//Exits loop once hits the end of the config file
-	//This is done so because in this function, the contents of the config file will
-	//be evaluated character by character
-	for(int i = 0; !feof(configfile); i++)
-	{
-		buffer[i] = fgetc(configfile);
-	}
-
-	//Following for loop will change values for timeout, logfilename, and statsfilename
-	//Increment i at the end of loop
-	//Exit loop after reached the DONE state
-	//Refer to Fig. 1 for corresponding State Machine
-	for(int i = 0; buffer[i] != 0; i++)
-	{
-		switch(CONFIG_STATE)
-		{
-			case START:
-				if(buffer[i] == '#')
-				{
-					CONFIG_STATE = GOT_HASH;
-				}
-				else if(buffer[i] == '\n')
-				{
-					CONFIG_STATE = NEW_LINE;
-				}
-				else if(buffer[i] != 0)
-				{
-					CONFIG_STATE = GOT_CHAR;
-
-					//Decrement i here to have buffer[i] remain at the character directly after the new line 
-					//for the next iteration through the switch statement
-					i--;
-				}
-				else if(buffer[i] == 0)
-				{
-					CONFIG_STATE = DONE;
-				}
-				break;
-
-			case NEW_LINE:
-				if(buffer[i] == '\n')
-				{
-					CONFIG_STATE = NEW_LINE;
-				}
-				else if(buffer[i] == '#')
-				{
-					CONFIG_STATE = GOT_HASH;
-				}
-				else if(buffer[i] != 0)
-				{
-					CONFIG_STATE = GOT_CHAR;
-
-					//Decrement i here to have buffer[i] remain at the character directly after the new line 
-					//for the next iteration through the switch statement
-					i--;
-				}
-				else if(buffer[i] == 0)
-				{					
-					CONFIG_STATE = DONE;
-				}
-				break;
-
-			case GOT_HASH:
-				if(buffer[i] == '\n')
-				{
-					CONFIG_STATE = NEW_LINE;
-				}
-				else if(buffer[i] != 0)
-				{
-					CONFIG_STATE = GOT_HASH;
-				}
-				else if(buffer[i] == 0)
-				{
-					CONFIG_STATE = DONE;
-				}
-				break;
-
-			case GOT_CHAR:
-				if(buffer[i] == '=')
-				{
-					CONFIG_STATE = GOT_EQUAL;
-
-					//Assign NULL value to end of evaluate string once all characters 
-					//before the equals sign have been evaluated
-					//This will represent the end of the array
-					evaluate[evalCounter] = 0;
-				}
-				else if(buffer[i] != 0)
-				{
-					CONFIG_STATE = GOT_CHAR;
-
-					//Store whatever is in the config file to the evaluate array
-					evaluate[evalCounter] = buffer[i];
-
-					//Increment the character counter for the evaluate array
-					evalCounter++;
-				}
-				else if(buffer[i] == 0)
-				{
-					CONFIG_STATE = DONE;
-				}
-				break;
-
-			case GOT_EQUAL:
-
-				//The following will evaluate which variable is currently being
-				//read from the buffer array
-				if(strcmp(evaluate, TIMEOUT) == 0)
-				{
-					CONFIG_STATE = TIME_OUT;
-				}
-				else if(strcmp(evaluate, LOGFILE) == 0)
-				{
-					CONFIG_STATE = LOG_FILE;
-				}
-				else if(strcmp(evaluate, STATSFILE) == 0)
-				{
-					CONFIG_STATE = STATS_FILE;
-				}
-				else if(buffer[i] == 0)
-				{
-					CONFIG_STATE = DONE;
-				}
-				else
-				{
-					CONFIG_STATE = DONE;
-
-					//If config file has been written improperly, assign garbage values to the variables
-					//Once evaluated by other functions, then the default values will be used instead
-					*timeout = -1;
-					strcpy(logfilename, "\0");
-					strcpy(statsfilename, "\0");
-				}
-				
-				//Decrement i here to have buffer[i] remain at the character directly after the new line 
-				//for the next iteration through the switch statement
-				i--;
-
-				//Reset the evalCounter for the next evaluation
-				evalCounter = 0;
-				
-				break;
-
-			case TIME_OUT:
-				if(buffer[i] >= '0' && buffer[i] <= '9')
-				{
-					CONFIG_STATE = TIME_OUT;
-
-					//Assign numerical value of buffer[i] to *timeout
-					*timeout = (*timeout * 10) + (buffer[i] - '0');
-				}
-				else if(buffer[i] == '\n')
-				{
-					CONFIG_STATE = NEW_LINE;
-				}
-				else if(buffer[i] == 0)
-				{
-					CONFIG_STATE = DONE;
-				}
-				break;
-
-			case LOG_FILE:
-				if(buffer[i] != 0 && buffer[i] != '\n')
-				{
-					CONFIG_STATE = LOG_FILE;
-
-					//Assign character in buffer[i] to logfilename[logCounter]
-					logfilename[logCounter] = buffer[i];
-
-					//Increment logCounter to get next array index in logfilename for the next character
-					logCounter++;
-				}
-				else if(buffer[i] == '\n')
-				{
-					CONFIG_STATE = NEW_LINE;
-
-					//Assign NULL value to the end of logfilename once all characters evaluated
-					//This represents the end of the array
-					logfilename[logCounter] = 0;
-				}
-				else if(buffer[i] == 0)
-				{
-					CONFIG_STATE = DONE;
-
-					//Assign NULL value to end of logfilename if file has ended here
-					//This represents the end of the array
-					logfilename[logCounter] = 0;
-				}
-				break;
-
-			case STATS_FILE:
-				if(buffer[i] != 0 && buffer[i] != '\n')
-				{
-					CONFIG_STATE = STATS_FILE;
-
-					//Assign character in buffer[i] to statsfilename[statsCounter]
-					statsfilename[statsCounter] = buffer[i];
-
-					//Increment statsCounter to get next array index in statsfilename for the next character
-					statsCounter++;
-				}
-				else if(buffer[i] == '\n')
-				{
-					CONFIG_STATE = NEW_LINE;
-
-					//Assign NULL value to the end of the statsfilename string once all characters evaluated
-					//This represents the end of the array
-					statsfilename[statsCounter] = 0;
-				}
-				else if(buffer[i] == 0)
-				{
-					//Since this is the last variable to be evaluated, hence only can go to the DONE state
-					CONFIG_STATE = DONE;
-
-					//Assign NULL value to the end of statsfilename string if file ends here
-					//This represents the end of the array
-					statsfilename[statsCounter] = '\0';
-				}
-				break;
-
-			case DONE:
-				break;
-
-			default:
-				break;
-		}	
-	}
-}
-
-//This function will get the current time using the gettimeofday function
+//This function will get the current time from the monotonic clock
+//The buffer is set to the current date, in a month, day, year format, and the current time in
+//24 hour notation followed by the microseconds
+//The date and time of day are formatted by localtime and strftime at most once per second
 void getTime(char* buffer)
 {
-	//Create a timeval struct named tv
-  	struct timeval tv;
-
-	//Create a time_t variable named curtime
-  	time_t curtime;
-
-	//Get the current time and store it in the tv struct
-  	gettimeofday(&tv, NULL); 
-
-	//Set curtime to be equal to the number of seconds in tv
-  	curtime=tv.tv_sec;
-
-	//This will set buffer to be equal to a string that in
-	//equivalent to the current date, in a month, day, year and
-	//the current time in 24 hour notation.
-  	strftime(buffer,30,"%m-%d-%Y  %T.\0",localtime(&curtime));
-}
-
-//This function will output messages to the stats file
-void outputStats(FILE* statsFile, int laser1Count, int laser2Count, int numberIn, int numberOut, char* Time, char* programName)
-{
-	//Initialize the following to store strings that will be printed onto the stats file
-	char strLaser1Count[50];
-	char strLaser2Count[50];
-	char strNumberIn[50];
-	char strNumberOut[50];
-
-	//Using the sprintf function, convert laser1Count, laser2Count, numberIn and numberOut from
-	//int variables to strings. This is done so that the final values can be passed into the
-	//PRINT_MSG function and printed onto the stats file properly.
-	sprintf(strLaser1Count, "Laser 1 was broken %d times\n\n", laser1Count);
-	sprintf(strLaser2Count, "Laser 2 was broken %d times\n\n", laser2Count);
-	sprintf(strNumberIn, "%d objects entered the room\n\n", numberIn);
-	sprintf(strNumberOut, "%d objects exitted the room\n\n", numberOut);
-
-	//Get current time
-	getTime(Time);
-
-	//Print to the statsfile all of the above defined strings in sequential order
-	PRINT_MSG(statsFile, Time, programName, strLaser1Count);
-	PRINT_MSG(statsFile, Time, programName, strLaser2Count);
-	PRINT_MSG(statsFile, Time, programName, strNumberIn);
-	PRINT_MSG(statsFile, Time, programName, strNumberOut);
+	static LaserTimeCache cache = {-1, ""};
+	laserFormatTime(&cache, laserMonotonicNs(), buffer);
 }
 
 //This function will check to see if the configuration file has correctly configured the address of the log file
@@ -348,8 +60,9 @@ void checkLogFile(char* logFileName, char* Time, char* programName)
 		direcLogFile[i] = logFileName[i];
 	}
 
-	//Create FILE pointer to the default log file and set to overwrite
-	FILE* defLogFile = fopen("/home/pi/Lab4Default.log", "w");
+	//Create FILE pointer to the default log file and set to append
+	//(the lines of the previous runs are kept: the log is rotated by size and age instead of being truncated)
+	FILE* defLogFile = fopen("/home/pi/Lab4Default.log", "a");
 
 	//Get current time
 	getTime(Time);
@@ -361,9 +74,9 @@ void checkLogFile(char* logFileName, char* Time, char* programName)
 		strcpy(logFileName, "/home/pi/Lab4Default.log");
 
 		//Initialize a file pointer 'logFile' to point to the determined log file.
-		//Set to overwrite the file so that any previous text would be erased before logging any information
+		//Set to append so that the lines of the previous runs are kept
 		//Fopen used so that if file does not exist, it will be created
-		FILE* logFile = fopen(logFileName, "w");
+		FILE* logFile = fopen(logFileName, "a");
 		
 		//If the timeout value is invalid, output a message to the log file
 		PRINT_MSG(logFile, Time, programName, "The log file directory is invalid: default log file has been opened.\n\n");
@@ -374,9 +87,9 @@ void checkLogFile(char* logFileName, char* Time, char* programName)
 	else
 	{
 		//Initialize a file pointer 'logFile' to point to the determined log file.
-		//Set to overwrite the file so that any previous text would be erased before logging any information
+		//Set to append so that the lines of the previous runs are kept
 		//Fopen used so that if file does not exist, it will be created
-		FILE* logFile = fopen(logFileName, "w");
+		FILE* logFile = fopen(logFileName, "a");
 
 		//Output an error message if the log file cannot be read
 		if(!logFile)
@@ -388,9 +101,9 @@ void checkLogFile(char* logFileName, char* Time, char* programName)
 			strcpy(logFileName, "/home/pi/Lab4Default.log");
 
 			//Initialize a file pointer 'logFile' to point to the determined log file.
-			//Set to overwrite the file so that any previous text would be erased before logging any information
+			//Set to append so that the lines of the previous runs are kept
 			//Fopen used so that if file does not exist, it will be created
-			FILE* logFile = fopen(logFileName, "w");
+			FILE* logFile = fopen(logFileName, "a");
 			
 			//If the timeout value is invalid, output a message to the log file
 			PRINT_MSG(logFile, Time, programName, "The log file cannot be opened: default log file has been opened.\n\n");
@@ -443,9 +156,9 @@ void checkStatsFile(FILE* logFile, char* logFileName, char* statsFileName, char*
 		strcpy(statsFileName, "/home/pi/Lab4Default.stats");
 
 		//Initialize a file pointer 'statsFile' to point to the determined stats file. 
-		//Set to overwrite the file so that any previous text would be erased before printing any information into the file
+		//Set to append so that the counts checkpointed by the previous run are kept and restored
 		//Fopen used so that if file does not exist, it will be created
-		FILE* statsFile = fopen(statsFileName, "w");
+		FILE* statsFile = fopen(statsFileName, "a");
 		
 		//If the stats file directory is invalid, output a message to the log file
 		PRINT_MSG(logFile, Time, programName, "Stats file directory is invalid: default stats file has been opened instead.\n\n");
@@ -463,9 +176,9 @@ void checkStatsFile(FILE* logFile, char* logFileName, char* statsFileName, char*
 	else
 	{
 		//Initialize a file pointer 'statsFile' to point to the determined log file.
-		//Set to overwrite the file so that any previous text would be erased before logging any information
+		//Set to append so that the counts checkpointed by the previous run are kept and restored
 		//Fopen used so that if file does not exist, it will be created
-		FILE* statsFile = fopen(statsFileName, "w");
+		FILE* statsFile = fopen(statsFileName, "a");
 
 		//Output an error message if the stats file cannot be read
 		if(!statsFile)
@@ -477,9 +190,9 @@ void checkStatsFile(FILE* logFile, char* logFileName, char* statsFileName, char*
 			strcpy(statsFileName, "/home/pi/Lab4Default.stats");
 
 			//Initialize a file pointer 'statsFile' to point to the determined stats file.
-			//Set to overwrite the file so that any previous text would be erased before logging any information
+			//Set to append so that the counts checkpointed by the previous run are kept and restored
 			//Fopen used so that if file does not exist, it will be created
-			FILE* statsFile = fopen(statsFileName, "w");
+			FILE* statsFile = fopen(statsFileName, "a");
 			
 			//If the timeout value is invalid, output a message to the log file
 			PRINT_MSG(logFile, Time, programName, "Stats file cannot be opened: default stats file has been opened instead.\n\n");
@@ -564,7 +277,7 @@ GPIO_Handle initializeGPIO()
 	return gpio;
 }
 
-//This is a helper function used in the laserDiodeStatus function.
+//This is a helper function giving the pins of the default doorway, used when the config file has no DOORWAY line.
 //It passes in the number photodiode being evaluated (1 or 2)
 //It returns the value of the gpio pin corresponding to the photodiode number plugged into it
 int pinNumberPhotoDiode(int diodeNumber)
@@ -586,97 +299,319 @@ int pinNumberPhotoDiode(int diodeNumber)
 	}
 }
 
-//This function accepts the photodiode number (1 or 2) and outputs
-// 0 if the laser beam is not reaching the diode, 1 if the laser
-//beam is reaching the diode or -1 if an error occurs.
-int laserDiodeStatus(GPIO_Handle gpio, int diodeNumber)
+//Posted by the SIGHUP handler (sem_post is async-signal-safe) to wake the reload thread
+static sem_t reloadWakeup;
+
+void requestReload(int signal)
 {
-	//Returns -1 if the gpio is invalid
-	if(gpio == NULL)
-	{
-		return -1;
-	}
+	(void)signal;
+	sem_post(&reloadWakeup);
+}
 
-	//Uses helper function 'pinNumberPhotoDiode' to find the GPIO pin number being evaluated
-	int PIN_NUM = pinNumberPhotoDiode(diodeNumber);
+//A config file read again by the reload thread, waiting to be applied by the sensing loop
+//The reload thread only writes fresh while pending is 0; the sensing loop only reads it while pending is 1
+typedef struct
+{
+	const char* configPath;
+	const LaserConfig* config;
+	LaserLog* log;
+	LaserConfig fresh;
+	atomic_int pending;
+} ConfigReload;
+
+//Reload thread: reads the config file after every SIGHUP and hands the result to the sensing loop
+//The file is read with stdio, and the restart-only settings compared and logged, here rather than on the
+//sensing thread, which may run at a real-time priority: the sensing loop only copies the new values in
+static void* reloadThread(void* arg)
+{
+	ConfigReload* reload = arg;
+	static LaserConfig parsed;
 
-	if(diodeNumber == 1 || diodeNumber == 2)
+	while(1)
 	{
-		//Create an unsigned int of size 32 bits 'level-reg' and assigns value of the photodiode at this moment
-		uint32_t level_reg = gpiolib_read_reg(gpio, GPLEV(0));
+		while(sem_wait(&reloadWakeup) < 0 && errno == EINTR)
+		{
+		}
 
-		//Returns 1 if laser beam reaches the photodiode
-		//Returns 0 if laser beam does not reach the photodiode
-		if(level_reg & (1 << PIN_NUM))
+		int errors = laserConfigLoad(&parsed, reload->configPath);
+		uint64_t nowNs = laserMonotonicNs();
+		if(errors < 0)
 		{
-			return 1;
+			LOG_MSG(reload->log, LOG_SINK_LOG, nowNs, "The config file could not be reloaded: the previous settings are kept.\n\n");
+			continue;
 		}
-		else
+
+		//Let the sensing loop finish applying the previous file: until then it may still be changing the running settings
+		while(atomic_load_explicit(&reload->pending, memory_order_acquire))
 		{
-			return 0;
+			usleep(10000);
 		}
+
+		if(errors > 0)
+		{
+			laserLogPost(reload->log, LOG_SINK_LOG, nowNs, -1,
+			             "The config file has %ld invalid lines: default values are used for them.\n\n", errors, 0, 0, 0);
+		}
+
+		const LaserConfig* config = reload->config;
+		if(parsed.timeout != config->timeout || parsed.watchdogKicks != config->watchdogKicks ||
+		   strcmp(parsed.logFileName, config->logFileName) != 0 || strcmp(parsed.statsFileName, config->statsFileName) != 0 ||
+		   parsed.logSegmentKb != config->logSegmentKb || parsed.logSegmentHours != config->logSegmentHours ||
+		   parsed.logSegments != config->logSegments || parsed.logCompress != config->logCompress ||
+		   strcmp(parsed.traceFileName, config->traceFileName) != 0 ||
+		   strcmp(parsed.captureFileName, config->captureFileName) != 0 ||
+		   strcmp(parsed.rollupFileName, config->rollupFileName) != 0 ||
+		   strcmp(parsed.archiveDirectory, config->archiveDirectory) != 0 || parsed.numDoorways != config->numDoorways ||
+		   memcmp(parsed.doorwayPins, config->doorwayPins, sizeof(parsed.doorwayPins)) != 0 ||
+		   parsed.rtPriority != config->rtPriority || parsed.rtCpu != config->rtCpu ||
+		   (parsed.beamSpacingMm != 0) != (config->beamSpacingMm != 0) || parsed.trackCrossings != config->trackCrossings ||
+		   strcmp(parsed.fleetAddress, config->fleetAddress) != 0 || parsed.fleetId != config->fleetId)
+		{
+			LOG_MSG(reload->log, LOG_SINK_LOG, nowNs, "The doorways, files, watchdog, real-time and fleet settings of the config file take effect after a restart.\n\n");
+		}
+
+		reload->fresh = parsed;
+		atomic_store_explicit(&reload->pending, 1, memory_order_release);
+		LOG_MSG(reload->log, LOG_SINK_LOG, nowNs, "The config file has been reloaded.\n\n");
 	}
-	//Returns -1 if the diodeNumber is neither 1 or 2 (i.e. an error has occured)
-	else
+	return NULL;
+}
+
+//This function applies the settings of a reloaded config file that can change while counting:
+//the debounce times, how the log is written, the latency budget, the polling bound and the beam spacing.
+//The counts and the state machines are kept
+//It runs on the sensing thread, between two samples, and only copies values
+void applyConfig(const LaserConfig* fresh, LaserConfig* config, LaserCounter* counter, LaserLog* log)
+{
+	laserFilterConfigure(&counter->filter, fresh->debounceUs, fresh->hysteresisUs);
+	laserLogConfigure(log, fresh->logFlushMs, fresh->logDurability);
+	config->debounceUs = fresh->debounceUs;
+	config->hysteresisUs = fresh->hysteresisUs;
+	config->logFlushMs = fresh->logFlushMs;
+	config->logDurability = fresh->logDurability;
+	config->latencyBudgetUs = fresh->latencyBudgetUs;
+	config->pollMaxLatencyUs = fresh->pollMaxLatencyUs;
+
+	//The beam spacing can change, but turning the analytics on or off needs a restart
+	if(counter->analytics != NULL && fresh->beamSpacingMm != 0)
 	{
-		return -1;
+		counter->analytics->spacingMm = fresh->beamSpacingMm;
+		config->beamSpacingMm = fresh->beamSpacingMm;
 	}
 }
 
-int main(const int argc, const char* const argv[])
+//This function prints the four stats lines of one set of counts, in the layout of the old stats file
+//When doorway is not -1, the lines are prefixed with the doorway number
+void printCounts(FILE* file, char* Time, char* programName, int doorway, const LaserCounts* counts)
 {
+	char prefix[24] = "";
+	if(doorway >= 0)
+	{
+		snprintf(prefix, sizeof(prefix), "Doorway %d: ", doorway + 1);
+	}
 
-	//Create a character array that points to the command line
-	const char* argName = argv[0];
+	fprintf(file, "%s : %s : %sLaser 1 was broken %d times\n\n", Time, programName, prefix, counts->laser1Count);
+	fprintf(file, "%s : %s : %sLaser 2 was broken %d times\n\n", Time, programName, prefix, counts->laser2Count);
+	fprintf(file, "%s : %s : %s%d objects entered the room\n\n", Time, programName, prefix, counts->numberIn);
+	fprintf(file, "%s : %s : %s%d objects exitted the room\n\n", Time, programName, prefix, counts->numberOut);
+}
 
-	//Create variable to determine the length of the program's name
-	int nameLength = 0;
+//This function re-counts a recorded trace or capture ring instead of reading the GPIO, as fast as the CPU allows
+//The same filter, state machines and messages as the sensing loop are used: the log lines go to stdout
+//(unless quiet is set) and are followed by the final counts, in the layout of the stats file
+//Returns 0, or -1 if the file cannot be read or the recorded run did not start with both lasers unbroken
+int replayTrace(const char* tracePath, char* programName, LaserCounter* counter, int quiet)
+{
+	//The file is either a trace (-t) or a capture ring (-e)
+	LaserTrace trace = {NULL, NULL, 0, 0};
+	LaserCapture capture = {NULL, NULL, 0, NULL, 0, 0};
+	if(laserTraceMap(&trace, tracePath) < 0 && laserCaptureMap(&capture, tracePath) < 0)
+	{
+		perror("The trace file could not be opened");
+		return -1;
+	}
 
-	//Find the length of the program name without the /home/pi/ at the start of argv[0]
-	for(int i = 0; argName[i+9] != 0; i++)
+	//The writer may not drop any line, the replay waits for it instead
+	static LaserLog log;
+	if(!quiet)
 	{
-		nameLength++;
+		if(laserLogStart(&log, stdout, programName, LOG_FLUSH_INTERVAL_MS, LOG_LOSSLESS) < 0)
+		{
+			perror("The log writer could not be started.");
+			return -1;
+		}
+		counter->log = &log;
 	}
+	counter->stats = NULL;
 
-	//Create an array to store the program name
-	char programName[nameLength];
+	LaserReplay replay = {0, 0, 0, 0};
+	uint64_t start = laserMonotonicNs();
+	long replayed = (trace.header != NULL) ? laserTraceReplay(&trace, counter, &replay) :
+	                                         laserCaptureReplay(&capture, counter, &replay);
+	uint64_t elapsed = laserMonotonicNs() - start;
+
+	if(!quiet)
+	{
+		laserLogStop(&log);
+	}
+	laserTraceUnmap(&trace);
+	laserCaptureClose(&capture);
 
-	//Copy the name of the program without the "/home/pi/"" at the start of argv[0]
-	for(int i = 0; i <= nameLength; i++)
+	//Same rule as the sensing loop: the recorded run must begin with both lasers of every doorway unbroken
+	if(replayed < 0)
 	{
-		//Assign the 'i+1'th value from argName to programName
-		//This avoids putting the period into the programName array
-		programName[i] = argName[i + 9];
+		fprintf(stderr, "Must start with both lasers unbroken: the trace was not counted.\n");
+		return -1;
+	}
 
-		//Assign the NULL terminator to the index directly after the last character of the programName
-		programName[i+1] = '\0';
+	//Print the totals, followed by each doorway when there is more than one
+	char Time[LASER_TIME_LEN];
+	LaserTimeCache cache = {-1, ""};
+	laserFormatTime(&cache, replay.lastNs, Time);
 
+	LaserCounts totals = {0, 0, 0, 0};
+	for(int i = 0; i < counter->numDoorways; i++)
+	{
+		totals.laser1Count += counter->doorways[i].counts.laser1Count;
+		totals.laser2Count += counter->doorways[i].counts.laser2Count;
+		totals.numberIn += counter->doorways[i].counts.numberIn;
+		totals.numberOut += counter->doorways[i].counts.numberOut;
+	}
+	printCounts(stdout, Time, programName, -1, &totals);
+	for(int i = 0; counter->numDoorways > 1 && i < counter->numDoorways; i++)
+	{
+		printCounts(stdout, Time, programName, i, &counter->doorways[i].counts);
 	}
 
-	//Initialize a file pointer 'configFile' to point to Lab4.cfg. Set to read the file.
-	FILE* configFile = fopen("/home/pi/Lab4.cfg", "r");
+	fprintf(stderr, "Replayed %ld changes in %.3f s (%.0f changes/s)\n", replayed, elapsed / 1e9,
+	        replayed * 1e9 / (elapsed ? elapsed : 1));
 
-	//Output an error message if Lab4.cfg cannot be read
-	if(!configFile)
+	//Summarise the timing of the crossings of each doorway
+	const LaserAnalytics* analytics = counter->analytics;
+	for(int i = 0; analytics != NULL && i < analytics->numDoorways; i++)
+	{
+		const LaserDoorwayAnalytics* timing = &analytics->doorways[i];
+		unsigned long in = atomic_load(&timing->crossings[CROSSING_IN]);
+		unsigned long out = atomic_load(&timing->crossings[CROSSING_OUT]);
+		unsigned long abandoned = atomic_load(&timing->crossings[CROSSING_ABANDONED]);
+		unsigned long counted = in + out;
+		unsigned long all = counted + abandoned;
+		fprintf(stderr, "Doorway %d: %lu in, %lu out, %lu abandoned, mean speed %.2f m/s, mean dwell %.3f s\n", i + 1,
+		        in, out, abandoned, counted ? atomic_load(&timing->speedSumMmS) / 1e3 / counted : 0.0,
+		        all ? atomic_load(&timing->dwellSumUs) / 1e6 / all : 0.0);
+	}
+	return 0;
+}
+
+int main(const int argc, const char* const argv[])
+{
+
+	//Record the offset between the wall clock and the monotonic clock used to stamp events
+	laserTimeInit();
+
+	//The program name is argv[0] without its directory (e.g. without the "/home/pi/" it is normally run from)
+	const char* argName = strrchr(argv[0], '/');
+	argName = (argName != NULL) ? argName + 1 : argv[0];
+
+	//Create an array to store the program name
+	char programName[64];
+	snprintf(programName, sizeof(programName), "%s", argName);
+
+	//Read the command line options:
+	//-r <trace> re-counts a recorded trace instead of reading the GPIO, -q leaves the log lines out of the replay
+	//-t <trace> records every beam change of the live run into a trace file
+	//-e <ring> captures every raw edge of the live run into a fixed-size ring file that keeps the most recent edges
+	//-c <config> reads another config file than /home/pi/Lab4.cfg
+	const char* configPath = CONFIG_PATH;
+	const char* replayPath = NULL;
+	const char* tracePath = NULL;
+	const char* capturePath = NULL;
+	int quiet = 0;
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+		{
+			replayPath = argv[++i];
+		}
+		else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+		{
+			tracePath = argv[++i];
+		}
+		else if(strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+		{
+			capturePath = argv[++i];
+		}
+		else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+		{
+			configPath = argv[++i];
+		}
+		else if(strcmp(argv[i], "-q") == 0)
+		{
+			quiet = 1;
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [-c <config file>] [-t <trace file>] [-e <capture file>] [-r <trace or capture file> [-q]]\n", programName);
+			return -1;
+		}
+	}
+
+	//Read the config file over the default settings
+	static LaserConfig config;
+	int configErrors = laserConfigLoad(&config, configPath);
+
+	//Output an error message if the config file cannot be read
+	//A replay does not need it: without it the default doorway is counted
+	if(configErrors < 0 && replayPath == NULL)
 	{
 		perror("The config file could not be opened");
 		return -1;
 	}
 
 	//Create watchdog time out (timeOut), name of log file (logFileName), and name of stats file (statsFileName)
-	//Set all these variables to their default values
-	int timeOut = 10;
-	char logFileName[50] = "/home/pi/Lab4Default.log\0";
-	char statsFileName[50] = "/home/pi/Lab4Default.stats\0";
+	//from the values read in the config file (the checks below replace invalid ones with the defaults)
+	int timeOut = config.timeout;
+	char logFileName[CONFIG_NAME_MAX];
+	char statsFileName[CONFIG_NAME_MAX];
+	strcpy(logFileName, config.logFileName);
+	strcpy(statsFileName, config.statsFileName);
+
+	//Create the sensor array, which holds every doorway to count
+	//A doorway with invalid or repeated pins is ignored
+	static LaserCounter counter;
+	for(int i = 0; i < config.numDoorways; i++)
+	{
+		laserCounterAddDoorway(&counter, config.doorwayPins[i][0], config.doorwayPins[i][1]);
+	}
+
+	//If the config file has no (valid) DOORWAY line, count the single doorway on the default pins
+	if(counter.numDoorways == 0)
+	{
+		laserCounterAddDoorway(&counter, pinNumberPhotoDiode(1), pinNumberPhotoDiode(2));
+	}
+
+	//Debounce the beams: a change must hold for the stable time before the state machines see it
+	laserFilterConfigure(&counter.filter, config.debounceUs, config.hysteresisUs);
+
+	//Count in and out with the crossing trackers, which tell apart objects following each other through a doorway
+	counter.tracking = config.trackCrossings;
 
-	//Read the config file and assign values to timeOut, logFileName and statsFileName found in the config file
-	readConfig(configFile, &timeOut, logFileName, statsFileName);
+	//Given the spacing of the beams, time the phases and the speed of every crossing
+	static LaserAnalytics analytics;
+	if(config.beamSpacingMm != 0)
+	{
+		laserAnalyticsInit(&analytics, config.beamSpacingMm, counter.numDoorways);
+		counter.analytics = &analytics;
+	}
 
-	//Close the config file
-	fclose(configFile);
+	//In replay mode the recorded trace is counted instead of the GPIO, and nothing else is touched
+	if(replayPath != NULL)
+	{
+		return replayTrace(replayPath, programName, &counter, quiet);
+	}
 
 	//Create a character array to hold the current time
-	char Time[30];
+	char Time[LASER_TIME_LEN];
 
 	//Call the function to check if the log file has been correctly configured
 	//If not, it will assign a default address to logFileName
@@ -685,12 +620,79 @@ int main(const int argc, const char* const argv[])
 	//Before proceeding, we only want to append to the log file
 	FILE* logFile = fopen(logFileName, "a");
 
+	//In real-time mode, keep the CPU of the sensing loop free of the threads started from here on
+	//(the log writer, the stats sync, the watchdog keepalive and the metrics server)
+	int rtReserved = 0;
+	if(config.rtPriority > 0 && config.rtCpu >= 0)
+	{
+		rtReserved = (laserRtReserve(config.rtCpu) == 0);
+	}
+
 	//Call the function to check if the stats file has been correctly configured
 	//If not, it will assign a default address to statsFileName
 	checkStatsFile(logFile, logFileName, statsFileName, Time, programName);
 
-	//Before proceeding, we only want to append to the stats file
-	FILE* statsFile = fopen(statsFileName, "a");
+
+	//Map the stats file
+	//It has a constant size: the counts are updated in place and the journal wraps around
+	static LaserStats stats;
+	if(laserStatsOpen(&stats, statsFileName, programName, counter.numDoorways, STATS_JOURNAL_RECORDS) < 0)
+	{
+		getTime(Time);
+		PRINT_MSG(logFile, Time, programName, "The stats file could not be mapped.\n\n");
+		perror("The stats file could not be mapped.");
+		return -1;
+	}
+
+	//Carry on counting from the checkpoint of the previous run (e.g. before a watchdog reset)
+	getTime(Time);
+	if(stats.restored)
+	{
+		for(int i = 0; i < counter.numDoorways; i++)
+		{
+			counter.doorways[i].counts = stats.header->doorways[i];
+		}
+		PRINT_MSG(logFile, Time, programName, "The counts of the previous run have been restored.\n\n");
+	}
+
+	//Keep the minute, hour and day history of the counts in the rollup file, carrying on from the restored counts
+	static LaserRollup rollup;
+	if(config.rollupFileName[0] != 0)
+	{
+		int occupancy = 0;
+		for(int i = 0; i < counter.numDoorways; i++)
+		{
+			occupancy += counter.doorways[i].counts.numberIn - counter.doorways[i].counts.numberOut;
+		}
+		if(laserRollupOpen(&rollup, config.rollupFileName, occupancy) < 0)
+		{
+			PRINT_MSG(logFile, Time, programName, "The rollup file could not be mapped: no history is kept.\n\n");
+		}
+		else
+		{
+			counter.rollup = &rollup;
+		}
+	}
+
+	//Archive every crossing in the segments of the archive directory
+	static LaserArchive archive;
+	if(config.archiveDirectory[0] != 0)
+	{
+		if(laserArchiveOpen(&archive, config.archiveDirectory) < 0)
+		{
+			PRINT_MSG(logFile, Time, programName, "The archive could not be opened: the crossings are not archived.\n\n");
+		}
+		else
+		{
+			counter.archive = &archive;
+		}
+	}
+
+	//Write every checkpoint through to the disk from a background thread
+	if(laserStatsStartSync(&stats) < 0)
+	{
+		PRINT_MSG(logFile, Time, programName, "The stats sync could not be started: checkpoints may be lost on a reset.\n\n");
+	}
 
 	//Call the function to check if the timeout value is valid or not
 	//If not, it will assign the default value of 10 secs to timeout
@@ -713,6 +715,24 @@ int main(const int argc, const char* const argv[])
 	//If the GPIO pins have been initialized, print a message to the log file
 	PRINT_MSG(logFile, Time, programName, "The GPIO pins have been initialized.\n\n");
 
+	//Request edge events on every photodiode pin so that the state machines only wake when a beam changes
+	//If the GPIO character device is not available, fall back to polling the level register
+	int eventPins[2 * LASER_MAX_DOORWAYS];
+	int numPins = laserCounterPins(&counter, eventPins);
+	GPIO_Events* events = gpiolib_init_events(programName, eventPins, numPins);
+
+	//Get current time
+	getTime(Time);
+
+	if(events != NULL)
+	{
+		PRINT_MSG(logFile, Time, programName, "GPIO edge events enabled: waiting for beam changes.\n\n");
+	}
+	else
+	{
+		PRINT_MSG(logFile, Time, programName, "GPIO edge events unavailable: polling the photodiodes instead.\n\n");
+	}
+
 	//Get current time
 	getTime(Time);
 
@@ -748,312 +768,432 @@ int main(const int argc, const char* const argv[])
 	//Change watchdog timer value to value of timeOut as read in the config file
 	ioctl(watchdog, WDIOC_GETTIMEOUT, &timeOut);
 
-	//Create the states that will be used in the state machine
-	typedef enum{START, ONLY_LASER1_BROKEN, ONLY_LASER2_BROKEN, BOTH_BROKEN, BOTH_UNBROKEN, DONE}State;
-
-	//Initialize LASER_STATE to START
-	State LASER_STATE = START;
-
-	//Following variables will be used in the switch statement to determine whether or not laser1 or laser2 has
-	//already previously broken.
-	int laser1HasBroken = 0;
-	int laser2HasBroken = 0;
-
-	//Following variables will be used for the outputStats function defined above
-	int laser1Count = 0;
-	int laser2Count = 0;
-	int numberIn = 0;
-	int numberOut = 0;
-
-	//Output statistics to stats file for the initial count
-	outputStats(statsFile, laser1Count, laser2Count, numberIn, numberOut, Time, programName);
-
-	//Initialize a variable representing the total number of CPU clock ticks within the watchdog timeout
-	int totalTicks = CLOCKS_PER_SEC*timeOut;
-
-	//Calculate a fifteenth of the totalTicks
-	//This will be used to determine when to kick the watchdog
-	//(i.e. the watchdog will be kicked every fifteenth of the timeOut)
-	long int ticksInterval = totalTicks/15;
+	//Start the log writer thread
+	//From here on, messages are queued and written in batches instead of being flushed one by one
+	static LaserLog log;
 
-	//Initialize a constant to represent the time taken from the beginning of the program till now
-	const clock_t ticksInitial = clock();
+	//The writer thread also rotates the log file into preallocated segments of bounded size and age
+	static LaserRotate rotate;
+	if(config.logSegmentKb > 0 &&
+	   laserRotateStart(&rotate, logFile, logFileName, (uint64_t)config.logSegmentKb * 1024,
+	                    config.logSegmentHours * 3600, config.logSegments, config.logCompress) == 0)
+	{
+		log.rotate = &rotate;
+	}
+	if(laserLogStart(&log, logFile, programName, config.logFlushMs, config.logDurability) < 0)
+	{
+		PRINT_MSG(logFile, Time, programName, "The log writer could not be started.\n\n");
+		perror("The log writer could not be started.");
+		return -1;
+	}
 
-	//Calculate the amount of ticks elapsed since ticksInitial
-	clock_t ticksElapsed = clock() - ticksInitial;
+	//Log the lines of the config file that were not understood
+	if(configErrors > 0)
+	{
+		laserLogPost(&log, LOG_SINK_LOG, laserMonotonicNs(), -1,
+		             "The config file has %ld invalid lines: default values are used for them.\n\n", configErrors, 0, 0, 0);
+	}
+	if(config.unknown > 0)
+	{
+		laserLogPost(&log, LOG_SINK_LOG, laserMonotonicNs(), -1,
+		             "The config file has %ld unknown keys: they are ignored.\n\n", config.unknown, 0, 0, 0);
+	}
 
-	//Continue in while loop indefinitely (so long as the watchdog is kicked)
-	//Exit the loop only if the program is forced to terminate
-	while(1)
+	//Start the keepalive thread
+	//It kicks the watchdog on elapsed time, independently of the sensing loop, as long as the loop keeps reporting a heartbeat
+	static LaserWatchdog keepalive;
+	if(laserWatchdogStart(&keepalive, watchdog, timeOut, config.watchdogKicks, &log) < 0)
 	{
+		PRINT_MSG(logFile, Time, programName, "The watchdog keepalive could not be started.\n\n");
+		perror("The watchdog keepalive could not be started.");
+		return -1;
+	}
 
-		//See Fig. 2 for the corresponding state machine
-		switch(LASER_STATE)
+	//Instrument the sensing loop and serve the metrics on the Unix socket named in the config file
+	static LaserLoopMetrics loopMetrics;
+	static LaserMetrics metrics;
+	int metricsStarted = 0;
+	counter.metrics = &loopMetrics;
+	if(config.metricsSocket[0] != 0)
+	{
+		metrics.loop = &loopMetrics;
+		metrics.log = &log;
+		metrics.watchdog = &keepalive;
+		metrics.filter = &counter.filter;
+		metrics.analytics = counter.analytics;
+		for(int i = 0; counter.tracking && i < counter.numDoorways; i++)
 		{
+			metrics.trackers[metrics.numTrackers++] = &counter.doorways[i].tracker;
+		}
+		metricsStarted = (laserMetricsStart(&metrics, config.metricsSocket) == 0);
+		if(!metricsStarted)
+		{
+			LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(), "The metrics socket could not be opened: the metrics are not served.\n\n");
+		}
+	}
 
-			case START:
-				//The following restriction was made here:
-				//The program must begin with both lasers unbroken
-				
-				if(laserDiodeStatus(gpio, 1) == 1 && laserDiodeStatus(gpio, 2) == 1)
-				{
-					LASER_STATE = BOTH_UNBROKEN;
+	//The sensing loop never blocks for longer than half the time the keepalive allows between heartbeats
+	int waitLimitMs = (int)(keepalive.stallNs / 2000000);
 
-					//Get current time
-					getTime(Time);
+	//Every doorway starts in the START state, with neither laser broken yet
+	//The state machine itself is the transition table in laser_fsm.c (see Fig. 2)
+	counter.log = &log;
+	counter.stats = &stats;
 
-					//If both lasers unbroken, output a message to the log file that the program has started
-					PRINT_MSG(logFile, Time, programName, "Both lasers unbroken: program successfully started.\n\n");
-				}
-				else
-				{
-					//If both lasers begin as not unbroken, then exit the program and output an error message to the screen & log file
-					
-					//Get current time
-					getTime(Time);
-
-					//Print a message to the screen to notify the user why the program has not started
-					perror("Must start with both lasers unbroken: exiting program.\n");
-
-					//Output a message to the log file that the program has unsuccessfully started
-					PRINT_MSG(logFile, Time, programName, "Must start with both lasers unbroken: exiting program.\n\n");
-					
-					//Write 'V' to the watchdog file to disable it
-					write(watchdog, "V", 1);
-					
-					//Get current time
-					getTime(Time);
-					
-					//Log that the watchdog was disabled
-					PRINT_MSG(logFile, Time, programName, "The watchdog was disabled. \n\n");
-
-					//Close the watchdog file
-					close(watchdog);
-
-					//Get current time
-					getTime(Time);
-
-					//Log that the watchdog was closed
-					PRINT_MSG(logFile, Time, programName, "The watchdog was closed. \n\n");
-
-					//Free the gpio pins
-					gpiolib_free_gpio(gpio);
-
-					//Get current time
-					getTime(Time);
-
-					//Log that the GPIO pins are freed
-					PRINT_MSG(logFile, Time, programName, "The GPIO pins have been freed. \n\n");
-
-					//Return negative value to indicate an error has occured
-					return -1;
-				}
-				break;
+	//Publish the live state of every doorway in shared memory for the local readers (see laser_shm.h)
+	static LaserShm shm;
+	if(laserShmCreate(&shm, SHM_NAME, programName, counter.numDoorways) < 0)
+	{
+		LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(), "The shared memory state could not be created: it is not published.\n\n");
+	}
+	else
+	{
+		counter.shm = &shm;
+		laserCounterPublish(&counter, laserMonotonicNs());
+	}
 
-			case BOTH_UNBROKEN:
+	//Timestamp of the last GPIO edge, used by the filter to time changes from the edge rather than the sample
+	uint64_t edgeTimestamp = 0;
 
-				//Once in this state, reassign 0 to the following variables to indicate that both lasers are now unbroken again
-				laser1HasBroken = 0;
-				laser2HasBroken = 0;
+	//Time of the previous sample and how long the loop waited for edges since, to measure the busy time
+	uint64_t previousSampleNs = 0;
+	uint64_t waitedNs = 0;
 
-				if(laserDiodeStatus(gpio, 1) == 1 && laserDiodeStatus(gpio, 2) ==1)
-				{
-					LASER_STATE = BOTH_UNBROKEN;
-				}
-				else if(laserDiodeStatus(gpio, 1)== 1 && laserDiodeStatus(gpio, 2)==0)
-				{
-					LASER_STATE = ONLY_LASER2_BROKEN;
+	//The command line options take precedence over the output files named in the config file
+	if(tracePath == NULL && config.traceFileName[0] != 0)
+	{
+		tracePath = config.traceFileName;
+	}
+	if(capturePath == NULL && config.captureFileName[0] != 0)
+	{
+		capturePath = config.captureFileName;
+	}
 
-					//If only laser 2 has broken, increment the number of times laser 2 has broken
-					laser2Count++;
+	//If asked to, record every change of the beams so that the run can be replayed later
+	static LaserTraceWriter trace;
+	if(tracePath != NULL)
+	{
+		uint32_t pinMask = counter.filter.pinMask;
+		if(laserTraceCreate(&trace, tracePath, pinMask) < 0)
+		{
+			LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(), "The trace file could not be created: the beams are not recorded.\n\n");
+		}
+		else
+		{
+			LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(), "The trace file has been opened.\n\n");
+		}
+	}
 
-					//Assign 1 to laser2HasBroken to indicate that laser 2 has been broken now
-					laser2HasBroken = 1;
+	//If asked to, capture every raw edge of the beams into the ring file
+	static LaserCapture capture;
+	if(capturePath != NULL)
+	{
+		if(laserCaptureOpen(&capture, capturePath, counter.filter.pinMask, CAPTURE_BLOCKS) < 0)
+		{
+			LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(), "The capture file could not be mapped: the edges are not captured.\n\n");
+		}
+		else
+		{
+			LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(), "The capture file has been mapped.\n\n");
+		}
+	}
 
-					//Get current time
-					getTime(Time);
+	//Read the config file again whenever the process receives a SIGHUP, on a thread of its own
+	//It is started before the sensing loop enters real-time mode, so it keeps the normal scheduling
+	static ConfigReload reload;
+	reload.configPath = configPath;
+	reload.config = &config;
+	reload.log = &log;
+	atomic_init(&reload.pending, 0);
+	sem_init(&reloadWakeup, 0, 0);
+	pthread_t reloader;
+	if(pthread_create(&reloader, NULL, reloadThread, &reload) == 0)
+	{
+		pthread_detach(reloader);
+	}
+	else
+	{
+		LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(), "The reload thread could not be started: a SIGHUP does not reload the config file.\n\n");
+	}
 
-					//Output message into log file that laser 2 has been broken
-					PRINT_MSG(logFile, Time, programName, "Laser 2 has been broken.\n\n");
+	struct sigaction hangup;
+	memset(&hangup, 0, sizeof(hangup));
+	hangup.sa_handler = requestReload;
+	sigemptyset(&hangup.sa_mask);
+	sigaction(SIGHUP, &hangup, NULL);
 
-					//Output statistics to stats file to update counts
-					outputStats(statsFile, laser1Count, laser2Count, numberIn, numberOut, Time, programName);
+	//Output statistics to stats file for the initial count
+	laserStatsUpdate(&stats, -1, NULL, 0, laserWallNs(laserMonotonicNs()));
 
-				}
-				else if(laserDiodeStatus(gpio, 1)== 0 && laserDiodeStatus(gpio, 2)==1)
-				{					
-					LASER_STATE = ONLY_LASER1_BROKEN;
+	//Send the counts to the fleet aggregator, starting with the current counts of every doorway
+	//(without a FLEET_ID the counter is numbered by its host id)
+	static LaserFleet fleet;
+	if(config.fleetAddress[0] != 0)
+	{
+		uint32_t fleetId = (config.fleetId != 0) ? config.fleetId : (uint32_t)gethostid();
+		if(laserFleetStart(&fleet, config.fleetAddress, fleetId, counter.numDoorways) < 0)
+		{
+			LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(), "The fleet address is invalid: the counts are not sent to the aggregator.\n\n");
+		}
+		else
+		{
+			counter.fleet = &fleet;
+			if(fleet.lookupFailed)
+			{
+				LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(),
+				        "The fleet aggregator host cannot be looked up yet: it is looked up again at every snapshot.\n\n");
+			}
+			for(int i = 0; i < counter.numDoorways; i++)
+			{
+				laserFleetPost(&fleet, i, 0, &counter.doorways[i].counts, laserWallNs(laserMonotonicNs()));
+			}
+			laserLogPost(&log, LOG_SINK_LOG, laserMonotonicNs(), -1,
+			             "The counts are sent to the fleet aggregator as counter %ld.\n\n", (long)fleetId, 0, 0, 0);
+		}
+	}
 
-					//If only laser 1 has broken, increment the number of times laser 1 has broken
-					laser1Count++;
+	//In real-time mode the sensing loop runs under SCHED_FIFO with every page locked, once the other threads are started
+	//It needs the edge events: a polling loop at a real-time priority would never let the other threads run
+	int realTime = 0;
+	if(config.rtPriority > 0 && events == NULL)
+	{
+		LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(), "Real-time mode needs GPIO edge events: the sensing loop keeps the normal scheduling.\n\n");
+	}
+	else if(config.rtPriority > 0)
+	{
+		int failed = laserRtEnter(config.rtPriority, config.rtCpu);
+		realTime = !(failed & RT_FAILED_SCHED);
+		if(realTime)
+		{
+			laserLogPost(&log, LOG_SINK_LOG, laserMonotonicNs(), -1,
+			             "Real-time mode: the sensing loop runs at SCHED_FIFO priority %ld.\n\n", config.rtPriority, 0, 0, 0);
+		}
+		else
+		{
+			LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(), "Real-time mode: SCHED_FIFO is not permitted, the sensing loop keeps the normal scheduling.\n\n");
+		}
+		if(failed & RT_FAILED_MLOCK)
+		{
+			LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(), "Real-time mode: the memory could not be locked.\n\n");
+		}
+		if(config.rtCpu >= 0 && (failed & RT_FAILED_AFFINITY))
+		{
+			LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(), "Real-time mode: the sensing loop could not be pinned to its CPU.\n\n");
+		}
+		else if(config.rtCpu >= 0)
+		{
+			laserLogPost(&log, LOG_SINK_LOG, laserMonotonicNs(), -1, rtReserved ?
+			             "Real-time mode: the sensing loop is pinned to CPU %ld, the other threads run on the other CPUs.\n\n" :
+			             "Real-time mode: the sensing loop is pinned to CPU %ld, which it shares with the other threads.\n\n",
+			             config.rtCpu, 0, 0, 0);
+		}
+		if(trace.file != NULL)
+		{
+			LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(), "The trace file is written by the sensing loop: the capture ring keeps its latency bounded.\n\n");
+		}
+	}
 
-					//Assign 1 to laser1HasBroken to indicate that laser 1 has been broken now
-					laser1HasBroken = 1;
+	//Time of the last latency budget miss that was logged, so that a burst of misses is logged once a second
+	uint64_t missLoggedNs = 0;
 
-					//Get current time
-					getTime(Time);
+	//Without edge events, poll adaptively: spin during a crossing and sleep, within the detection latency bound, while idle
+	static LaserPoll poll;
+	uint32_t polledLevels = 0;
+	uint64_t polledEdgeNs = 0;
+	if(events == NULL)
+	{
+		laserPollInit(&poll, config.pollMaxLatencyUs);
+		laserLogPost(&log, LOG_SINK_LOG, laserMonotonicNs(), -1,
+		             "Polling the photodiodes: a beam change is seen within %ld us while no crossing is in progress.\n\n",
+		             config.pollMaxLatencyUs, 0, 0, 0);
+	}
 
-					//Output message into log file that laser 1 has been broken
-					PRINT_MSG(logFile, Time, programName, "Laser 1 has been broken.\n\n");
+	//Continue in while loop indefinitely (so long as the watchdog is kicked)
+	//Exit the loop only if the program is forced to terminate
+	while(1)
+	{
+		//Sample every photodiode with a single read of the level register
+		//Every doorway's transition is decided on this one snapshot
+		uint32_t levels = gpiolib_read_reg(gpio, GPLEV(0));
 
-					//Output statistics to stats file to update counts
-					outputStats(statsFile, laser1Count, laser2Count, numberIn, numberOut, Time, programName);
-				}
-				break;
+		//Stamp the sample with the monotonic time it was captured at
+		uint64_t sampleNs = laserMonotonicNs();
 
-			case ONLY_LASER1_BROKEN:
-				if(laserDiodeStatus(gpio, 1) == 0 && laserDiodeStatus(gpio, 2) == 1)
-				{
-					LASER_STATE = ONLY_LASER1_BROKEN;
-				}
-				else if(laserDiodeStatus(gpio, 1) == 1 && laserDiodeStatus(gpio, 2) == 1)
-				{
-					LASER_STATE = BOTH_UNBROKEN;
-
-					//Get current time
-					getTime(Time);
-
-					//Output message into log file that both lasers are now unbroken
-					PRINT_MSG(logFile, Time, programName, "Both lasers are now unbroken.\n\n");
-
-					//If laser2 has been previously broken, then laser 1 is broken and now both lasers are unbroken
-					//Then, an object has exitted the room
-					if(laser2HasBroken)
-					{
-						//Increment number of objects exitting the room
-						numberOut++;
-						
-						//Get current time
-						getTime(Time);
-
-						//Output message into log file that an object has exitted the room
-						PRINT_MSG(logFile, Time, programName, "An object has exitted the room.\n\n");
-
-						//Output statistics to stats file to update counts
-						outputStats(statsFile, laser1Count, laser2Count, numberIn, numberOut, Time, programName);
-					}
-				}
-				else if(laserDiodeStatus(gpio, 1) == 0 && laserDiodeStatus(gpio, 2) == 0)
-				{
-					LASER_STATE = BOTH_BROKEN;
+		//When polling, the earliest a changed beam can have changed is just after the previous sample
+		if(events == NULL && previousSampleNs != 0 && ((levels ^ polledLevels) & counter.filter.pinMask))
+		{
+			polledEdgeNs = previousSampleNs;
+		}
+		polledLevels = levels;
 
-					//Increment number of times laser 2 is broken
-					laser2Count++;
+		//Count the iteration, and how long it has been since the previous sample without waiting
+		laserMetricAdd(&loopMetrics.iterations, 1);
+		laserMetricAdd(&loopMetrics.levelReads, 1);
+		if(previousSampleNs != 0)
+		{
+			laserMetricMax(&loopMetrics.maxBusyNs, sampleNs - previousSampleNs - waitedNs);
+		}
+		previousSampleNs = sampleNs;
+		waitedNs = 0;
 
-					//Get current time
-					getTime(Time);
+		//Tell the keepalive thread that the sensing loop is still running
+		laserWatchdogHeartbeat(&keepalive, sampleNs);
 
-					//Output message into log file that both lasers are broken
-					PRINT_MSG(logFile, Time, programName, "Both lasers are now broken.\n\n");
+		//Apply a config file read by the reload thread without stopping: the counts and the state machines carry on
+		if(atomic_load_explicit(&reload.pending, memory_order_acquire))
+		{
+			applyConfig(&reload.fresh, &config, &counter, &log);
+			if(events == NULL)
+			{
+				laserPollInit(&poll, config.pollMaxLatencyUs);
+			}
+			atomic_store_explicit(&reload.pending, 0, memory_order_release);
+		}
 
-					//Output statistics to stats file to update counts
-					outputStats(statsFile, laser1Count, laser2Count, numberIn, numberOut, Time, programName);
-				}
-				break;
+		//Record the sample if a beam changed (the filter and state machines run again on replay)
+		if(trace.file != NULL)
+		{
+			laserTraceRecord(&trace, levels, sampleNs);
+		}
 
-			case ONLY_LASER2_BROKEN:
-				if(laserDiodeStatus(gpio, 2) == 0 && laserDiodeStatus(gpio, 1) == 1)
-				{
-					LASER_STATE = ONLY_LASER2_BROKEN;
-				}
-				else if(laserDiodeStatus(gpio, 1) == 1 && laserDiodeStatus(gpio, 2) == 1)
-				{
-					LASER_STATE = BOTH_UNBROKEN;
+		//Capture the raw edges, stamped with the kernel's edge timestamp when there is one
+		if(capture.header != NULL)
+		{
+			uint64_t captureNs = (edgeTimestamp != 0 && edgeTimestamp <= sampleNs) ? edgeTimestamp : sampleNs;
+			laserCaptureSample(&capture, levels, captureNs);
+		}
 
-					//Get current time
-					getTime(Time);
+		//Debounce the sample and run every doorway's state machine, counting and logging any transition
+		unsigned actions = laserCounterProcess(&counter, levels, sampleNs, edgeTimestamp);
 
-					//Output message into log file that both lasers are now unbroken
-					PRINT_MSG(logFile, Time, programName, "Both lasers are now unbroken.\n\n");
+		//Measure the time from the edge that woke the loop to the end of its processing, against the latency budget
+		//(when polling, from the previous sample: the longest it can have taken)
+		uint64_t edgeNs = (edgeTimestamp != 0) ? edgeTimestamp : polledEdgeNs;
+		if(edgeNs != 0 && edgeNs <= sampleNs)
+		{
+			uint64_t decidedNs = laserMonotonicNs();
+			uint64_t latencyNs = decidedNs - edgeNs;
+			if(laserMetricsLatency(&loopMetrics, latencyNs, (uint64_t)config.latencyBudgetUs * 1000) &&
+			   decidedNs - missLoggedNs >= 1000000000ull)
+			{
+				missLoggedNs = decidedNs;
+				laserLogPost(&log, LOG_SINK_LOG, decidedNs, -1, "An edge was processed %ld us after it happened, over the %ld us budget.\n\n",
+				             (long)(latencyNs / 1000), config.latencyBudgetUs, 0, 0);
+			}
+		}
+		edgeTimestamp = 0;
+		polledEdgeNs = 0;
 
-					//If laser1 has been previously broken, then laser 2 is broken and now both lasers are unbroken
-					//Then, an object has entered the room
-					if(laser1HasBroken)
-					{
-						//Increment number of objects entering the room
-						numberIn++;
+		//The program must begin with both lasers of every doorway unbroken
+		//If it did not, exit the program and output an error message to the screen
+		if(actions & ACT_ABORT)
+		{
+			//Print a message to the screen to notify the user why the program has not started
+			perror("Must start with both lasers unbroken: exiting program.\n");
 
-						//Get current time
-						getTime(Time);
+			//Stop the keepalive thread, write 'V' to the watchdog file to disable it and close the watchdog file
+			laserWatchdogStop(&keepalive, 1);
 
-						//Output message into log file that an object has entered the room
-						PRINT_MSG(logFile, Time, programName, "An object has entered the room.\n\n");
+			//Log that the watchdog was disabled
+			LOG_MSG(&log, LOG_SINK_LOG, sampleNs, "The watchdog was disabled. \n\n");
 
-						//Output statistics to stats file to update counts
-						outputStats(statsFile, laser1Count, laser2Count, numberIn, numberOut, Time, programName);
-					}
-				}
-				else if(laserDiodeStatus(gpio, 1) == 0 && laserDiodeStatus(gpio, 2) == 0)
-				{
-					LASER_STATE = BOTH_BROKEN;
+			//Log that the watchdog was closed
+			LOG_MSG(&log, LOG_SINK_LOG, sampleNs, "The watchdog was closed. \n\n");
 
-					//Increment number of times laser 1 is broken
-					laser1Count++;
+			//Release the edge event lines and free the gpio pins
+			laserTraceClose(&trace);
+			laserCaptureClose(&capture);
+			laserShmClose(&shm);
+			if(metricsStarted)
+			{
+				laserMetricsStop(&metrics);
+			}
+			if(counter.fleet != NULL)
+			{
+				laserFleetStop(&fleet);
+			}
+			gpiolib_free_events(events);
+			gpiolib_free_gpio(gpio);
 
-					//Get current time
-					getTime(Time);
+			//Log that the GPIO pins are freed
+			LOG_MSG(&log, LOG_SINK_LOG, sampleNs, "The GPIO pins have been freed. \n\n");
 
-					//Output message into log file that both lasers are broken
-					PRINT_MSG(logFile, Time, programName, "Both lasers are now broken.\n\n");
+			//Write out every queued message and the stats before exiting
+			laserLogStop(&log);
+			laserStatsClose(&stats);
+			laserRollupClose(&rollup);
+			laserArchiveClose(&archive);
 
-					//Output statistics to stats file to update counts
-					outputStats(statsFile, laser1Count, laser2Count, numberIn, numberOut, Time, programName);
-				}
-				break;
+			//Return negative value to indicate an error has occured
+			return -1;
+		}
 
-			case BOTH_BROKEN:
-				if(laserDiodeStatus(gpio, 1)== 0 && laserDiodeStatus(gpio, 2)==0)
-				{
-					LASER_STATE = BOTH_BROKEN;
-				}
-				else if(laserDiodeStatus(gpio, 1)== 0 && laserDiodeStatus(gpio, 2)==1)
-				{
-					LASER_STATE = ONLY_LASER1_BROKEN;
+		//If the beams did not cause a transition, sleep until one of them changes
+		//The wait is bounded so that the heartbeat stays fresh while nobody walks through the door,
+		//and ends early when a filtered change becomes stable so that it is passed on without sleeping past it
+		if(events != NULL && actions == 0)
+		{
+			int waitMs = waitLimitMs;
+			if(counter.filterDeadlineNs != UINT64_MAX)
+			{
+				uint64_t nowNs = laserMonotonicNs();
+				uint64_t untilNs = (counter.filterDeadlineNs > nowNs) ? counter.filterDeadlineNs - nowNs : 0;
+				int untilMs = (int)((untilNs + 999999) / 1000000);
+				waitMs = (untilMs < waitMs) ? untilMs : waitMs;
+			}
 
-					//Get current time
-					getTime(Time);
+			//Write out the recorded changes before sleeping, while nothing is happening
+			if(trace.file != NULL)
+			{
+				laserTraceFlush(&trace);
+			}
 
-					//Output message into log file that only laser 1 is broken after laser 2 has been unbroken
-					PRINT_MSG(logFile, Time, programName, "Laser 2 has unbroken: only Laser 1 is now broken.\n\n");
-				}
-				else if(laserDiodeStatus(gpio, 1)== 1 && laserDiodeStatus(gpio, 2)==0)
-				{
-					LASER_STATE = ONLY_LASER2_BROKEN;
+			//Each pin's own edge time goes to the filter, so the tracker orders edges drained together by when they happened
+			uint64_t waitStartNs = laserMonotonicNs();
+			int waited = gpiolib_wait_events(events, waitMs, &edgeTimestamp, counter.filter.edgeNs);
+			waitedNs = laserMonotonicNs() - waitStartNs;
+			laserMetricAdd(&loopMetrics.waits, 1);
+			laserMetricAdd(&loopMetrics.waitNs, waitedNs);
 
-					//Get current time
-					getTime(Time);
+			if(waited < 0)
+			{
+				//If the edge events fail, keep counting by polling instead
+				gpiolib_free_events(events);
+				events = NULL;
+				LOG_MSG(&log, LOG_SINK_LOG, laserMonotonicNs(), "GPIO edge events failed: polling the photodiodes instead.\n\n");
 
-					//Output message into log file that only laser 2 is broken after laser 1 has been unbroken
-					PRINT_MSG(logFile, Time, programName, "Laser 1 has unbroken: only Laser 2 is now broken.\n\n");
+				//A polling loop must not keep the real-time priority
+				if(realTime)
+				{
+					laserRtLeave();
+					realTime = 0;
 				}
-				break;
-
-			case DONE:	
-				break;
-
-			//If defaults, return -1 to indicate an error has occured
-			default:
-				return -1;
+				laserPollInit(&poll, config.pollMaxLatencyUs);
+			}
 		}
-
-		//Every time the ticksElapsed has reached a multiple of ticksInterval, enter the if statement
-		//(i.e. every fifteenth of the timeout, enter the if statement)
-		//This will keep the watchdog alive and print a message onto the log file
-		if(ticksElapsed % ticksInterval == 0)
+		else if(events == NULL)
 		{
+			//Without edge events, spin while a crossing is in progress and back off to longer sleeps while idle
+			uint64_t nowNs = laserMonotonicNs();
+			uint64_t sleepNs = laserPollNext(&poll, laserCounterBusy(&counter));
+			if(sleepNs > (uint64_t)waitLimitMs * 1000000)
+			{
+				sleepNs = (uint64_t)waitLimitMs * 1000000;
+			}
+			if(sleepNs != 0)
+			{
+				//Write out the recorded changes before sleeping, while nothing is happening
+				if(trace.file != NULL)
+				{
+					laserTraceFlush(&trace);
+				}
 
-			//Get current time
-			getTime(Time);
-
-			//Kick the watchdog
-			ioctl(watchdog, WDIOC_KEEPALIVE, 0);
-
-			//Print a message to the log file that the watchdog has been kicked
-			PRINT_MSG(logFile, Time, programName, "The watchdog has been kicked.\n\n");
+				laserPollSleep(nowNs + sleepNs);
+				waitedNs = laserMonotonicNs() - nowNs;
+				laserMetricAdd(&loopMetrics.pollSleeps, 1);
+				laserMetricAdd(&loopMetrics.pollSleepNs, waitedNs);
+			}
 		}
-
-		//Recalculate the ticksElapsed
-		ticksElapsed = (clock() - ticksInitial);
 	}
 	return 0;
 }
@@ -0,0 +1,115 @@
+#include "laser_stats.h"
+#include "laser_time.h"
+#include "laser_shm.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//This program renders a binary stats file as the text the counter used to write
+//Usage: statsreader <stats file> [-j]
+//       statsreader -s
+//Without -j it prints the current counts, with -j it prints every count change kept in the journal
+//(when several doorways are counted, their lines are prefixed with the doorway number)
+//With -s it prints the live counts the running counter publishes in shared memory instead
+
+//This function prints the four stats lines for one set of counts, in the PRINT_MSG layout
+//When doorway is not -1, the lines are prefixed with the doorway number
+void printStats(LaserTimeCache* cache, int64_t time, const char* programName, int doorway, const LaserCounts* counts)
+{
+	char Time[LASER_TIME_LEN];
+	laserFormatWallTime(cache, time, Time);
+
+	char prefix[24] = "";
+	if(doorway >= 0)
+	{
+		snprintf(prefix, sizeof(prefix), "Doorway %d: ", doorway + 1);
+	}
+
+	printf("%s : %s : %sLaser 1 was broken %d times\n\n", Time, programName, prefix, counts->laser1Count);
+	printf("%s : %s : %sLaser 2 was broken %d times\n\n", Time, programName, prefix, counts->laser2Count);
+	printf("%s : %s : %s%d objects entered the room\n\n", Time, programName, prefix, counts->numberIn);
+	printf("%s : %s : %s%d objects exitted the room\n\n", Time, programName, prefix, counts->numberOut);
+}
+
+int main(const int argc, const char* const argv[])
+{
+	if(argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <stats file> [-j] | -s\n", argv[0]);
+		return -1;
+	}
+
+	//The live state is read from shared memory without touching the stats file
+	if(strcmp(argv[1], "-s") == 0)
+	{
+		const LaserShmState* state = laserShmOpen(SHM_NAME);
+		if(state == NULL)
+		{
+			perror("The shared memory state could not be opened");
+			return -1;
+		}
+
+		LaserShmState live;
+		LaserTimeCache cache = {-1, ""};
+		int read = laserShmRead(state, &live);
+		laserShmUnmap(state);
+		if(read < 0)
+		{
+			perror("The counter stopped in the middle of an update");
+			return -1;
+		}
+
+		printStats(&cache, live.lastEventNs, live.programName, -1, &live.totals);
+		for(uint32_t i = 0; live.numDoorways > 1 && i < live.numDoorways && i < LASER_MAX_DOORWAYS; i++)
+		{
+			printStats(&cache, live.lastEventNs, live.programName, (int)i, &live.doorways[i].counts);
+		}
+		return 0;
+	}
+
+	LaserStats stats;
+	if(laserStatsMap(&stats, argv[1]) < 0)
+	{
+		perror("The stats file could not be opened");
+		return -1;
+	}
+
+	StatsHeader header;
+	LaserTimeCache cache = {-1, ""};
+	if(laserStatsRead(&stats, &header) < 0)
+	{
+		perror("The stats file is stuck in the middle of an update");
+		laserStatsClose(&stats);
+		return -1;
+	}
+
+	if(argc > 2 && strcmp(argv[2], "-j") == 0)
+	{
+		//The journal is a ring: start at the oldest event that has not been overwritten yet
+		uint64_t first = 0;
+		if(header.journalNext > header.journalCapacity)
+		{
+			first = header.journalNext - header.journalCapacity;
+		}
+
+		for(uint64_t i = first; i < header.journalNext; i++)
+		{
+			//With a single doorway its counts are the totals, so the lines are printed without a prefix
+			const StatsEvent* event = &stats.journal[i % header.journalCapacity];
+			int doorway = (header.numDoorways > 1) ? event->doorway : -1;
+			printStats(&cache, event->time, header.programName, doorway, &event->counts);
+		}
+	}
+	else
+	{
+		//Print the totals, followed by each doorway when there is more than one
+		printStats(&cache, header.updated, header.programName, -1, &header.counts);
+		for(uint32_t i = 0; header.numDoorways > 1 && i < header.numDoorways && i < LASER_MAX_DOORWAYS; i++)
+		{
+			printStats(&cache, header.updated, header.programName, (int)i, &header.doorways[i]);
+		}
+	}
+
+	laserStatsClose(&stats);
+	return 0;
+}